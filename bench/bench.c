@@ -0,0 +1,317 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Times each step of making the docs for a folder of sources, one step at a time over every
+//  file, so that each one is measured on its own:
+//   read    read_whole_file
+//   parse   parse_source_file and sort_source_docs
+//   link    symbols_add_source
+//   render  generate_html, into a sink that holds the page
+//   output  writing the held pages out
+// Everything runs on one thread. Each run starts from scratch, and the fastest of the runs is
+//  kept for each step. The files will be in the page cache after the first run, so "read"
+//  measures the system calls and copies rather than the disk.
+
+enum { PHASE_READ, PHASE_PARSE, PHASE_LINK, PHASE_RENDER, PHASE_OUTPUT, N_PHASES };
+
+static const char *phase_names[N_PHASES] = { "read", "parse", "link", "render", "output" };
+
+typedef struct {
+	double wall;
+	double cpu;
+	long bytes;
+	int files;
+} Phase_Result;
+
+typedef struct {
+	struct timespec wall;
+	struct timespec cpu;
+} Stamp;
+
+static Stamp stamp_now(void)
+{
+	Stamp s;
+	clock_gettime(CLOCK_MONOTONIC, &s.wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &s.cpu);
+	return s;
+}
+
+static double seconds_between(struct timespec a, struct timespec b)
+{
+	return (double)(b.tv_sec - a.tv_sec) + (double)(b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static void phase_end(Phase_Result *r, Stamp start, long bytes, int files)
+{
+	Stamp end = stamp_now();
+	r->wall = seconds_between(start.wall, end.wall);
+	r->cpu = seconds_between(start.cpu, end.cpu);
+	r->bytes = bytes;
+	r->files = files;
+}
+
+// The page name a source gets inside the output, as with --in-folder
+static char *bench_page_name(const char *path, int root_len)
+{
+	const char *rel = path + root_len;
+	while (*rel == '/')
+		rel++;
+
+	int len = strlen(rel);
+	const char *dot = strrchr(rel, '.');
+	const char *slash = strrchr(rel, '/');
+	if (dot && (!slash || dot > slash + 1))
+		len = dot - rel;
+
+	char *name = malloc(len + 6);
+	memcpy(name, rel, len);
+	strcpy(name + len, ".html");
+	return name;
+}
+
+static void bench_run(char **paths, char **names, int n, const Stylesheet *css, int out_fd, Phase_Result *results)
+{
+	Arena *arenas = calloc(n, sizeof(Arena));
+	Source *sources = calloc(n, sizeof(Source));
+	Sink *sinks = calloc(n, sizeof(Sink));
+	Chunk_Pool *chunks = chunk_pool_create();
+
+	// read_whole_file splits the path it's given, so each run works on copies
+	char **path_copies = malloc(n * sizeof(char*));
+	for (int i = 0; i < n; i++)
+		path_copies[i] = strdup(paths[i]);
+
+	long in_bytes = 0;
+	int n_read = 0;
+	Stamp t = stamp_now();
+	for (int i = 0; i < n; i++) {
+		source_init(&sources[i], &arenas[i]);
+		sources[i].file = read_whole_file(path_copies[i]);
+		sources[i].sort_order = SORT_CONTENT;
+		sources[i].access_level = DOC_ACCESS_PRIVATE;
+		if (sources[i].file.buf) {
+			in_bytes += sources[i].file.size;
+			n_read++;
+		}
+	}
+	phase_end(&results[PHASE_READ], t, in_bytes, n_read);
+
+	t = stamp_now();
+	for (int i = 0; i < n; i++) {
+		if (!sources[i].file.buf)
+			continue;
+		parse_source_file(&sources[i]);
+		sort_source_docs(&sources[i]);
+	}
+	phase_end(&results[PHASE_PARSE], t, in_bytes, n_read);
+
+	Symbols *symbols = symbols_create();
+	t = stamp_now();
+	for (int i = 0; i < n; i++) {
+		if (sources[i].file.buf)
+			symbols_add_source(symbols, &sources[i], i, names[i]);
+	}
+	phase_end(&results[PHASE_LINK], t, in_bytes, n_read);
+
+	long out_bytes = 0;
+	t = stamp_now();
+	for (int i = 0; i < n; i++) {
+		sink_init(&sinks[i], -1);
+		sinks[i].pool = chunks;
+		if (!sources[i].file.buf)
+			continue;
+
+		Page_Ref page = { .symbols = symbols, .name = names[i], .index = i };
+		generate_html(&sources[i], &page, css, &sinks[i]);
+		out_bytes += sinks[i].size;
+	}
+	phase_end(&results[PHASE_RENDER], t, out_bytes, n_read);
+
+	t = stamp_now();
+	for (int i = 0; i < n; i++) {
+		sink_drain(&sinks[i], out_fd);
+		sink_close(&sinks[i]);
+	}
+	phase_end(&results[PHASE_OUTPUT], t, out_bytes, n_read);
+
+	for (int i = 0; i < n; i++) {
+		source_close(&sources[i]);
+		free(path_copies[i]);
+	}
+	free(path_copies);
+	symbols_destroy(symbols);
+	chunk_pool_destroy(chunks);
+	free(arenas);
+	free(sinks);
+	free(sources);
+}
+
+static void print_json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', f);
+		if ((unsigned char)*str >= 0x20)
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+static void write_json(FILE *f, const char *label, const char *folder, int n_files, int n_runs, const Phase_Result *best)
+{
+	fprintf(f, "{\n");
+	fprintf(f, "  \"label\": ");
+	print_json_string(f, label);
+	fprintf(f, ",\n  \"input\": ");
+	print_json_string(f, folder);
+	fprintf(f, ",\n");
+	fprintf(f, "  \"files\": %d,\n", n_files);
+	fprintf(f, "  \"runs\": %d,\n", n_runs);
+	fprintf(f, "  \"phases\": {\n");
+
+	for (int p = 0; p < N_PHASES; p++) {
+		const Phase_Result *r = &best[p];
+		double wall = r->wall > 0 ? r->wall : 1e-9;
+		fprintf(f,
+			"    \"%s\": { \"seconds\": %.6f, \"cpu_seconds\": %.6f, \"bytes\": %ld, \"files\": %d, \"mb_per_s\": %.2f, \"files_per_s\": %.1f }%s\n",
+			phase_names[p], r->wall, r->cpu, r->bytes, r->files,
+			(double)r->bytes / (1024.0 * 1024.0) / wall, (double)r->files / wall,
+			p < N_PHASES - 1 ? "," : "");
+	}
+
+	fprintf(f, "  }\n}\n");
+}
+
+static void print_help()
+{
+	puts(
+		"Documentation Generator Benchmark\n\n"
+		"Options:\n"
+		"   --in-folder <folder>\n"
+		"      Folder of sources to measure, eg. one made by docs-corpus. Required\n"
+		"   --exts <list of file extensions>\n"
+		"      Defaults to \"java,kt,swift\"\n"
+		"   --css <file>\n"
+		"      Defaults to \"style.css\"\n"
+		"   --runs <n>\n"
+		"      How many times to go over the sources. Defaults to 5\n"
+		"   --out <file>\n"
+		"      Where the pages are written in the output step. Defaults to /dev/null\n"
+		"   --json <file>\n"
+		"      Also write the results here, to compare against other runs\n"
+		"   --label <text>\n"
+		"      Name for this run in the results, eg. a commit. Defaults to \"\"\n"
+	);
+}
+
+int main(int argc, char **argv)
+{
+	char *folder = NULL;
+	char *exts = "java,kt,swift";
+	char *css_name = "style.css";
+	char *out_name = "/dev/null";
+	char *json_name = NULL;
+	char *label = "";
+	int n_runs = 5;
+
+	for (int i = 1; i < argc-1; i += 2) {
+		if (!strcmp(argv[i], "--in-folder"))
+			folder = argv[i+1];
+		else if (!strcmp(argv[i], "--exts"))
+			exts = argv[i+1];
+		else if (!strcmp(argv[i], "--css"))
+			css_name = argv[i+1];
+		else if (!strcmp(argv[i], "--runs"))
+			n_runs = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "--out"))
+			out_name = argv[i+1];
+		else if (!strcmp(argv[i], "--json"))
+			json_name = argv[i+1];
+		else if (!strcmp(argv[i], "--label"))
+			label = argv[i+1];
+		else {
+			print_help();
+			return 1;
+		}
+	}
+
+	if (!folder || (argc - 1) % 2 != 0) {
+		print_help();
+		return 1;
+	}
+	if (n_runs < 1)
+		n_runs = 1;
+
+	File css_file = read_whole_file(strdup(css_name));
+	if (!css_file.buf)
+		return 2;
+
+	Stylesheet css;
+	stylesheet_init(&css, &css_file, false, false);
+
+	int out_fd = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		printf("Could not write \"%s\"\n", out_name);
+		return 2;
+	}
+
+	Vector paths = {0};
+	Vector names = {0};
+	int root_len = strlen(folder);
+
+	Walk *walk = walk_start(folder, exts, 1);
+	char *path;
+	while ((path = walk_next(walk))) {
+		*(char**)vector_add(&paths, sizeof(char*), 1) = path;
+		*(char**)vector_add(&names, sizeof(char*), 1) = bench_page_name(path, root_len);
+	}
+	walk_finish(walk);
+
+	int n = paths.n;
+	if (n == 0) {
+		printf("No sources in \"%s\"\n", folder);
+		return 2;
+	}
+
+	Phase_Result best[N_PHASES] = {0};
+	for (int run = 0; run < n_runs; run++) {
+		Phase_Result results[N_PHASES];
+		bench_run(paths.buf, names.buf, n, &css, out_fd, results);
+
+		for (int p = 0; p < N_PHASES; p++) {
+			if (run == 0 || results[p].wall < best[p].wall)
+				best[p] = results[p];
+		}
+	}
+
+	write_json(stdout, label, folder, n, n_runs, best);
+
+	if (json_name) {
+		FILE *f = fopen(json_name, "w");
+		if (!f) {
+			printf("Could not write \"%s\"\n", json_name);
+			return 2;
+		}
+		write_json(f, label, folder, n, n_runs, best);
+		fclose(f);
+	}
+
+	for (int i = 0; i < n; i++) {
+		free(((char**)paths.buf)[i]);
+		free(((char**)names.buf)[i]);
+	}
+	vector_free(&paths);
+	vector_free(&names);
+	stylesheet_free(&css);
+	file_close(&css_file);
+	close(out_fd);
+	return 0;
+}
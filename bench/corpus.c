@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Writes a synthetic corpus of Java, Kotlin and Swift sources for benchmarking.
+// The same options and seed always give the same files, byte for byte, so that runs made
+//  on different builds are measured against the same input. Each file gets its own stream
+//  of random numbers, so the first N files don't change when more are asked for.
+
+typedef struct {
+	uint64_t state;
+} Rng;
+
+static uint64_t rng_next(Rng *rng)
+{
+	// xorshift64*
+	uint64_t x = rng->state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static int rng_below(Rng *rng, int n)
+{
+	return n > 0 ? (int)((rng_next(rng) >> 33) % (uint64_t)n) : 0;
+}
+
+static bool rng_percent(Rng *rng, int percent)
+{
+	return rng_below(rng, 100) < percent;
+}
+
+typedef struct {
+	int n_files;
+	int file_size;
+	int comment_percent;
+	int max_depth;
+	int non_ascii_percent;
+	uint64_t seed;
+	const char *langs;
+	const char *out;
+} Corpus_Options;
+
+enum { LANG_JAVA, LANG_KOTLIN, LANG_SWIFT };
+
+typedef struct {
+	Rng rng;
+	const Corpus_Options *opts;
+	int lang;
+	char *buf;
+	int n;
+	int cap;
+	int n_names;
+} Writer;
+
+static const char *words[] = {
+	"returns", "the", "value", "of", "a", "given", "index", "into", "buffer", "list",
+	"node", "when", "called", "from", "any", "thread", "this", "is", "cached", "after",
+	"first", "use", "and", "never", "null", "unless", "closed", "size", "count", "key",
+};
+
+static const char *non_ascii_words[] = {
+	"größe", "naïve", "façade", "café", "déjà", "señal", "Ωmega", "λambda",
+	"значение", "индекс", "データ", "配列", "문자열", "→", "µs", "✓",
+};
+
+static const char *type_names[] = { "int", "long", "String", "boolean", "double", "Object" };
+static const char *kt_types[] = { "Int", "Long", "String", "Boolean", "Double", "Any" };
+static const char *swift_types[] = { "Int", "Int64", "String", "Bool", "Double", "AnyObject" };
+
+#define COUNT(a) (int)(sizeof(a) / sizeof((a)[0]))
+
+static void put(Writer *w, const char *str, int len)
+{
+	if (w->n + len + 1 > w->cap) {
+		w->cap = (w->n + len + 1) * 2;
+		w->buf = realloc(w->buf, w->cap);
+	}
+	memcpy(w->buf + w->n, str, len);
+	w->n += len;
+}
+
+static void puts_w(Writer *w, const char *str)
+{
+	put(w, str, strlen(str));
+}
+
+static void printf_w(Writer *w, const char *fmt, ...)
+{
+	char tmp[512];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(tmp, sizeof(tmp), fmt, args);
+	va_end(args);
+	put(w, tmp, len < (int)sizeof(tmp) ? len : (int)sizeof(tmp) - 1);
+}
+
+static void indent(Writer *w, int depth)
+{
+	for (int i = 0; i < depth; i++)
+		put(w, "    ", 4);
+}
+
+static const char *type_name(Writer *w)
+{
+	int t = rng_below(&w->rng, COUNT(type_names));
+	return w->lang == LANG_JAVA ? type_names[t] : w->lang == LANG_KOTLIN ? kt_types[t] : swift_types[t];
+}
+
+static void sentence(Writer *w, int n_words)
+{
+	for (int i = 0; i < n_words; i++) {
+		if (i > 0)
+			put(w, " ", 1);
+		if (rng_percent(&w->rng, w->opts->non_ascii_percent))
+			puts_w(w, non_ascii_words[rng_below(&w->rng, COUNT(non_ascii_words))]);
+		else
+			puts_w(w, words[rng_below(&w->rng, COUNT(words))]);
+	}
+	put(w, ".", 1);
+}
+
+// A doc comment, with a few lines of description and maybe some tags
+static void doc_comment(Writer *w, int depth, int n_params, bool returns)
+{
+	indent(w, depth);
+	puts_w(w, "/**\n");
+
+	int n_lines = 1 + rng_below(&w->rng, 4);
+	for (int i = 0; i < n_lines; i++) {
+		indent(w, depth);
+		puts_w(w, " * ");
+		sentence(w, 4 + rng_below(&w->rng, 10));
+		puts_w(w, "\n");
+	}
+
+	for (int i = 0; i < n_params; i++) {
+		indent(w, depth);
+		printf_w(w, " * @param p%d ", i);
+		sentence(w, 2 + rng_below(&w->rng, 5));
+		puts_w(w, "\n");
+	}
+	if (returns) {
+		indent(w, depth);
+		puts_w(w, " * @return ");
+		sentence(w, 2 + rng_below(&w->rng, 5));
+		puts_w(w, "\n");
+	}
+	if (rng_percent(&w->rng, 5)) {
+		indent(w, depth);
+		puts_w(w, " * @deprecated use something else\n");
+	}
+
+	indent(w, depth);
+	puts_w(w, " */\n");
+}
+
+static void line_comment(Writer *w, int depth)
+{
+	indent(w, depth);
+	puts_w(w, "// ");
+	sentence(w, 3 + rng_below(&w->rng, 6));
+	puts_w(w, "\n");
+}
+
+static const char *access_word(Writer *w)
+{
+	static const char *java[] = { "public ", "protected ", "private ", "" };
+	static const char *kotlin[] = { "", "protected ", "private ", "internal " };
+	static const char *swift[] = { "public ", "open ", "private ", "" };
+	int a = rng_below(&w->rng, 4);
+	return w->lang == LANG_JAVA ? java[a] : w->lang == LANG_KOTLIN ? kotlin[a] : swift[a];
+}
+
+static void field(Writer *w, int depth)
+{
+	int id = w->n_names++;
+	if (rng_percent(&w->rng, w->opts->comment_percent))
+		doc_comment(w, depth, 0, false);
+
+	indent(w, depth);
+	if (w->lang == LANG_JAVA)
+		printf_w(w, "%s%s%s field%d = %d;\n", access_word(w), rng_percent(&w->rng, 30) ? "static final " : "", type_name(w), id, id);
+	else if (w->lang == LANG_KOTLIN)
+		printf_w(w, "%s%s field%d: %s = TODO()\n", access_word(w), rng_percent(&w->rng, 50) ? "val" : "var", id, type_name(w));
+	else
+		printf_w(w, "%s%s field%d: %s\n", access_word(w), rng_percent(&w->rng, 50) ? "let" : "var", id, type_name(w));
+}
+
+static void method(Writer *w, int depth)
+{
+	int id = w->n_names++;
+	int n_params = rng_below(&w->rng, 4);
+	bool returns = rng_percent(&w->rng, 60);
+
+	if (rng_percent(&w->rng, w->opts->comment_percent))
+		doc_comment(w, depth, n_params, returns);
+	if (w->lang == LANG_JAVA && rng_percent(&w->rng, 10)) {
+		indent(w, depth);
+		puts_w(w, "@Override\n");
+	}
+
+	indent(w, depth);
+	const char *ret = returns ? type_name(w) : NULL;
+	if (w->lang == LANG_JAVA)
+		printf_w(w, "%s%s method%d(", access_word(w), ret ? ret : "void", id);
+	else if (w->lang == LANG_KOTLIN)
+		printf_w(w, "%sfun method%d(", access_word(w), id);
+	else
+		printf_w(w, "%sfunc method%d(", access_word(w), id);
+
+	for (int i = 0; i < n_params; i++) {
+		if (i > 0)
+			puts_w(w, ", ");
+		if (w->lang == LANG_JAVA)
+			printf_w(w, "%s p%d", type_name(w), i);
+		else
+			printf_w(w, "p%d: %s", i, type_name(w));
+	}
+	puts_w(w, ")");
+	if (ret && w->lang != LANG_JAVA)
+		printf_w(w, w->lang == LANG_KOTLIN ? ": %s" : " -> %s", ret);
+	puts_w(w, " {\n");
+
+	int n_lines = 1 + rng_below(&w->rng, 6);
+	for (int i = 0; i < n_lines; i++) {
+		if (rng_percent(&w->rng, w->opts->comment_percent / 3))
+			line_comment(w, depth + 1);
+		indent(w, depth + 1);
+		if (w->lang == LANG_JAVA)
+			printf_w(w, "int v%d = p0 * %d + field%d;\n", i, rng_below(&w->rng, 100), rng_below(&w->rng, id + 1));
+		else
+			printf_w(w, "%s v%d = %d + %d\n", w->lang == LANG_KOTLIN ? "val" : "let", i, rng_below(&w->rng, 100), i);
+	}
+	if (ret) {
+		indent(w, depth + 1);
+		puts_w(w, w->lang == LANG_JAVA ? "return null;\n" : "return TODO()\n");
+	}
+
+	indent(w, depth);
+	puts_w(w, "}\n\n");
+}
+
+static void class_body(Writer *w, int depth, int end);
+
+static void class_decl(Writer *w, int depth, int end)
+{
+	int id = w->n_names++;
+	if (rng_percent(&w->rng, w->opts->comment_percent))
+		doc_comment(w, depth, 0, false);
+
+	indent(w, depth);
+	const char *kinds[3][3] = {
+		{ "class", "interface", "static class" },
+		{ "class", "interface", "object" },
+		{ "class", "protocol", "struct" },
+	};
+	const char *kind = kinds[w->lang][rng_below(&w->rng, 3)];
+	if (depth == 0 && !strcmp(kind, "static class"))
+		kind = "class";
+
+	printf_w(w, "%s%s Type%d", depth == 0 ? "public " : access_word(w), kind, id);
+	if (rng_percent(&w->rng, 30)) {
+		if (w->lang == LANG_JAVA)
+			puts_w(w, " extends Base implements Comparable<Object>");
+		else
+			puts_w(w, w->lang == LANG_KOTLIN ? " : Base(), Comparable<Any>" : ": Base, Equatable");
+	}
+	puts_w(w, " {\n\n");
+
+	class_body(w, depth + 1, end);
+
+	indent(w, depth);
+	puts_w(w, "}\n\n");
+}
+
+// Members until the file reaches end bytes, with a nested type now and then
+static void class_body(Writer *w, int depth, int end)
+{
+	int n_members = 0;
+	while (w->n < end || n_members == 0) {
+		int r = rng_below(&w->rng, 100);
+		if (depth < w->opts->max_depth && r < 8) {
+			// a nested type takes a share of what's left
+			int left = end - w->n;
+			class_decl(w, depth, w->n + left / (2 + rng_below(&w->rng, 3)));
+		}
+		else if (r < 40) {
+			field(w, depth);
+		}
+		else {
+			method(w, depth);
+		}
+		n_members++;
+	}
+}
+
+static const char *lang_ext[] = { "java", "kt", "swift" };
+
+static int make_dirs(char *path)
+{
+	for (char *p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		int ret = mkdir(path, 0755);
+		*p = '/';
+		if (ret != 0 && errno != EEXIST)
+			return -1;
+	}
+	return 0;
+}
+
+static bool write_file(const Corpus_Options *opts, int idx, const int *langs, int n_langs)
+{
+	Writer w = {0};
+	w.opts = opts;
+	w.rng.state = (opts->seed ^ ((uint64_t)(idx + 1) * 0x9e3779b97f4a7c15ULL)) | 1;
+	for (int i = 0; i < 4; i++)
+		rng_next(&w.rng);
+	w.lang = langs[idx % n_langs];
+
+	int pkg = idx / 100;
+	if (w.lang == LANG_SWIFT)
+		puts_w(&w, "import Foundation\n\n");
+	else
+		printf_w(&w, "package bench.p%d%s\n\n", pkg, w.lang == LANG_JAVA ? ";" : "");
+
+	// sizes vary by up to half either way, so the corpus isn't all one size
+	int size = opts->file_size / 2 + rng_below(&w.rng, opts->file_size + 1);
+	class_decl(&w, 0, size);
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/p%d/File%d.%s", opts->out, pkg, idx, lang_ext[w.lang]);
+
+	bool ok = make_dirs(path) == 0;
+	FILE *f = ok ? fopen(path, "wb") : NULL;
+	if (f) {
+		ok = fwrite(w.buf, 1, w.n, f) == (size_t)w.n;
+		ok = fclose(f) == 0 && ok;
+	}
+	else {
+		ok = false;
+	}
+
+	if (!ok)
+		printf("Could not write \"%s\"\n", path);
+
+	free(w.buf);
+	return ok;
+}
+
+static void print_help()
+{
+	puts(
+		"Benchmark Corpus Generator\n\n"
+		"Options:\n"
+		"   --out <folder>\n"
+		"      Where to write the corpus. Required\n"
+		"   --files <n>\n"
+		"      Number of source files. Defaults to 1000\n"
+		"   --size <bytes>\n"
+		"      Average size of a file. Defaults to 8000\n"
+		"   --comments <percent>\n"
+		"      How many declarations have a doc comment. Defaults to 70\n"
+		"   --depth <n>\n"
+		"      How deep types may be nested. Defaults to 3\n"
+		"   --non-ascii <percent>\n"
+		"      How many words in comments aren't ASCII. Defaults to 5\n"
+		"   --langs <list>\n"
+		"      Comma separated, out of \"java\", \"kt\" and \"swift\"\n"
+		"      Files take turns in this order. Defaults to \"java,kt,swift\"\n"
+		"   --seed <n>\n"
+		"      Defaults to 1\n"
+	);
+}
+
+int main(int argc, char **argv)
+{
+	Corpus_Options opts = {0};
+	opts.n_files = 1000;
+	opts.file_size = 8000;
+	opts.comment_percent = 70;
+	opts.max_depth = 3;
+	opts.non_ascii_percent = 5;
+	opts.seed = 1;
+	opts.langs = "java,kt,swift";
+
+	for (int i = 1; i < argc-1; i += 2) {
+		if (!strcmp(argv[i], "--out"))
+			opts.out = argv[i+1];
+		else if (!strcmp(argv[i], "--files"))
+			opts.n_files = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "--size"))
+			opts.file_size = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "--comments"))
+			opts.comment_percent = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "--depth"))
+			opts.max_depth = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "--non-ascii"))
+			opts.non_ascii_percent = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "--langs"))
+			opts.langs = argv[i+1];
+		else if (!strcmp(argv[i], "--seed"))
+			opts.seed = strtoull(argv[i+1], NULL, 10);
+		else {
+			print_help();
+			return 1;
+		}
+	}
+
+	if (!opts.out || (argc - 1) % 2 != 0) {
+		print_help();
+		return 1;
+	}
+
+	int langs[8];
+	int n_langs = 0;
+	for (const char *p = opts.langs; *p && n_langs < 8; ) {
+		const char *comma = strchr(p, ',');
+		int len = comma ? comma - p : (int)strlen(p);
+		for (int l = 0; l < 3; l++) {
+			if ((int)strlen(lang_ext[l]) == len && !memcmp(p, lang_ext[l], len))
+				langs[n_langs++] = l;
+		}
+		p += comma ? len + 1 : len;
+	}
+	if (n_langs == 0) {
+		print_help();
+		return 1;
+	}
+
+	if (opts.file_size < 64)
+		opts.file_size = 64;
+
+	for (int i = 0; i < opts.n_files; i++) {
+		if (!write_file(&opts, i, langs, n_langs))
+			return 2;
+	}
+
+	return 0;
+}
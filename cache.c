@@ -0,0 +1,504 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Bump whenever the parser or generator would produce different output for the same input
+#define CACHE_VERSION 7
+#define CACHE_MAGIC   0x65686361636f6464ULL // "ddocache"
+
+typedef struct {
+	uint64_t magic;
+	uint64_t key;
+	uint64_t contents; // the key only says which page an entry is for, this says what it was made from
+	int version;
+	int detail_size;
+	int tag_size;
+	int64_t file_size;
+	Span package_name;
+	Span class_name;
+	Span extends_name;
+	int n_implements;
+	int n_docs;
+	int n_tags;
+	int n_descs;
+	int html_size;
+	int n_lookups; // the names the page looked up, which follow it, each with where it led then
+} Cache_Header;
+
+struct Cache_Used {
+	pthread_mutex_t lock;
+	Vector keys;
+};
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const uint8_t *p = data;
+	uint64_t h = seed ^ (len * m);
+
+	while (len >= 8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		k *= m;
+		k ^= k >> 47;
+		k *= m;
+		h ^= k;
+		h *= m;
+		p += 8;
+		len -= 8;
+	}
+
+	uint64_t tail = 0;
+	for (size_t i = 0; i < len; i++)
+		tail |= (uint64_t)p[i] << (i * 8);
+
+	if (len > 0) {
+		h ^= tail;
+		h *= m;
+	}
+
+	h ^= h >> 47;
+	h *= m;
+	h ^= h >> 47;
+	return h;
+}
+
+bool cache_open(Cache *cache, const char *dir, uint64_t config_hash)
+{
+	cache->dir = NULL;
+	cache->used = NULL;
+	cache->config_hash = hash_bytes(&config_hash, sizeof(uint64_t), CACHE_VERSION);
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		printf("Could not create cache folder \"%s\"\n", dir);
+		return false;
+	}
+
+	int len = strlen(dir);
+	cache->dir = malloc(len + 1);
+	strcpy(cache->dir, dir);
+
+	cache->used = calloc(1, sizeof(Cache_Used));
+	pthread_mutex_init(&cache->used->lock, NULL);
+	return true;
+}
+
+// Entries are per page rather than per source: two copies of a file in different places get
+//  the same tables, but not the same links. The key leaves out the contents, so that a source
+//  that changed replaces its entry rather than adding another one.
+static uint64_t cache_key(Cache *cache, Source *source, const char *page)
+{
+	uint64_t seed = cache->config_hash;
+	if (source->file.name)
+		seed = hash_bytes(source->file.name, strlen(source->file.name), seed);
+	if (page)
+		seed = hash_bytes(page, strlen(page), seed);
+	return seed;
+}
+
+static uint64_t cache_contents(Cache *cache, Source *source)
+{
+	return hash_bytes(source->file.buf, source->file.size, cache->config_hash);
+}
+
+// Named after the version and the options too, so that cache_evict can tell which entries
+//  this run could have used
+#define CACHE_ENTRY_NAME "v%d-%016llx-%016llx.cache"
+
+static void cache_entry_path(Cache *cache, uint64_t key, char *path, int path_size)
+{
+	snprintf(path, path_size, "%s/" CACHE_ENTRY_NAME, cache->dir, CACHE_VERSION,
+		(unsigned long long)cache->config_hash, (unsigned long long)key);
+}
+
+static void cache_note_used(Cache *cache, uint64_t key)
+{
+	pthread_mutex_lock(&cache->used->lock);
+	*(uint64_t*)vector_add(&cache->used->keys, sizeof(uint64_t), 1) = key;
+	pthread_mutex_unlock(&cache->used->lock);
+}
+
+static bool read_vector(int fd, Vector *vec, int elem_size, int count)
+{
+	if (count <= 0)
+		return true;
+
+	char *space = vector_add(vec, elem_size, count);
+	size_t want = (size_t)elem_size * count;
+	size_t off = 0;
+
+	while (off < want) {
+		ssize_t got = read(fd, space + off, want - off);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		off += got;
+	}
+	return true;
+}
+
+// Docs are stored a column at a time, as they're kept
+static bool read_doc_table(int fd, Doc_Table *t, int count)
+{
+	if (!(read_vector(fd, &t->bits, sizeof(uint32_t), count) &&
+		read_vector(fd, &t->parent, sizeof(int), count) &&
+		read_vector(fd, &t->name, sizeof(Span), count) &&
+		read_vector(fd, &t->main, sizeof(Tag), count) &&
+		read_vector(fd, &t->detail, sizeof(Doc_Detail), count)))
+		return false;
+
+	t->n = count > 0 ? count : 0;
+	return true;
+}
+
+static bool pread_all(int fd, void *data, size_t len, off_t off)
+{
+	char *p = data;
+	while (len > 0) {
+		ssize_t got = pread(fd, p, len, off);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		p += got;
+		off += got;
+		len -= got;
+	}
+	return true;
+}
+
+static bool read_header(int fd, Cache_Header *hdr, Cache *cache, uint64_t key, Source *source)
+{
+	return read(fd, hdr, sizeof(Cache_Header)) == sizeof(Cache_Header) &&
+		hdr->magic == CACHE_MAGIC &&
+		hdr->key == key &&
+		hdr->contents == cache_contents(cache, source) &&
+		hdr->version == CACHE_VERSION &&
+		hdr->detail_size == sizeof(Doc_Detail) &&
+		hdr->tag_size == sizeof(Tag) &&
+		hdr->file_size == source->file.size &&
+		hdr->html_size >= 0 &&
+		hdr->n_lookups >= 0;
+}
+
+// Where the stored page starts, from the end of the entry, which is all of it but the tables
+static off_t cache_page_start(const Cache_Header *hdr, off_t entry_size)
+{
+	return entry_size - hdr->html_size - (off_t)hdr->n_lookups * sizeof(Symbol_State);
+}
+
+// On a hit, fills in everything parse_source_file would have. The stored page comes later,
+//  from cache_load_page, once it's known whether the links on it are still right.
+bool cache_load(Cache *cache, Source *source, const char *page)
+{
+	if (!cache || !cache->dir || !source->file.buf)
+		return false;
+
+	uint64_t key = cache_key(cache, source, page);
+	cache_note_used(cache, key);
+
+	char path[1024];
+	cache_entry_path(cache, key, path, sizeof(path));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	Cache_Header hdr;
+	bool ok = read_header(fd, &hdr, cache, key, source);
+
+	Source loaded;
+	source_init(&loaded, source->arena);
+
+	if (ok) {
+		ok = read_vector(fd, &loaded.implements_names, sizeof(Span), hdr.n_implements) &&
+			read_doc_table(fd, &loaded.docs, hdr.n_docs) &&
+			read_vector(fd, &loaded.tags, sizeof(Tag), hdr.n_tags) &&
+			read_vector(fd, &loaded.descs, sizeof(Span), hdr.n_descs);
+	}
+
+	// make sure the whole page is there before any of it is passed on
+	struct stat st;
+	off_t page_start = ok ? lseek(fd, 0, SEEK_CUR) : -1;
+	ok = ok && fstat(fd, &st) == 0 && page_start >= 0 && cache_page_start(&hdr, st.st_size) == page_start;
+
+	if (!ok) {
+		close(fd);
+		vector_free(&loaded.implements_names);
+		doc_table_free(&loaded.docs);
+		vector_free(&loaded.tags);
+		vector_free(&loaded.descs);
+		return false;
+	}
+
+	source->package_name = hdr.package_name;
+	source->class_name = hdr.class_name;
+	source->extends_name = hdr.extends_name;
+	source->implements_names = loaded.implements_names;
+	source->docs = loaded.docs;
+	source->tags = loaded.tags;
+	source->descs = loaded.descs;
+	index_doc_kinds(source);
+
+	close(fd);
+	return true;
+}
+
+// Streams the stored page into out, if every name it looked up still leads where it did, and
+//  if lookups is given, puts those names in it, sorted, as rendering the page would have.
+// out must only find its destination through get_fd. If false comes back after part of the page
+//  was read, that part is still in out, and the caller has to start the sink again.
+bool cache_load_page(Cache *cache, Source *source, const char *page, Symbols *symbols, Vector *lookups, Sink *out)
+{
+	if (!cache || !cache->dir || !source->file.buf)
+		return false;
+
+	uint64_t key = cache_key(cache, source, page);
+
+	char path[1024];
+	cache_entry_path(cache, key, path, sizeof(path));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	// the page and its lookups are the last things in the entry
+	Cache_Header hdr;
+	struct stat st;
+	bool ok = read_header(fd, &hdr, cache, key, source) &&
+		fstat(fd, &st) == 0 &&
+		cache_page_start(&hdr, st.st_size) >= (off_t)sizeof(Cache_Header);
+
+	Symbol_State *states = NULL;
+	if (ok && hdr.n_lookups > 0) {
+		states = malloc((size_t)hdr.n_lookups * sizeof(Symbol_State));
+		ok = pread_all(fd, states, (size_t)hdr.n_lookups * sizeof(Symbol_State), st.st_size - (off_t)hdr.n_lookups * sizeof(Symbol_State));
+	}
+
+	for (int i = 0; ok && i < hdr.n_lookups; i++)
+		ok = symbols_state(symbols, states[i].key) == states[i].value;
+
+	if (!ok) {
+		free(states);
+		close(fd);
+		return false;
+	}
+
+	// the page is held back from its destination until all of it has been read, so a short
+	//  read leaves nothing in the output, only in the sink, for the caller to throw away
+	int (*get_fd)(void *owner) = out->get_fd;
+	out->get_fd = NULL;
+
+	char buf[64 * 1024];
+	off_t off = cache_page_start(&hdr, st.st_size);
+	int left = hdr.html_size;
+	while (left > 0) {
+		ssize_t got = pread(fd, buf, left < (int)sizeof(buf) ? left : (int)sizeof(buf), off);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+		sink_write(out, buf, got);
+		off += got;
+		left -= got;
+	}
+
+	out->get_fd = get_fd;
+	close(fd);
+
+	if (left == 0 && lookups) {
+		lookups->n = 0;
+		for (int i = 0; i < hdr.n_lookups; i++)
+			*(uint64_t*)vector_add(lookups, sizeof(uint64_t), 1) = states[i].key;
+	}
+
+	free(states);
+	return left == 0;
+}
+
+struct Cache_Entry {
+	int fd;
+	Cache_Header hdr;
+	char path[1024];
+	char tmp_path[1100];
+};
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	while (len > 0) {
+		ssize_t wrote = write(fd, p, len);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return false;
+		p += wrote;
+		len -= wrote;
+	}
+	return true;
+}
+
+static bool write_vector(int fd, Vector *vec, int elem_size)
+{
+	if (!vec->buf || vec->n <= 0)
+		return true;
+
+	return write_all(fd, vec->buf, (size_t)elem_size * vec->n);
+}
+
+static bool write_doc_table(int fd, Doc_Table *t)
+{
+	return write_vector(fd, &t->bits, sizeof(uint32_t)) &&
+		write_vector(fd, &t->parent, sizeof(int)) &&
+		write_vector(fd, &t->name, sizeof(Span)) &&
+		write_vector(fd, &t->main, sizeof(Tag)) &&
+		write_vector(fd, &t->detail, sizeof(Doc_Detail));
+}
+
+// Starts an entry for a freshly parsed source. The page itself is appended to
+//  cache_entry_fd() as it's generated (see Sink.tee_fd), then cache_store_end() completes it.
+// Entries are written to a temporary file first, so that a reader never sees half an entry.
+Cache_Entry *cache_store_begin(Cache *cache, Source *source, const char *page)
+{
+	if (!cache || !cache->dir || !source->file.buf)
+		return NULL;
+
+	Cache_Entry *entry = calloc(1, sizeof(Cache_Entry));
+	Cache_Header *hdr = &entry->hdr;
+
+	hdr->magic = CACHE_MAGIC;
+	hdr->key = cache_key(cache, source, page);
+	hdr->contents = cache_contents(cache, source);
+	hdr->version = CACHE_VERSION;
+	hdr->detail_size = sizeof(Doc_Detail);
+	hdr->tag_size = sizeof(Tag);
+	hdr->file_size = source->file.size;
+	hdr->package_name = source->package_name;
+	hdr->class_name = source->class_name;
+	hdr->extends_name = source->extends_name;
+	hdr->n_implements = source->implements_names.buf ? source->implements_names.n : 0;
+	hdr->n_docs = source->docs.n;
+	hdr->n_tags = source->tags.buf ? source->tags.n : 0;
+	hdr->n_descs = source->descs.buf ? source->descs.n : 0;
+	hdr->html_size = -1;
+
+	cache_entry_path(cache, hdr->key, entry->path, sizeof(entry->path));
+	snprintf(entry->tmp_path, sizeof(entry->tmp_path), "%s.%d.%p.tmp", entry->path, (int)getpid(), (void*)entry);
+
+	entry->fd = open(entry->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (entry->fd < 0) {
+		free(entry);
+		return NULL;
+	}
+
+	bool ok = write_all(entry->fd, hdr, sizeof(Cache_Header)) &&
+		write_vector(entry->fd, &source->implements_names, sizeof(Span)) &&
+		write_doc_table(entry->fd, &source->docs) &&
+		write_vector(entry->fd, &source->tags, sizeof(Tag)) &&
+		write_vector(entry->fd, &source->descs, sizeof(Span));
+
+	if (!ok) {
+		close(entry->fd);
+		unlink(entry->tmp_path);
+		free(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+int cache_entry_fd(Cache_Entry *entry)
+{
+	return entry ? entry->fd : -1;
+}
+
+// lookups are the names the page looked up while it was made, sorted, and are stored with where
+//  each of them leads now, for cache_load_page to check against the table of a later run
+void cache_store_end(Cache_Entry *entry, int html_size, Symbols *symbols, const Vector *lookups, bool ok)
+{
+	if (!entry)
+		return;
+
+	Vector states = {0};
+	for (int i = 0; i < lookups->n; i++) {
+		uint64_t key = ((uint64_t*)lookups->buf)[i];
+		Symbol_State *state = vector_add(&states, sizeof(Symbol_State), 1);
+		state->key = key;
+		state->value = symbols_state(symbols, key);
+	}
+
+	entry->hdr.html_size = html_size;
+	entry->hdr.n_lookups = states.n;
+	ok = ok && write_vector(entry->fd, &states, sizeof(Symbol_State));
+	vector_free(&states);
+
+	ok = ok && pwrite(entry->fd, &entry->hdr, sizeof(Cache_Header), 0) == sizeof(Cache_Header);
+	ok = close(entry->fd) == 0 && ok;
+
+	if (!ok || rename(entry->tmp_path, entry->path) != 0)
+		unlink(entry->tmp_path);
+
+	free(entry);
+}
+
+// Removes the entries for this version and these options that no page of the run asked for,
+//  which are for sources that have gone or been renamed since, and those from other versions,
+//  which can't be read any more. Entries for other options are left, since they'll be used
+//  again as soon as the options they were made with are.
+void cache_evict(Cache *cache)
+{
+	if (!cache || !cache->dir)
+		return;
+
+	Vector *used = &cache->used->keys;
+	if (used->n > 1)
+		qsort(used->buf, used->n, sizeof(uint64_t), compare_u64);
+
+	DIR *dir = opendir(cache->dir);
+	if (!dir)
+		return;
+
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		int version;
+		unsigned long long config, key;
+		int len = 0;
+		if (sscanf(ent->d_name, "v%d-%16llx-%16llx.cache%n", &version, &config, &key, &len) != 3 ||
+			len != (int)strlen(ent->d_name))
+			continue;
+
+		bool keep = version == CACHE_VERSION &&
+			(config != cache->config_hash || bsearch(&(uint64_t){key}, used->buf, used->n, sizeof(uint64_t), compare_u64));
+		if (keep)
+			continue;
+
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+		unlink(path);
+	}
+	closedir(dir);
+}
+
+void cache_close(Cache *cache)
+{
+	if (cache->dir) {
+		free(cache->dir);
+		cache->dir = NULL;
+	}
+	if (cache->used) {
+		vector_free(&cache->used->keys);
+		pthread_mutex_destroy(&cache->used->lock);
+		free(cache->used);
+		cache->used = NULL;
+	}
+}
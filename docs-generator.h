@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #define SORT_CONTENT  0
 #define SORT_ALPHA    1
 
@@ -27,32 +32,69 @@
 #define DOC_FLAG_IS_PARENT  0x20000
 #define DOC_FLAG_KOTLIN     0x40000
 #define DOC_FLAG_SWIFT      0x80000
+#define DOC_FLAG_OVERRIDE  0x100000
+#define DOC_FLAG_NATIVE    0x200000
+#define DOC_FLAG_DEPRECATED 0x400000
+
+// The flags take the low 24 bits of a doc's packed bits, and its access level the top 8
+#define DOC_FLAGS_MASK   0xffffff
+#define DOC_ACCESS_SHIFT 24
 
 #define DOC_ACCESS_PACKAGE    0
 #define DOC_ACCESS_PRIVATE    1
 #define DOC_ACCESS_PROTECTED  2
 #define DOC_ACCESS_PUBLIC     3
 
+#define TAG_KIND_NONE        0
+#define TAG_KIND_PARAM       1
+#define TAG_KIND_RETURN      2
+#define TAG_KIND_THROWS      3
+#define TAG_KIND_SEE         4
+#define TAG_KIND_DEPRECATED  5
+#define TAG_KIND_SINCE       6
+
+// Which list of Source.kinds a doc is in, by the flags it ends up with. A doc can be in more
+//  than one, eg. a Kotlin property declared with parentheses is both a method and a field.
+#define DOC_KIND_PARENT  0
+#define DOC_KIND_CTOR    1
+#define DOC_KIND_METHOD  2
+#define DOC_KIND_FIELD   3
+#define N_DOC_KINDS      4
+
 #define MAX_CLASS_LEVELS 256
 
+// Sources at least this big are memory-mapped instead of read into the heap
+#define MMAP_THRESHOLD 65536
+
+typedef struct Arena_Block Arena_Block;
+
+typedef struct {
+	Arena_Block *head;
+	Arena_Block *spare;
+} Arena;
+
 typedef struct {
     void *buf;
     int cap;
     int n;
+    Arena *arena;
 } Vector;
 
+// Offsets into a source's text are 64-bit, so that sources over 2 GB can be parsed
 typedef struct {
-	int start;
-	int end;
+	int64_t start;
+	int64_t end;
 } Span;
 
 typedef struct {
-    int cmt_start;
-    int cmt_end;
-    int code_start;
-    int code_end;
+    int64_t cmt_start;
+    int64_t cmt_end;
+    int64_t code_start;
+    int64_t code_end;
+    int kind;
 } Tag;
 
+// One doc as the parser puts it together, before it goes into the source's Doc_Table
 typedef struct {
 	Span name;
     Tag main;
@@ -61,17 +103,45 @@ typedef struct {
     int code_lineno;
     int first_desc_line;
     int n_desc_lines;
-    int first_param;
-    short n_params;
+    int first_tag;
+    short n_tags;
     short access;
     unsigned int flags;
+    short soft_keyword; // the last word, if it was a soft keyword, whose effect waits for the next word
+    bool access_given;  // by a keyword that's always reserved, which a soft keyword can't override
 } Doc;
 
+// What of a doc is only needed once its page is being written
+typedef struct {
+	Tag ret;
+	int code_lineno;
+	int first_desc_line;
+	int n_desc_lines;
+	int first_tag;
+	int n_tags;
+} Doc_Detail;
+
+// The docs of a source, kept as columns. Picking docs by kind or access, walking up parents and
+//  sorting by name each read one or two narrow columns, instead of pulling in every field of
+//  every doc. Read through the doc_* accessors below; only doc_table_add and doc_table_append
+//  add rows.
+typedef struct {
+	int n;
+	Vector bits;   // uint32_t, flags and access packed, see DOC_FLAGS_MASK
+	Vector parent; // int, the doc this one is nested in, or -1
+	Vector name;   // Span
+	Vector main;   // Tag
+	Vector detail; // Doc_Detail
+} Doc_Table;
+
 typedef struct {
 	char *name;
     char *path;
     char *buf;
-    int size;
+    int64_t size;
+    size_t map_size;
+    bool borrowed; // buf belongs to something else, eg. a mapped archive
+    char sep;      // where file_set_path cut the path in two, for file_join_path to put back
 } File;
 
 typedef struct {
@@ -80,21 +150,363 @@ typedef struct {
     Span class_name;
     Span extends_name;
     Vector implements_names;
-    Vector docs;
+    Doc_Table docs;
     Vector tags;
     Vector descs;
+    Vector kinds[N_DOC_KINDS]; // int, the index of every doc of each kind, in the order of docs
     int sort_order;
     int access_level;
+    Arena *arena;
 } Source;
 
+// Stage 1 of the parser, see parser.c
+typedef struct {
+	const char *buf;
+	int64_t size;
+	int64_t base; // the block in bits
+	uint64_t bits;
+	bool prev_blank;
+	bool prev_marked;
+	bool final; // size is the end of the source, rather than of what's arrived so far
+} Scanner;
+
+typedef struct Parse_Chunk Parse_Chunk;
+
+// Everything the parser keeps track of between one byte and the next, so that a source can be
+//  given to it a piece at a time as it's read from a pipe. Docs point into the text, so each
+//  parser_feed passes all of it so far rather than only what's new.
+typedef struct {
+	Source *source;
+	Parse_Chunk *chunk; // set while a piece of a large source is parsed ahead of the rest
+	Scanner scan;
+	int64_t pos;   // where to look for the next byte to visit
+	bool exact;    // pos is the next byte to visit, eg. the one after a UTF-8 sequence
+	int64_t last_nonname_idx;
+
+	bool is_javadoc;
+	bool is_block_comment;
+	bool is_line_comment;
+	bool inside_cmd;
+	bool is_line_cmd;
+	int tag_kind;
+	bool seen_ws;
+	bool seen_code_atsym;
+	bool seen_semicolon;
+	bool seen_open_curly;
+	bool seen_close_curly;
+	bool seen_paren;
+	int n_open_paren;
+	int n_lines;
+
+	int n_open_curly;
+	int class_level;
+	int64_t class_index[MAX_CLASS_LEVELS]; // n_open_curly << 32 | the doc of each open class
+
+	Doc doc;
+	Tag tag;
+	Span dline;
+} Parser;
+
+typedef struct Cache_Used Cache_Used;
+
+typedef struct {
+	char *dir;
+	uint64_t config_hash;
+	Cache_Used *used; // the entries this run asked for, which cache_evict keeps
+} Cache;
+
+typedef struct Cache_Entry Cache_Entry;
+
+typedef struct Chunk_Pool Chunk_Pool;
+
+typedef bool (*Sink_Write)(void *ctx, const void *data, size_t len);
+
+typedef struct {
+	char *chunk;
+	int n;
+	long size;
+	Vector held;
+	Vector spare;
+	int fd;
+	int tee_fd;
+	int spill_fd;
+	int (*get_fd)(void *owner);
+	void *owner;
+	Sink_Write write; // if set, where the page goes instead of fd
+	void *write_ctx;
+	Chunk_Pool *pool;
+	void *zs;
+	char *packed;
+	int packed_n;
+	long packed_size;
+	uint32_t crc;
+	bool failed;
+	bool tee_failed;
+} Sink;
+
+typedef struct Pool Pool;
+
+typedef struct Walk Walk;
+
+typedef struct Watch Watch;
+
+// A source that changed while --watch was waiting
+typedef struct {
+	char *path;   // NULL if events were lost, and any source could have changed
+	int root;     // the input folder it's in, or -1 for a single source
+	bool removed; // deleted or moved away, rather than written
+	bool is_dir;  // a whole folder went, along with every source in it
+} Watch_Event;
+
+typedef struct Zip Zip;
+
+typedef struct Zip_Writer Zip_Writer;
+
+typedef struct Uring Uring;
+
+typedef struct Symbols Symbols;
+
+typedef struct Search_Index Search_Index;
+
+// Puts a whole file into the output (an archive or a folder), under a name relative to its top
+typedef void (*Output_Add)(void *ctx, const char *name, const void *data, int len);
+
+// Counted from wherever the work happens, for --stats. Times are summed over every thread.
+typedef struct {
+	long vector_grows;
+	long vector_copies;       // grows that moved the buffer, by realloc or out of the arena
+	long vector_copied_bytes;
+	long bytes_read;
+	long read_ns;
+	long bytes_written;
+	long write_ns;
+} Stats_Counters;
+
+extern bool stats_enabled;
+extern Stats_Counters stats_counters;
+
+#define STATS_ADD(field, n) do { \
+	if (stats_enabled) \
+		__atomic_fetch_add(&stats_counters.field, (long)(n), __ATOMIC_RELAXED); \
+} while (0)
+
+typedef struct {
+	const char *name;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+} Stats_Phase;
+
+typedef struct {
+	const char *name;
+	long size;
+	int n_docs;
+	int n_tags;
+	int n_descs;
+	uint64_t read_ns;
+	uint64_t parse_ns; // or the time to load it from the cache
+	uint64_t render_ns;
+	bool cached;
+} Stats_File;
+
+typedef struct {
+	Vector phases;
+	Vector files;
+	int open_phase;
+	bool json;
+} Stats;
+
+// Where a name was declared: the page it's on, and the id of its element on that page
+typedef struct {
+	const char *name; // package-qualified
+	const char *page;
+	const char *anchor;
+	int page_idx;
+	int doc;
+	bool is_type;
+} Symbol;
+
+// The stylesheet as pages use it, worked out once per run
+typedef struct {
+	const File *file;
+	bool embed;
+	char *embedded;    // the contents, escaped, when they go into every page
+	int embedded_len;
+	char *out_name;    // the file pages link to
+	char *href;        // out_name, escaped
+	int href_len;
+	bool in_output;    // written once at the top of the output, so pages link to it relative to themselves
+} Stylesheet;
+
+// The page being generated, for links to itself and to the other pages
+typedef struct {
+	Symbols *symbols;
+	const char *name;
+	int index;
+	bool has_search; // search.js is at the top of the output
+	Vector *lookups; // if set, the hash of every name the page looks up is added to it
+} Page_Ref;
+
+// How a name in the table resolves at some point, for --watch to tell which names a change moved
+typedef struct {
+	uint64_t key;   // symbols_key_hash of the name
+	uint64_t value; // a hash of where it leads, or 0 if it isn't there
+} Symbol_State;
+
+static inline unsigned int doc_flags(const Doc_Table *t, int i)
+{
+	return ((const uint32_t*)t->bits.buf)[i] & DOC_FLAGS_MASK;
+}
+
+static inline int doc_access(const Doc_Table *t, int i)
+{
+	return ((const uint32_t*)t->bits.buf)[i] >> DOC_ACCESS_SHIFT;
+}
+
+static inline int doc_parent(const Doc_Table *t, int i)
+{
+	return ((const int*)t->parent.buf)[i];
+}
+
+static inline const Span *doc_name(const Doc_Table *t, int i)
+{
+	return &((const Span*)t->name.buf)[i];
+}
+
+static inline const Tag *doc_main(const Doc_Table *t, int i)
+{
+	return &((const Tag*)t->main.buf)[i];
+}
+
+static inline const Doc_Detail *doc_detail(const Doc_Table *t, int i)
+{
+	return &((const Doc_Detail*)t->detail.buf)[i];
+}
+
+extern int parse_threads;
 void parse_source_file(Source *file);
+void parser_begin(Parser *p, Source *source);
+void parser_feed(Parser *p, char *buf, int64_t size);
+void parser_finish(Parser *p);
+
+void sort_source_docs(Source *source);
+void index_doc_kinds(Source *source);
+void stylesheet_init(Stylesheet *css, const File *file, bool embed, bool in_output);
+void stylesheet_free(Stylesheet *css);
+bool doc_carries_id(unsigned int flags);
+void generate_html(Source *source, const Page_Ref *page, const Stylesheet *css, Sink *out);
+void print_docs(Source *source, FILE *out);
 
-File generate_html(Source *source, File *css, int should_embed_css);
+void *arena_alloc(Arena *arena, size_t size);
+bool arena_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+size_t arena_size(const Arena *arena);
 
+void vector_reserve(Vector *vec, int elem_size, int count);
 void *vector_add(Vector *vec, int elem_size, int count);
 void vector_append_array(Vector *vec, int elem_size, const void *data, int count);
 void vector_append_cstring(Vector *vec, const char *str);
-void vector_append_utf8_html(Vector *vec, const char *str, int len);
+bool vector_append_utf8_html(Vector *vec, const char *str, int64_t len);
+int html_escape(const char *str, int len, char *out, int *utf8_left, bool *stop);
 void vector_free(Vector *vec);
+int compare_u64(const void *a, const void *b);
+
+// What a source read from stdin (the path "-") is called, both in its page and for the page's file
+#define STDIN_NAME "stdin"
+
 File read_whole_file(char *path);
+void read_source_stream(char *path, Source *source);
+void file_set_path(File *file, char *path);
+void file_join_path(File *file);
+void file_close(File *f);
+bool extension_in_list(const char *name, const char *exts);
+void doc_table_reserve(Doc_Table *t, int count);
+void doc_table_add(Doc_Table *t, const Doc *doc);
+void doc_table_append(Doc_Table *t, const Doc_Table *from, int first);
+void doc_table_reorder(Doc_Table *t, const int *order);
+void doc_table_free(Doc_Table *t);
+void source_init(Source *s, Arena *arena);
 void source_close(Source *s);
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+bool cache_open(Cache *cache, const char *dir, uint64_t config_hash);
+bool cache_load(Cache *cache, Source *source, const char *page);
+bool cache_load_page(Cache *cache, Source *source, const char *page, Symbols *symbols, Vector *lookups, Sink *out);
+Cache_Entry *cache_store_begin(Cache *cache, Source *source, const char *page);
+int cache_entry_fd(Cache_Entry *entry);
+void cache_store_end(Cache_Entry *entry, int html_size, Symbols *symbols, const Vector *lookups, bool ok);
+void cache_evict(Cache *cache);
+void cache_close(Cache *cache);
+
+Chunk_Pool *chunk_pool_create(void);
+void chunk_pool_destroy(Chunk_Pool *pool);
+
+void sink_init(Sink *sink, int fd);
+void sink_init_callback(Sink *sink, Sink_Write write, void *ctx);
+void sink_deflate(Sink *sink, int level);
+void sink_write(Sink *sink, const void *data, int len);
+void sink_append_cstring(Sink *sink, const char *str);
+void sink_append_utf8_html(Sink *sink, const char *str, int64_t len);
+void sink_flush(Sink *sink);
+void sink_finish(Sink *sink);
+void sink_drain(Sink *sink, int fd);
+void sink_close(Sink *sink);
+
+int pool_default_size(void);
+Pool *pool_create(int n_workers, void (*func)(void *data, int job, int worker), void *data);
+int pool_n_workers(Pool *pool);
+void pool_submit(Pool *pool, int job);
+void pool_finish(Pool *pool);
+
+Walk *walk_start(const char *folder, const char *exts, int n_workers);
+char *walk_next(Walk *walk);
+void walk_finish(Walk *walk);
+
+Watch *watch_open(const char *exts);
+bool watch_add_tree(Watch *w, const char *folder, int root);
+bool watch_add_file(Watch *w, const char *path);
+int watch_wait(Watch *w, Vector *events);
+void watch_close(Watch *w);
+
+Zip *zip_open(const char *path, const char *exts);
+int zip_n_entries(Zip *zip);
+long zip_entry_size(Zip *zip, int idx);
+File zip_read_entry(Zip *zip, int idx);
+char *zip_entry_path(Zip *zip, int idx);
+void zip_close(Zip *zip);
+
+Zip_Writer *zip_writer_open(const char *path);
+int zip_writer_fd(Zip_Writer *zw);
+void zip_writer_begin(Zip_Writer *zw, const char *name);
+void zip_writer_end(Zip_Writer *zw, uint32_t crc, uint64_t comp_size, uint64_t size);
+void zip_writer_add(Zip_Writer *zw, const char *name, const void *data, int len);
+bool zip_writer_close(Zip_Writer *zw);
+
+Uring *uring_open(void);
+int uring_read_files(Uring *ring, File *files, const char **paths, const long *sizes, int n);
+void uring_close(Uring *ring);
+
+Symbols *symbols_create(void);
+int symbol_key(const Source *source, int doc, Vector *key);
+void symbols_add_source(Symbols *symbols, const Source *source, int page_idx, const char *page_name);
+const Symbol *symbols_find(Symbols *symbols, const char *key, int len);
+const Symbol *symbols_find_type(Symbols *symbols, const char *name, int len);
+uint64_t symbols_key_hash(const char *key, int len, bool simple);
+void symbols_snapshot(Symbols *symbols, const Source *source, Vector *states);
+uint64_t symbols_state(Symbols *symbols, uint64_t key);
+bool symbols_remove_source(Symbols *symbols, const Source *source, int page_idx);
+void symbols_settle(Symbols *symbols);
+void symbols_destroy(Symbols *symbols);
+
+Search_Index *search_create(int n_workers);
+void search_add_source(Search_Index *index, int worker, const Source *source, int page_idx, const char *page_name);
+bool search_replace_source(Search_Index *index, const Source *source, int page_idx, const char *page_name);
+void search_write(Search_Index *index, Symbols *symbols, Output_Add add, void *ctx);
+void search_destroy(Search_Index *index);
+
+uint64_t stats_clock(void);
+void stats_begin_phase(Stats *stats, const char *name);
+void stats_end_phase(Stats *stats);
+void stats_add_file(Stats *stats, const Stats_File *file);
+void stats_report(Stats *stats, FILE *out);
+void stats_free(Stats *stats);
@@ -0,0 +1,197 @@
+#include "docs-generator.h"
+#include "docsgen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+
+// The library behind docsgen.h. It's the same parse, link and render that docs-generator runs,
+//  minus everything that touches files: a source's File borrows the caller's buffer, and a
+//  page's Sink hands its chunks to the caller's write function as they fill up.
+
+struct Docsgen_Style {
+	File file; // borrows css, which the style owns
+	char *css;
+	char *name;
+	Stylesheet sheet;
+};
+
+struct Docsgen_Source {
+	Docsgen_Module *module;
+	Source source;
+	char *file_name;
+	char *page_name;
+	int index;
+};
+
+struct Docsgen_Module {
+	const Docsgen_Style *style;
+	int sort_order;
+	Symbols *symbols;
+	Chunk_Pool *chunks;
+	Vector sources; // Docsgen_Source*
+	int n_adding;   // sources in sources whose symbols are still going into the table
+	bool rendering;
+	pthread_mutex_t lock;
+	pthread_cond_t added; // n_adding went back to 0
+};
+
+static char *copy_string(const char *str)
+{
+	int len = strlen(str);
+	char *copy = malloc(len + 1);
+	memcpy(copy, str, len + 1);
+	return copy;
+}
+
+Docsgen_Style *docsgen_style_create(const char *name, const void *css, size_t len, bool embed)
+{
+	if (!name || (!css && len > 0) || len > INT_MAX)
+		return NULL;
+
+	Docsgen_Style *style = calloc(1, sizeof(Docsgen_Style));
+	style->css = malloc(len + 1);
+	if (len > 0)
+		memcpy(style->css, css, len);
+	style->css[len] = '\0';
+	style->name = copy_string(name);
+
+	style->file.buf = style->css;
+	style->file.size = (int)len;
+	style->file.name = style->name;
+	style->file.borrowed = true;
+
+	// pages link to a copy of the stylesheet at the top of the output, like with --out-zip
+	stylesheet_init(&style->sheet, &style->file, embed, true);
+	return style;
+}
+
+const char *docsgen_style_file_name(const Docsgen_Style *style)
+{
+	return style->sheet.embed ? NULL : style->sheet.out_name;
+}
+
+void docsgen_style_destroy(Docsgen_Style *style)
+{
+	if (!style)
+		return;
+
+	stylesheet_free(&style->sheet);
+	free(style->css);
+	free(style->name);
+	free(style);
+}
+
+Docsgen_Module *docsgen_module_create(const Docsgen_Style *style, int sort_order)
+{
+	if (!style)
+		return NULL;
+
+	Docsgen_Module *module = calloc(1, sizeof(Docsgen_Module));
+	module->style = style;
+	module->sort_order = sort_order == DOCSGEN_SORT_ALPHA ? SORT_ALPHA : SORT_CONTENT;
+	module->symbols = symbols_create();
+	module->chunks = chunk_pool_create();
+	pthread_mutex_init(&module->lock, NULL);
+	pthread_cond_init(&module->added, NULL);
+	return module;
+}
+
+Docsgen_Source *docsgen_add_source(Docsgen_Module *module, const char *file_name, const void *buf, size_t len, const char *page_name)
+{
+	if (!module || !file_name || !page_name || (!buf && len > 0))
+		return NULL;
+
+	Docsgen_Source *ds = calloc(1, sizeof(Docsgen_Source));
+	ds->module = module;
+	ds->file_name = copy_string(file_name);
+	ds->page_name = copy_string(page_name);
+
+	// an empty source still needs a buffer, since a File without one is one that couldn't be read
+	Source *source = &ds->source;
+	source_init(source, NULL);
+	source->file.buf = len > 0 ? (char*)buf : ds->file_name + strlen(ds->file_name);
+	source->file.size = (int64_t)len;
+	source->file.name = ds->file_name;
+	source->file.borrowed = true;
+	source->sort_order = module->sort_order;
+	source->access_level = DOC_ACCESS_PRIVATE;
+
+	// parsing is the slow part, and doesn't need the module
+	parse_source_file(source);
+	sort_source_docs(source);
+
+	pthread_mutex_lock(&module->lock);
+	bool ok = !module->rendering;
+	if (ok) {
+		ds->index = module->sources.n;
+		*(Docsgen_Source**)vector_add(&module->sources, sizeof(Docsgen_Source*), 1) = ds;
+		module->n_adding++;
+	}
+	pthread_mutex_unlock(&module->lock);
+
+	if (!ok) {
+		source_close(source);
+		free(ds->file_name);
+		free(ds->page_name);
+		free(ds);
+		return NULL;
+	}
+
+	// the table of symbols takes its own locks, but pages look names up in it without any,
+	//  so rendering waits for every add that got in before it
+	symbols_add_source(module->symbols, source, ds->index, ds->page_name);
+
+	pthread_mutex_lock(&module->lock);
+	if (--module->n_adding == 0)
+		pthread_cond_broadcast(&module->added);
+	pthread_mutex_unlock(&module->lock);
+	return ds;
+}
+
+bool docsgen_render(Docsgen_Module *module, Docsgen_Source *source, Docsgen_Write write, void *ctx)
+{
+	if (!module || !source || source->module != module || !write)
+		return false;
+
+	pthread_mutex_lock(&module->lock);
+	module->rendering = true;
+	while (module->n_adding > 0)
+		pthread_cond_wait(&module->added, &module->lock);
+	pthread_mutex_unlock(&module->lock);
+
+	Sink out;
+	sink_init_callback(&out, write, ctx);
+	out.pool = module->chunks;
+
+	Page_Ref page = { .symbols = module->symbols, .name = source->page_name, .index = source->index };
+	generate_html(&source->source, &page, &module->style->sheet, &out);
+	sink_finish(&out);
+
+	bool ok = !out.failed;
+	sink_close(&out);
+	return ok;
+}
+
+void docsgen_module_destroy(Docsgen_Module *module)
+{
+	if (!module)
+		return;
+
+	Docsgen_Source **sources = module->sources.buf;
+	for (int i = 0; i < module->sources.n; i++) {
+		source_close(&sources[i]->source);
+		free(sources[i]->file_name);
+		free(sources[i]->page_name);
+		free(sources[i]);
+	}
+	vector_free(&module->sources);
+
+	symbols_destroy(module->symbols);
+	chunk_pool_destroy(module->chunks);
+	pthread_mutex_destroy(&module->lock);
+	pthread_cond_destroy(&module->added);
+	free(module);
+}
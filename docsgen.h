@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// libdocsgen: the generator as a library, for a process that makes the docs for many sets of
+//  sources without starting docs-generator for each one. Build it with "./make.sh lib".
+// Nothing goes through files, stdin or stdout: sources are read from the caller's buffers,
+//  and pages are handed to the caller's write function.
+//
+// A style is a stylesheet, ready to go into pages. It's only read once made, so any number of
+//  modules and threads can share one.
+// A module is a set of sources whose pages link to each other. Sources can be added to it from
+//  several threads at once, and its pages rendered from several threads at once, but every
+//  source has to be in before the first page is rendered. Modules don't share anything, so
+//  separate modules can be used from separate threads freely.
+
+#define DOCSGEN_SORT_CONTENT 0
+#define DOCSGEN_SORT_ALPHA   1
+
+#define DOCSGEN_API __attribute__((visibility("default")))
+
+typedef struct Docsgen_Style Docsgen_Style;
+typedef struct Docsgen_Module Docsgen_Module;
+typedef struct Docsgen_Source Docsgen_Source;
+
+// Takes the next piece of a page. Returning false stops the page there.
+typedef bool (*Docsgen_Write)(void *ctx, const void *data, size_t len);
+
+// name is the stylesheet's file name, eg. "style.css". If embed is set, every page carries its
+//  own copy of the stylesheet. Otherwise pages link to docsgen_style_file_name() at the top of
+//  the output, which is up to the caller to write there.
+// The stylesheet is copied, so css can be let go of once this returns.
+DOCSGEN_API Docsgen_Style *docsgen_style_create(const char *name, const void *css, size_t len, bool embed);
+DOCSGEN_API const char *docsgen_style_file_name(const Docsgen_Style *style);
+DOCSGEN_API void docsgen_style_destroy(Docsgen_Style *style);
+
+// The style has to outlive the module
+DOCSGEN_API Docsgen_Module *docsgen_module_create(const Docsgen_Style *style, int sort_order);
+
+// Parses a source and adds what it declares to the module. file_name is used where the source
+//  doesn't name its own class, eg. "Foo.kt". page_name is where the page goes, relative to the
+//  top of the output, eg. "com/example/Foo.html"; links between pages follow from it.
+// buf is not copied, and has to stay as it is until the module is destroyed.
+// Returns NULL if pages have already been rendered.
+DOCSGEN_API Docsgen_Source *docsgen_add_source(Docsgen_Module *module, const char *file_name, const void *buf, size_t len, const char *page_name);
+
+// Renders the source's page, in pieces, through write.
+// Returns false if write did, or the source doesn't belong to the module.
+DOCSGEN_API bool docsgen_render(Docsgen_Module *module, Docsgen_Source *source, Docsgen_Write write, void *ctx);
+
+// Frees the module and every source in it
+DOCSGEN_API void docsgen_module_destroy(Docsgen_Module *module);
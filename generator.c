@@ -3,125 +3,560 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-void print_docs(Source *source, const char *output_root)
+// Dumps what the parser found in a source, for debugging the parser
+void print_docs(Source *source, FILE *out)
 {
     const char *comment = "\n\ncomment: ";
     const char *code1 = "\ncode: ";
-    const char *param = "\n\tparam: ";
+    const char *tag_labels[] = {
+        "\n\ttag: ", "\n\tparam: ", "\n\treturn: ", "\n\tthrows: ",
+        "\n\tsee: ", "\n\tdeprecated: ", "\n\tsince: "
+    };
     const char *ret = "\n\treturn: ";
     const char *code2 = "\n\n\tcode: ";
-	Doc *d = source->docs.buf;
+	const Doc_Table *docs = &source->docs;
 	char *in_buf = source->file.buf;
 
-    for (int i = 0; i < source->docs.n; i++) {
+    for (int i = 0; i < docs->n; i++) {
+		unsigned int flags = doc_flags(docs, i);
+		int access = doc_access(docs, i);
+		const Span *name = doc_name(docs, i);
+		const Tag *main = doc_main(docs, i);
+		const Doc_Detail *d = doc_detail(docs, i);
+
     	/*
-		    fwrite(comment, 1, strlen(comment), stdout);
-		    fwrite(&in_buf[d->main.cmt_start], 1, d->main.cmt_end - d->main.cmt_start + 1, stdout);
+		    fwrite(comment, 1, strlen(comment), out);
+		    fwrite(&in_buf[main->cmt_start], 1, main->cmt_end - main->cmt_start + 1, out);
         */
 
-		putchar('\n');
+		fputc('\n', out);
 
-		if (d->access == DOC_ACCESS_PUBLIC) printf("PUBLIC ");
-		else if (d->access == DOC_ACCESS_PROTECTED) printf("PROTECTED ");
-		else if (d->access == DOC_ACCESS_PRIVATE) printf("PRIVATE ");
+		if (access == DOC_ACCESS_PUBLIC) fprintf(out, "PUBLIC ");
+		else if (access == DOC_ACCESS_PROTECTED) fprintf(out, "PROTECTED ");
+		else if (access == DOC_ACCESS_PRIVATE) fprintf(out, "PRIVATE ");
 
-		if (d->flags & DOC_FLAG_KOTLIN) printf("KOTLIN ");
-		if (d->flags & DOC_FLAG_METHOD) printf("METHOD ");
-		if (d->flags & DOC_FLAG_FIELD)  printf("FIELD ");
-		if (d->flags & DOC_FLAG_STATIC) printf("STATIC ");
-		if (d->flags & DOC_FLAG_FINAL)  printf("FINAL ");
-		if (d->flags & DOC_FLAG_SYNC)   printf("SYNC ");
+		if (flags & DOC_FLAG_KOTLIN) fprintf(out, "KOTLIN ");
+		if (flags & DOC_FLAG_METHOD) fprintf(out, "METHOD ");
+		if (flags & DOC_FLAG_FIELD)  fprintf(out, "FIELD ");
+		if (flags & DOC_FLAG_STATIC) fprintf(out, "STATIC ");
+		if (flags & DOC_FLAG_FINAL)  fprintf(out, "FINAL ");
+		if (flags & DOC_FLAG_SYNC)   fprintf(out, "SYNC ");
+		if (flags & DOC_FLAG_DEPRECATED) fprintf(out, "DEPRECATED ");
 
-		if (d->name.start >= 0) {
-			fwrite("\nname: ", 1, 7, stdout);
-			fwrite(&in_buf[d->name.start], 1, d->name.end - d->name.start + 1, stdout);
+		if (name->start >= 0) {
+			fwrite("\nname: ", 1, 7, out);
+			fwrite(&in_buf[name->start], 1, name->end - name->start + 1, out);
 		}
 
-		fwrite(code1, 1, strlen(code1), stdout);
-	    fwrite(&in_buf[d->main.code_start], 1, d->main.code_end - d->main.code_start + 1, stdout);
+		fwrite(code1, 1, strlen(code1), out);
+	    fwrite(&in_buf[main->code_start], 1, main->code_end - main->code_start + 1, out);
 
 		Span *s = d->first_desc_line >= 0 ? &((Span*)source->descs.buf)[d->first_desc_line] : NULL;
 		for (int j = 0; s && j < d->n_desc_lines; j++) {
 			if (s->start >= 0)
-				fwrite(&in_buf[s->start], 1, s->end - s->start + 1, stdout);
-			fputc('\n', stdout);
+				fwrite(&in_buf[s->start], 1, s->end - s->start + 1, out);
+			fputc('\n', out);
 			s++;
 		}
 
-        Tag *p = d->first_param >= 0 ? &((Tag*)source->tags.buf)[d->first_param] : NULL;
-        for (int j = 0; p && j < d->n_params; j++) {
+        Tag *p = d->first_tag >= 0 ? &((Tag*)source->tags.buf)[d->first_tag] : NULL;
+        for (int j = 0; p && j < d->n_tags; j++) {
             if (p->code_start >= 0 && p->code_end >= 0) {
-                fwrite(code2, 1, strlen(code2), stdout);
-                fwrite(&in_buf[p->code_start], 1, p->code_end - p->code_start + 1, stdout);
+                fwrite(code2, 1, strlen(code2), out);
+                fwrite(&in_buf[p->code_start], 1, p->code_end - p->code_start + 1, out);
             }
             if (p->cmt_start >= 0 && p->cmt_end >= 0) {
-                fwrite(param, 1, strlen(param), stdout);
-                fwrite(&in_buf[p->cmt_start], 1, p->cmt_end - p->cmt_start + 1, stdout);
+                const char *label = tag_labels[p->kind <= TAG_KIND_SINCE ? p->kind : TAG_KIND_NONE];
+                fwrite(label, 1, strlen(label), out);
+                fwrite(&in_buf[p->cmt_start], 1, p->cmt_end - p->cmt_start + 1, out);
             }
 
             p++;
         }
 
         if (d->ret.cmt_start >= 0) {
-            fwrite(ret, 1, strlen(ret), stdout);
-            fwrite(&in_buf[d->ret.cmt_start], 1, d->ret.cmt_end - d->ret.cmt_start + 1, stdout);
+            fwrite(ret, 1, strlen(ret), out);
+            fwrite(&in_buf[d->ret.cmt_start], 1, d->ret.cmt_end - d->ret.cmt_start + 1, out);
         }
-
-        d++;
     }
 }
 
+typedef struct {
+	uint64_t key; // the first 8 bytes of the name, big-endian, so that it compares like memcmp
+	const char *name;
+	int len;
+	int parent;
+	int idx;
+} Sort_Key;
+
+static int compare_sort_keys(const void *a, const void *b)
+{
+	const Sort_Key *x = a;
+	const Sort_Key *y = b;
+
+	if (x->parent != y->parent)
+		return x->parent < y->parent ? -1 : 1;
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+
+	// only names sharing the first 8 bytes get this far
+	if (x->len > 8 && y->len > 8) {
+		int len = x->len < y->len ? x->len : y->len;
+		int c = memcmp(x->name + 8, y->name + 8, len - 8);
+		if (c != 0)
+			return c;
+	}
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+
+	return x->idx - y->idx;
+}
+
+// Orders the docs by name within each class, keeping every class followed by its own members
+//  (nested classes included), as they are in the source. parent_doc is remapped to match.
 void sort_source_docs(Source *source)
 {
-	
+	if (source->sort_order != SORT_ALPHA || source->docs.n < 2)
+		return;
+
+	const char *in = source->file.buf;
+	Doc_Table *docs = &source->docs;
+	int n_docs = docs->n;
+
+	Sort_Key *keys = malloc(n_docs * sizeof(Sort_Key));
+	for (int i = 0; i < n_docs; i++) {
+		const Span *name = doc_name(docs, i);
+		int len = name->start >= 0 && name->end >= name->start ? name->end - name->start + 1 : 0;
+
+		uint64_t key = 0;
+		for (int j = 0; j < 8; j++)
+			key = (key << 8) | (j < len ? (unsigned char)in[name->start + j] : 0);
+
+		// a parent always comes before its members, anything else is treated as top level
+		int parent = doc_parent(docs, i);
+		keys[i].key = key;
+		keys[i].name = len > 0 ? &in[name->start] : NULL;
+		keys[i].len = len;
+		keys[i].parent = parent >= 0 && parent < i ? parent : -1;
+		keys[i].idx = i;
+	}
+
+	qsort(keys, n_docs, sizeof(Sort_Key), compare_sort_keys);
+
+	// members of each parent are now in a row, starting at first[parent + 1]
+	int *first = calloc(n_docs + 2, sizeof(int));
+	for (int i = 0; i < n_docs; i++)
+		first[keys[i].parent + 2]++;
+	for (int i = 1; i < n_docs + 2; i++)
+		first[i] += first[i-1];
+
+	// walk the tree depth first, so that a nested class is followed by its members
+	int *order = malloc(n_docs * sizeof(int));
+	int *new_idx = malloc(n_docs * sizeof(int));
+	int *stack = malloc((n_docs + 1) * sizeof(int));
+	int *next = malloc((n_docs + 1) * sizeof(int));
+	int n_order = 0;
+	int depth = 0;
+
+	stack[0] = -1;
+	next[0] = first[0];
+
+	while (depth >= 0) {
+		int parent = stack[depth];
+		if (next[depth] >= first[parent + 2]) {
+			depth--;
+			continue;
+		}
+
+		int idx = keys[next[depth]++].idx;
+		new_idx[idx] = n_order;
+		order[n_order++] = idx;
+
+		depth++;
+		stack[depth] = idx;
+		next[depth] = first[idx + 1];
+	}
+
+	doc_table_reorder(docs, order);
+
+	int *parents = docs->parent.buf;
+	for (int i = 0; i < n_docs; i++) {
+		int parent = parents[i];
+		parents[i] = parent >= 0 && parent < order[i] ? new_idx[parent] : -1;
+	}
+	index_doc_kinds(source);
+
+	free(next);
+	free(stack);
+	free(new_idx);
+	free(order);
+	free(first);
+	free(keys);
 }
 
-void maybe_write_text(Vector *html, const char *in, int start, int end)
+void maybe_write_text(Sink *out, const char *in, int64_t start, int64_t end)
 {
 	if (start >= 0 && end >= start)
-		vector_append_utf8_html(html, &in[start], end - start + 1);
+		sink_append_utf8_html(out, &in[start], end - start + 1);
+}
+
+// What the links on a page are worked out from
+typedef struct {
+	const Page_Ref *page;
+	const Source *source;
+	Vector scope; // qualified name of the doc being written, which names in its code are looked up from
+	int scope_min; // the length of the package in scope, which is as short as it gets
+	Vector probe;
+} Linker;
+
+static bool is_link_name_byte(char c)
+{
+	return c == '_' || c == '$' || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static void linker_set_scope(Linker *lk, int doc)
+{
+	int anchor = symbol_key(lk->source, doc, &lk->scope);
+	lk->scope_min = anchor > 0 ? anchor - 1 : 0;
+}
+
+// Names are noted as they're looked up when the page asks for it (for --watch), misses
+//  included, since a name that appears later can change the page as much as one that goes away
+static const Symbol *linker_lookup(Linker *lk, const char *key, int len, bool simple)
+{
+	Symbols *symbols = lk->page->symbols;
+	if (lk->page->lookups)
+		*(uint64_t*)vector_add(lk->page->lookups, sizeof(uint64_t), 1) = symbols_key_hash(key, len, simple);
+
+	return simple ? symbols_find_type(symbols, key, len) : symbols_find(symbols, key, len);
+}
+
+// The symbol a doc was added to the table under, or NULL if it doesn't have one
+static const Symbol *linker_find_doc(Linker *lk, int doc)
+{
+	if (!lk->page->symbols)
+		return NULL;
+
+	symbol_key(lk->source, doc, &lk->probe);
+	return lk->probe.n > 0 ? linker_lookup(lk, lk->probe.buf, lk->probe.n, false) : NULL;
+}
+
+// Whether this doc is the one its name links to, in which case its element carries the id
+static const Symbol *linker_own_anchor(Linker *lk, int doc)
+{
+	const Symbol *sym = linker_find_doc(lk, doc);
+	return sym && sym->page_idx == lk->page->index && sym->doc == doc ? sym : NULL;
+}
+
+// Finds the type a name refers to from the current scope: a type nested in one of the classes
+//  around it, then one in the same package, then a fully qualified name, then the only type
+//  anywhere with that simple name
+static const Symbol *linker_find_type(Linker *lk, const char *name, int len)
+{
+	if (!lk->page->symbols)
+		return NULL;
+
+	const char *scope = lk->scope.buf;
+	int end = lk->scope.n;
+
+	while (end > 0) {
+		lk->probe.n = 0;
+		vector_append_array(&lk->probe, 1, scope, end);
+		*(char*)vector_add(&lk->probe, 1, 1) = '.';
+		vector_append_array(&lk->probe, 1, name, len);
+
+		const Symbol *sym = linker_lookup(lk, lk->probe.buf, lk->probe.n, false);
+		if (sym && sym->is_type)
+			return sym;
+
+		if (end <= lk->scope_min)
+			break;
+
+		do {
+			end--;
+		} while (end > lk->scope_min && scope[end] != '.');
+	}
+
+	const Symbol *sym = linker_lookup(lk, name, len, false);
+	if (sym && sym->is_type)
+		return sym;
+
+	const char *dot = memchr(name, '.', len);
+	if (!dot)
+		return linker_lookup(lk, name, len, true);
+
+	// eg. Outer.Inner, where Outer is found the same way as any other name
+	const Symbol *outer = linker_find_type(lk, name, dot - name);
+	if (!outer)
+		return NULL;
+
+	lk->probe.n = 0;
+	vector_append_cstring(&lk->probe, outer->name);
+	vector_append_array(&lk->probe, 1, dot, len - (dot - name));
+
+	sym = linker_lookup(lk, lk->probe.buf, lk->probe.n, false);
+	return sym && sym->is_type ? sym : NULL;
+}
+
+// The target's page relative to this one, then its anchor
+static void write_href(Sink *out, Linker *lk, const Symbol *sym)
+{
+	const char *from = lk->page->name;
+	const char *to = sym->page;
+
+	if (strcmp(from, to) != 0) {
+		int common = 0;
+		for (int i = 0; from[i] && from[i] == to[i]; i++) {
+			if (from[i] == '/')
+				common = i + 1;
+		}
+
+		for (const char *p = from + common; *p; p++) {
+			if (*p == '/')
+				sink_append_cstring(out, "../");
+		}
+		sink_append_utf8_html(out, to + common, strlen(to + common));
+	}
+
+	sink_append_cstring(out, "#");
+	sink_append_utf8_html(out, sym->anchor, strlen(sym->anchor));
+}
+
+static void write_link(Sink *out, Linker *lk, const Symbol *sym, const char *text, int len)
+{
+	sink_append_cstring(out, "<a href=\"");
+	write_href(out, lk, sym);
+	sink_append_cstring(out, "\">");
+	sink_append_utf8_html(out, text, len);
+	sink_append_cstring(out, "</a>");
+}
+
+// Writes a stretch of code, with known type names as links, and the doc's own name as a link
+//  to the doc. Only names starting with a capital (or a qualified name ending in one) are
+//  looked up as types, which leaves out keywords, primitives and parameter names.
+static void write_code_links(Sink *out, Linker *lk, int doc, int64_t start, int64_t end)
+{
+	if (start < 0 || end < start)
+		return;
+
+	const char *in = lk->source->file.buf;
+	const Span *name = doc_name(&lk->source->docs, doc);
+	const Symbol *self = name->start >= start && name->end <= end ? linker_find_doc(lk, doc) : NULL;
+
+	linker_set_scope(lk, doc);
+
+	int64_t text_start = start;
+	int64_t i = start;
+
+	while (i <= end) {
+		char c = in[i];
+		if (!is_link_name_byte(c) || (c >= '0' && c <= '9') || (i > start && (is_link_name_byte(in[i-1]) || in[i-1] == '.'))) {
+			i++;
+			continue;
+		}
+
+		int64_t name_start = i;
+		int64_t last_part = i;
+		while (i <= end && (is_link_name_byte(in[i]) || (in[i] == '.' && i < end && is_link_name_byte(in[i+1])))) {
+			if (in[i] == '.')
+				last_part = i + 1;
+			i++;
+		}
+		int len = i - name_start;
+
+		const Symbol *sym = NULL;
+		if (self && name_start == name->start && i - 1 == name->end)
+			sym = self;
+		else if (in[last_part] >= 'A' && in[last_part] <= 'Z')
+			sym = linker_find_type(lk, &in[name_start], len);
+
+		if (sym) {
+			maybe_write_text(out, in, text_start, name_start - 1);
+			write_link(out, lk, sym, &in[name_start], len);
+			text_start = i;
+		}
+	}
+
+	maybe_write_text(out, in, text_start, end);
+}
+
+// Whether a doc is shown on its page at all, in the table of classes or one of the summaries,
+//  and so has somewhere to carry its id. Others, like a Kotlin object, are only in the code.
+bool doc_carries_id(unsigned int flags)
+{
+	return (flags & (DOC_FLAG_IS_PARENT | DOC_FLAG_CTOR | DOC_FLAG_METHOD | DOC_FLAG_FIELD)) != 0;
+}
+
+// A doc can be listed in more than one summary, and in the table of classes, but its id can
+//  only be in one place: the table for classes, or else the first summary it's in
+static bool carries_id(unsigned int flags, int kind)
+{
+	if (flags & DOC_FLAG_IS_PARENT)
+		return false;
+	if (flags & DOC_FLAG_CTOR)
+		return kind == DOC_KIND_CTOR;
+	if (flags & DOC_FLAG_METHOD)
+		return kind == DOC_KIND_METHOD;
+	return kind == DOC_KIND_FIELD;
 }
 
-void emit_summary(Vector *html, Source *source, const char *title, unsigned int mask)
+// Lists every doc of one kind, going through that kind's list rather than every doc
+void emit_summary(Sink *out, Linker *lk, const char *title, int kind)
 {
-	vector_append_cstring(html, "<h2>");
-	vector_append_utf8_html(html, title, strlen(title));
-	vector_append_cstring(html, "</h2><ul>");
+	sink_append_cstring(out, "<h2>");
+	sink_append_utf8_html(out, title, strlen(title));
+	sink_append_cstring(out, "</h2><ul>");
 
+	const Source *source = lk->source;
 	const char *in = source->file.buf;
-	const Doc *d = (Doc*)source->docs.buf;
+	const Doc_Table *docs = &source->docs;
 	const Span *descs = (Span*)source->descs.buf;
-	int n_docs = source->docs.n;
-
-	for (int i = 0; d && i < n_docs; i++) {
-		if (d->flags & mask) {
-			vector_append_cstring(html, "<li><a href=\"");
-			// write link
-			vector_append_cstring(html, "\">");
-			maybe_write_text(html, in, d->main.code_start, d->main.code_end);
-			vector_append_cstring(html, "</a></li>");
-
-			if (d->first_desc_line >= 0) {
-				const Span *first = &descs[d->first_desc_line];
-				if (first->start >= 0 && first->end >= first->start) {
-					vector_append_cstring(html, "<ul><li>");
-					vector_append_utf8_html(html, &in[first->start], first->end - first->start + 1);
-					vector_append_cstring(html, "</li></ul>");
-				}
+	const int *members = source->kinds[kind].buf;
+	int n_members = source->kinds[kind].n;
+
+	for (int m = 0; members && m < n_members; m++) {
+		int i = members[m];
+		const Symbol *own = carries_id(doc_flags(docs, i), kind) ? linker_own_anchor(lk, i) : NULL;
+		if (own) {
+			sink_append_cstring(out, "<li id=\"");
+			sink_append_utf8_html(out, own->anchor, strlen(own->anchor));
+			sink_append_cstring(out, "\">");
+		}
+		else {
+			sink_append_cstring(out, "<li>");
+		}
+		const Tag *main = doc_main(docs, i);
+		write_code_links(out, lk, i, main->code_start, main->code_end);
+		sink_append_cstring(out, "</li>");
+
+		int first_desc = doc_detail(docs, i)->first_desc_line;
+		if (first_desc >= 0) {
+			const Span *first = &descs[first_desc];
+			if (first->start >= 0 && first->end >= first->start) {
+				sink_append_cstring(out, "<ul><li>");
+				sink_append_utf8_html(out, &in[first->start], first->end - first->start + 1);
+				sink_append_cstring(out, "</li></ul>");
 			}
 		}
-		d++;
 	}
 
-	vector_append_cstring(html, "</ul>");
+	sink_append_cstring(out, "</ul>");
 }
 
-File generate_html(Source *source, File *css, int should_embed_css)
+// What the source's main type extends and implements, as links where they're known
+static void emit_inherited_names(Sink *out, Linker *lk)
 {
-	Vector html = {0};
+	const Source *source = lk->source;
 	const char *in = source->file.buf;
-	
+	const Span *ext = &source->extends_name;
+	const Span *impls = source->implements_names.buf;
+	int n_impls = impls ? source->implements_names.n : 0;
+
+	bool has_extends = ext->start >= 0 && ext->end >= ext->start;
+	if (!has_extends && n_impls == 0)
+		return;
+
+	// names are looked up from the package
+	lk->scope.n = 0;
+	const Span *pkg = &source->package_name;
+	if (pkg->start >= 0 && pkg->end >= pkg->start)
+		vector_append_array(&lk->scope, 1, &in[pkg->start], pkg->end - pkg->start + 1);
+	lk->scope_min = lk->scope.n;
+
+	sink_append_cstring(out, "<p>");
+	for (int i = has_extends ? -1 : 0; i < n_impls; i++) {
+		const Span *name = i < 0 ? ext : &impls[i];
+		if (i < 0)
+			sink_append_cstring(out, "extends ");
+		else if (i == 0)
+			sink_append_cstring(out, has_extends ? " implements " : "implements ");
+		else
+			sink_append_cstring(out, ", ");
+
+		int len = name->end - name->start + 1;
+		const Symbol *sym = linker_find_type(lk, &in[name->start], len);
+		if (sym)
+			write_link(out, lk, sym, &in[name->start], len);
+		else
+			sink_append_utf8_html(out, &in[name->start], len);
+	}
+	sink_append_cstring(out, "</p>");
+}
+
+// Escapes the stylesheet once for every page of the run. One that's written into the output is
+//  named after a hash of its contents, so that it can be cached for as long as it exists.
+void stylesheet_init(Stylesheet *css, const File *file, bool embed, bool in_output)
+{
+	memset(css, 0, sizeof(Stylesheet));
+	css->file = file;
+	css->embed = embed;
+	css->in_output = in_output && !embed;
+
+	if (embed) {
+		Vector escaped = {0};
+		if (vector_append_utf8_html(&escaped, file->buf, file->size)) {
+			css->embedded = escaped.buf;
+			css->embedded_len = escaped.n;
+			return;
+		}
+
+		// too large to put in every page, so they link to it instead
+		vector_free(&escaped);
+		css->embed = false;
+		css->in_output = in_output;
+	}
+
+	Vector name = {0};
+	if (css->in_output) {
+		// "style.css" becomes "style.<hash>.css"
+		const char *dot = strrchr(file->name, '.');
+		int stem = dot && dot > file->name ? (int)(dot - file->name) : (int)strlen(file->name);
+
+		char hash[24];
+		snprintf(hash, sizeof(hash), ".%016llx", (unsigned long long)hash_bytes(file->buf, file->size, 0));
+
+		vector_append_array(&name, 1, file->name, stem);
+		vector_append_cstring(&name, hash);
+		vector_append_cstring(&name, dot && dot > file->name ? dot : ".css");
+	}
+	else {
+		vector_append_cstring(&name, file->name);
+	}
+
+	Vector href = {0};
+	vector_append_utf8_html(&href, name.buf, name.n);
+	css->href = href.buf;
+	css->href_len = href.n;
+
+	*(char*)vector_add(&name, 1, 1) = '\0';
+	css->out_name = name.buf;
+}
+
+void stylesheet_free(Stylesheet *css)
+{
+	free(css->embedded);
+	free(css->out_name);
+	free(css->href);
+}
+
+// "../" for every folder the page is in, to get back to the top of the output
+static void emit_path_to_top(Sink *out, const Page_Ref *page)
+{
+	for (const char *p = page->name; *p; p++) {
+		if (*p == '/')
+			sink_write(out, "../", 3);
+	}
+}
+
+void generate_html(Source *source, const Page_Ref *page, const Stylesheet *css, Sink *out)
+{
+	const char *in = source->file.buf;
+
+	Linker lk = {0};
+	lk.page = page;
+	lk.source = source;
 	const char *class_name = NULL;
 	int class_name_len = 0;
 
@@ -141,75 +576,111 @@ File generate_html(Source *source, File *css, int should_embed_css)
 		}
 	}
 
-	vector_append_cstring(&html, "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>");
-	vector_append_utf8_html(&html, class_name, class_name_len);
-	vector_append_cstring(&html, "</title>");
+	sink_append_cstring(out, "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>");
+	sink_append_utf8_html(out, class_name, class_name_len);
+	sink_append_cstring(out, "</title>");
 
-	if (should_embed_css) {
-		vector_append_cstring(&html, "<style>\n");
-		vector_append_utf8_html(&html, css->buf, css->size);
-		vector_append_cstring(&html, "\n</style>");
+	if (css->embed) {
+		sink_append_cstring(out, "<style>\n");
+		sink_write(out, css->embedded, css->embedded_len);
+		sink_append_cstring(out, "\n</style>");
 	}
 	else {
-		vector_append_cstring(&html, "<link rel=\"stylesheet\" href=\"");
-		vector_append_utf8_html(&html, css->name, strlen(css->name));
-		vector_append_cstring(&html, "\">");
-	}
-
-	vector_append_cstring(&html, "</head>\n<body><h1>");
-	vector_append_utf8_html(&html, class_name, class_name_len);
-	vector_append_cstring(&html, "</h1>");
-
-	Doc *d = source->docs.buf;
-	int n_docs = source->docs.n;
-
-	vector_append_cstring(&html, "<table><tbody>");
-
-	for (int i = 0; d && i < n_docs; i++) {
-		if (d->flags & DOC_FLAG_IS_PARENT) {
-			vector_append_cstring(&html, "<tr><td>");
-			if (d->flags & DOC_FLAG_FINAL)
-				vector_append_cstring(&html, "final ");
-			if (d->flags & DOC_FLAG_STATIC)
-				vector_append_cstring(&html, "static ");
-			if (d->flags & DOC_FLAG_ABSTRACT)
-				vector_append_cstring(&html, "abstract ");
-
-			if (d->flags & DOC_FLAG_CLASS)
-				vector_append_cstring(&html, "class");
-			else if (d->flags & DOC_FLAG_STRUCT)
-				vector_append_cstring(&html, "struct");
-			else if (d->flags & DOC_FLAG_EXTENSION)
-				vector_append_cstring(&html, "extension");
-			else if (d->flags & DOC_FLAG_INTERFACE)
-				vector_append_cstring(&html, "interface");
-
-			vector_append_cstring(&html, "</td><td>");
-			if (d->name.start >= 0 && d->name.end >= d->name.start) {
-				// write parent names here, eg. ParentClass.SubParent.
-				vector_append_utf8_html(&html, &in[d->name.start], d->name.end - d->name.start + 1);
-			}
+		sink_append_cstring(out, "<link rel=\"stylesheet\" href=\"");
+		if (css->in_output)
+			emit_path_to_top(out, page);
+		sink_write(out, css->href, css->href_len);
+		sink_append_cstring(out, "\">");
+	}
+
+	if (page->has_search) {
+		sink_append_cstring(out, "<script src=\"");
+		emit_path_to_top(out, page);
+		sink_append_cstring(out, "search.js\" defer></script>");
+	}
+
+	sink_append_cstring(out, "</head>\n<body><h1>");
+	sink_append_utf8_html(out, class_name, class_name_len);
+	sink_append_cstring(out, "</h1>");
 
-			vector_append_cstring(&html, "</td><td>");
-			maybe_write_text(&html, in, d->main.cmt_start, d->main.cmt_end);
+	emit_inherited_names(out, &lk);
 
-			vector_append_cstring(&html, "</td></tr>");
+	const Doc_Table *docs = &source->docs;
+	const int *types = source->kinds[DOC_KIND_PARENT].buf;
+	int n_types = source->kinds[DOC_KIND_PARENT].n;
+
+	sink_append_cstring(out, "<table><tbody>");
+
+	for (int t = 0; types && t < n_types; t++) {
+		int i = types[t];
+		unsigned int flags = doc_flags(docs, i);
+		const Span *type_name = doc_name(docs, i);
+
+		const Symbol *own = linker_own_anchor(&lk, i);
+		if (own) {
+			sink_append_cstring(out, "<tr id=\"");
+			sink_append_utf8_html(out, own->anchor, strlen(own->anchor));
+			sink_append_cstring(out, "\"><td>");
 		}
-		d++;
-	}
+		else {
+			sink_append_cstring(out, "<tr><td>");
+		}
+
+		if (flags & DOC_FLAG_FINAL)
+			sink_append_cstring(out, "final ");
+		if (flags & DOC_FLAG_STATIC)
+			sink_append_cstring(out, "static ");
+		if (flags & DOC_FLAG_ABSTRACT)
+			sink_append_cstring(out, "abstract ");
+
+		if (flags & DOC_FLAG_CLASS)
+			sink_append_cstring(out, "class");
+		else if (flags & DOC_FLAG_STRUCT)
+			sink_append_cstring(out, "struct");
+		else if (flags & DOC_FLAG_EXTENSION)
+			sink_append_cstring(out, "extension");
+		else if (flags & DOC_FLAG_INTERFACE)
+			sink_append_cstring(out, "interface");
+
+		sink_append_cstring(out, "</td><td>");
+		if (type_name->start >= 0 && type_name->end >= type_name->start) {
+			// the classes it's nested in, outermost first, eg. ParentClass.SubParent.
+			int parents[MAX_CLASS_LEVELS];
+			int n_parents = 0;
+			for (int p = doc_parent(docs, i); p >= 0 && p < i && n_parents < MAX_CLASS_LEVELS; p = doc_parent(docs, p))
+				parents[n_parents++] = p;
+
+			for (int j = n_parents - 1; j >= 0; j--) {
+				const Span *name = doc_name(docs, parents[j]);
+				if (name->start < 0 || name->end < name->start)
+					continue;
+
+				const Symbol *sym = linker_find_doc(&lk, parents[j]);
+				if (sym)
+					write_link(out, &lk, sym, &in[name->start], name->end - name->start + 1);
+				else
+					sink_append_utf8_html(out, &in[name->start], name->end - name->start + 1);
+				sink_append_cstring(out, ".");
+			}
 
-	vector_append_cstring(&html, "</tbody></table>");
+			sink_append_utf8_html(out, &in[type_name->start], type_name->end - type_name->start + 1);
+		}
+
+		sink_append_cstring(out, "</td><td>");
+		const Tag *main = doc_main(docs, i);
+		maybe_write_text(out, in, main->cmt_start, main->cmt_end);
+
+		sink_append_cstring(out, "</td></tr>");
+	}
 
-	emit_summary(&html, source, "Constructors", DOC_FLAG_CTOR);
-	emit_summary(&html, source, "Methods", DOC_FLAG_METHOD);
-	emit_summary(&html, source, "Fields", DOC_FLAG_FIELD);
+	sink_append_cstring(out, "</tbody></table>");
 
-	vector_append_cstring(&html, "</body></html>\n");
+	emit_summary(out, &lk, "Constructors", DOC_KIND_CTOR);
+	emit_summary(out, &lk, "Methods", DOC_KIND_METHOD);
+	emit_summary(out, &lk, "Fields", DOC_KIND_FIELD);
 
-	fwrite(html.buf, 1, html.n, stdout);
+	sink_append_cstring(out, "</body></html>\n");
 
-	File res = {0};
-	res.buf = html.buf;
-	res.size = html.n;
-	return res;
+	vector_free(&lk.scope);
+	vector_free(&lk.probe);
 }
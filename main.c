@@ -3,6 +3,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+typedef struct Page_Run Page_Run;
+
+typedef struct {
+	char *path;
+	long size;
+	int index;
+	bool owns_path;
+	bool stream; // stdin or a pipe, which is parsed as it's read
+	Zip *zip;
+	int zip_entry;
+	char *out_name;
+	bool started;
+	File file;
+	bool prefetched;
+	Source *source; // from when it's read until its page is out, or for the whole run with --watch
+	Arena arena; // holds the source's tables, which go in one go once its page is rendered
+	bool released; // let go after the first pass, to be read and parsed again for its page
+	bool cached;
+	Page_Run *run;
+	Sink html;
+	bool done;
+	int page_fd; // with --out-folder, the page's own file
+	Stats_File stats;
+	char *watch_path; // with --watch, where the source is read from again when it changes
+	int root;         // the input folder it was found in, or -1
+	bool gone;        // the source was removed after the first run
+	Vector lookups;   // the hashes of the names the page looked up, sorted, for the cache and --watch
+} Page_Job;
+
+// Jobs are kept in fixed blocks so that they stay put while more are added, eg. during a folder walk
+#define PAGE_BLOCK_SIZE 1024
+#define MAX_PAGE_BLOCKS 16384
+
+#define OUT_ZIP_LEVEL 6
+
+// Small sources are read ahead in groups of this many when there's an io_uring to do it
+#define PREFETCH_BATCH 64
+
+// How much of the parsed sources (text and tables) the first pass keeps for the second.
+// Sources past this are let go once the table of symbols has what they declare, and are
+//  read and parsed again when their page is rendered, so memory doesn't grow with the corpus.
+#define PAGE_HOLD_MAX ((int64_t)32 << 20)
+
+// Memory that a worker keeps between pages, so each new page doesn't start from malloc
+typedef struct {
+	Chunk_Pool *chunks;
+} Worker_State;
+
+// Page names already given out, so that no two sources end up with the same page
+typedef struct {
+	char **slots;
+	int cap;
+	int n;
+} Page_Names;
+
+struct Page_Run {
+	Page_Job **blocks;
+	int n_jobs;
+	int next_out;
+	Stylesheet *css;
+	Cache *cache;
+	Worker_State *workers;
+	Zip_Writer *zip_out;
+	char *out_folder;
+	bool watch;
+	Uring *ring;
+	Symbols *symbols;
+	int64_t held; // bytes of parsed sources kept for the second pass, up to PAGE_HOLD_MAX
+	Search_Index *search;
+	int out_fd;
+	bool write_failed;
+	int sort_order;
+	Page_Names names;
+	Page_Names search_files; // with --out-folder, the parts of the search index being written
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
 
 void print_help()
 {
@@ -19,21 +103,27 @@ void print_help()
 		"      File listing every file to exclude\n"
 		"   --exts <list of file extensions>\n"
 		"      Comma separated without spaces, eg. \"java,kt\"\n"
+		"      Only applies to files found with --in-folder or --in-zip\n"
+		"      Defaults to \"java,kt,swift\"\n"
 		"   --in-single <source file>\n"
 		"      Add one source file to the list of inputs\n"
+		"      Its page is named after the file, or after its whole path\n"
+		"       if another source file given this way has the same name\n"
 		"   --in-zip <ZIP-compatible file>\n"
-		"      Archive containing input source files\n"
+		"      Archive containing input source files, eg. a ZIP or a source JAR\n"
 		"   --in-folder <folder>\n"
 		"      Folder containing input source files\n"
+		"      Sub-folders are searched too, except for hidden ones\n"
 		"   --out-single <HTML file>\n"
 		"      Generate an HTML file\n"
 		"      Only valid if there is only one input source file\n"
 		"   --out-zip <ZIP file>\n"
-		"      Output to a new ZIP file\n"
+		"      Output to a new ZIP file, with a search index for the pages\n"
 		"      NOTE: this operation deletes and replaces any existing output file\n"
 		"   --out-folder <folder>\n"
-		"      Output to a new folder\n"
-		"      NOTE: this operation deletes and replaces any existing output folder\n"
+		"      Output to a folder, with a search index for the pages\n"
+		"      NOTE: files in the folder with the same names are replaced, others are left alone,\n"
+		"       except for the parts of an older search index in its search folder\n"
 		"   --css <file>\n"
 		"      Select the CSS file to use\n"
 		"      Defaults to \"style.css\"\n"
@@ -41,12 +131,896 @@ void print_help()
 		"      Set whether the CSS file will be embedded into HTML or kept separate\n"
 		"      Supported modes are \"always\", \"never\" or \"auto\"\n"
 		"      Defaults to \"auto\", where the CSS is embedded only if\n"
-		"       exactly one source file is given\n\n"
+		"       exactly one source file is given\n"
+		"   --jobs <n>\n"
+		"      Number of worker threads used to read, parse and render sources\n"
+		"      Sources of several MB are also split between them to be parsed\n"
+		"      0 uses every available core. Defaults to 1\n"
+		"   --io <mode>\n"
+		"      How sources are read: \"uring\" reads small sources in batches\n"
+		"       with io_uring where the kernel allows it, \"sync\" reads one at a time\n"
+		"      Defaults to \"uring\"\n"
+		"   --cache-dir <folder>\n"
+		"      Keep parsed sources and generated pages here, and reuse them for\n"
+		"       sources that haven't changed. A page is only reused if everything\n"
+		"       it links to is still where it was. Entries for sources that are\n"
+		"       no longer given are removed\n"
+		"   --stats[=json]\n"
+		"      Report where the time went to stderr once done: each phase,\n"
+		"       bytes read and written, what each file produced, and the slowest files\n"
+		"   --watch\n"
+		"      After writing every page, keep watching the sources given with\n"
+		"       --in-single and --in-folder, and update the pages when they change\n"
+		"      Only valid with --out-folder\n\n"
 		"If any --in-* command is given \"-\", contents will be read from stdin.\n"
+		" They're parsed as they arrive, but kept in memory until their page is written.\n"
 		"If any --out-* command is given \"-\", contents will be written to stdout.\n"
 	);
 }
 
+Page_Job *page_job(Page_Run *run, int idx)
+{
+	return &run->blocks[idx / PAGE_BLOCK_SIZE][idx % PAGE_BLOCK_SIZE];
+}
+
+// Only the main thread adds pages. Returns -1 once there's no more room.
+int add_page(Page_Run *run, char *path, long size, bool owns_path)
+{
+	int idx = run->n_jobs;
+	if (idx >= PAGE_BLOCK_SIZE * MAX_PAGE_BLOCKS)
+		return -1;
+
+	if (idx % PAGE_BLOCK_SIZE == 0)
+		run->blocks[idx / PAGE_BLOCK_SIZE] = malloc(PAGE_BLOCK_SIZE * sizeof(Page_Job));
+
+	Page_Job *pj = page_job(run, idx);
+	memset(pj, 0, sizeof(Page_Job));
+	pj->path = path;
+	pj->size = size;
+	pj->index = idx;
+	pj->owns_path = owns_path;
+	pj->run = run;
+	pj->page_fd = -1;
+	pj->root = -1;
+
+	run->n_jobs++;
+	return idx;
+}
+
+// The name of a page inside an output archive: the source's path with .html for its extension.
+// Leading slashes and any "." or ".." folders are dropped, so that every page stays inside the archive.
+char *page_out_name(const char *path)
+{
+	Vector name = {0};
+
+	while (*path) {
+		const char *slash = strchr(path, '/');
+		int len = slash ? slash - path : (int)strlen(path);
+
+		bool skip = len == 0 || (len == 1 && path[0] == '.') || (len == 2 && path[0] == '.' && path[1] == '.');
+		if (!skip) {
+			if (name.n > 0)
+				*(char*)vector_add(&name, 1, 1) = '/';
+			vector_append_array(&name, 1, path, len);
+		}
+
+		path += slash ? len + 1 : len;
+	}
+
+	// replace the extension, if the file name has one
+	char *buf = name.buf;
+	int ext = name.n;
+	for (int i = name.n - 1; i > 0 && buf[i] != '/'; i--) {
+		if (buf[i] == '.' && buf[i-1] != '/') {
+			ext = i;
+			break;
+		}
+	}
+	name.n = ext;
+
+	vector_append_cstring(&name, name.n > 0 ? ".html" : "index.html");
+	*(char*)vector_add(&name, 1, 1) = '\0';
+	return name.buf;
+}
+
+// The slot with the name in it, or the empty slot where it would go
+int page_names_slot(const Page_Names *names, const char *name)
+{
+	int i = hash_bytes(name, strlen(name), 0) & (names->cap - 1);
+	while (names->slots[i] && strcmp(names->slots[i], name) != 0)
+		i = (i + 1) & (names->cap - 1);
+	return i;
+}
+
+bool page_names_has(const Page_Names *names, const char *name)
+{
+	return names->n > 0 && names->slots[page_names_slot(names, name)];
+}
+
+// Adds a name to the set unless it's there already. The set keeps the pointer, not a copy.
+bool page_names_add(Page_Names *names, char *name)
+{
+	if ((names->n + 1) * 2 > names->cap) {
+		int cap = names->cap ? names->cap * 2 : 1024;
+		Page_Names grown = { .slots = calloc(cap, sizeof(char*)), .cap = cap };
+		for (int i = 0; i < names->cap; i++) {
+			if (names->slots[i])
+				grown.slots[page_names_slot(&grown, names->slots[i])] = names->slots[i];
+		}
+		free(names->slots);
+		names->slots = grown.slots;
+		names->cap = grown.cap;
+	}
+
+	int i = page_names_slot(names, name);
+	if (names->slots[i])
+		return false;
+
+	names->slots[i] = name;
+	names->n++;
+	return true;
+}
+
+// Frees the set, and the names in it if it owns them
+void page_names_free(Page_Names *names, bool owned)
+{
+	for (int i = 0; owned && i < names->cap; i++)
+		free(names->slots[i]);
+	free(names->slots);
+	memset(names, 0, sizeof(Page_Names));
+}
+
+// Takes a page name from page_out_name and hands back one that no other page has, which is the
+//  same name unless it's taken. Then a number goes before the extension, as in "Foo-2.html".
+char *unique_page_name(Page_Run *run, char *name)
+{
+	if (page_names_add(&run->names, name))
+		return name;
+
+	int len = strlen(name) - strlen(".html");
+	char *numbered = malloc(len + 32);
+	for (int k = 2; ; k++) {
+		snprintf(numbered, len + 32, "%.*s-%d.html", len, name, k);
+		if (page_names_add(&run->names, numbered))
+			break;
+	}
+
+	free(name);
+	return numbered;
+}
+
+// The path of a file inside the output folder, to be freed by the caller
+char *output_path(const char *folder, const char *name)
+{
+	int folder_len = strlen(folder);
+	int name_len = strlen(name);
+
+	char *path = malloc(folder_len + name_len + 2);
+	memcpy(path, folder, folder_len);
+	path[folder_len] = '/';
+	memcpy(path + folder_len + 1, name, name_len + 1);
+	return path;
+}
+
+// Opens a file inside the output folder for writing, making the folders on the way to it
+int open_output_file(const char *folder, const char *name)
+{
+	char *path = output_path(folder, name);
+
+	for (char *p = path + strlen(folder) + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	free(path);
+	return fd;
+}
+
+// Output_Add for what goes next to the pages, ie. the stylesheet and the search index
+void add_output_file(void *ctx, const char *name, const void *data, int len)
+{
+	Page_Run *run = ctx;
+	if (run->zip_out) {
+		zip_writer_add(run->zip_out, name, data, len);
+		return;
+	}
+
+	char *copy = strncmp(name, "search/", 7) == 0 ? strdup(name) : NULL;
+	if (copy && !page_names_add(&run->search_files, copy))
+		free(copy);
+
+	int fd = open_output_file(run->out_folder, name);
+	const char *p = data;
+	while (fd >= 0 && len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		p += n;
+		len -= n;
+	}
+
+	if (fd < 0 || len > 0)
+		run->write_failed = true;
+	if (fd >= 0)
+		close(fd);
+}
+
+// Writes the search index next to the pages. In a folder, the chunks of an older index that the
+//  new one doesn't have are removed, since nothing lists them any more.
+void write_search_index(Page_Run *run)
+{
+	search_write(run->search, run->symbols, add_output_file, run);
+	if (!run->out_folder)
+		return;
+
+	char *path = output_path(run->out_folder, "search");
+	DIR *dir = opendir(path);
+	struct dirent *d;
+	while (dir && (d = readdir(dir))) {
+		int len = strlen(d->d_name);
+		if (len < 5 || strcmp(d->d_name + len - 5, ".json") != 0)
+			continue;
+
+		char *name = output_path("search", d->d_name);
+		if (!page_names_has(&run->search_files, name))
+			unlinkat(dirfd(dir), d->d_name, 0);
+		free(name);
+	}
+
+	if (dir)
+		closedir(dir);
+	free(path);
+	page_names_free(&run->search_files, true);
+}
+
+// A page can go straight to the output once every page before it has been written.
+// In a folder, each page has a file of its own, so it doesn't have to wait for anything.
+int page_output_fd(void *owner)
+{
+	Page_Job *pj = owner;
+	Page_Run *run = pj->run;
+	if (run->out_folder) {
+		if (pj->page_fd < 0)
+			pj->page_fd = open_output_file(run->out_folder, pj->out_name);
+		return pj->page_fd;
+	}
+
+	if (__atomic_load_n(&run->next_out, __ATOMIC_ACQUIRE) != pj->index)
+		return -1;
+
+	fflush(stdout);
+
+	if (run->zip_out && !pj->started) {
+		zip_writer_begin(run->zip_out, pj->out_name);
+		pj->started = true;
+	}
+	return run->out_fd;
+}
+
+// Sources are only allocated while they are needed, which for most is the time between the passes
+static Source *open_page_source(Page_Run *run, Page_Job *pj)
+{
+	pj->source = malloc(sizeof(Source));
+	source_init(pj->source, &pj->arena);
+	pj->source->sort_order = run->sort_order;
+	pj->source->access_level = DOC_ACCESS_PRIVATE;
+	return pj->source;
+}
+
+static void close_page_source(Page_Job *pj)
+{
+	if (pj->source) {
+		source_close(pj->source);
+		free(pj->source);
+		pj->source = NULL;
+	}
+}
+
+// Fills in the tables of a source that has been read, from the cache if it has them
+static void parse_page_source(Page_Run *run, Page_Job *pj)
+{
+	Source *source = pj->source;
+	pj->cached = !pj->stream && cache_load(run->cache, source, pj->out_name);
+	if (!pj->cached) {
+		if (!pj->stream)
+			parse_source_file(source);
+		sort_source_docs(source);
+	}
+}
+
+// First pass: every source is read and parsed, and what it declares goes into the table of
+//  symbols. Sources are kept (each in an arena of its own) until their page has been rendered,
+//  as far as PAGE_HOLD_MAX allows.
+void parse_page(void *data, int job, int worker)
+{
+	Page_Run *run = data;
+	Page_Job *pj = page_job(run, job);
+	uint64_t start = stats_enabled ? stats_clock() : 0;
+
+	Source *source = open_page_source(run, pj);
+	if (pj->prefetched)
+		source->file = pj->file;
+	else if (pj->zip)
+		source->file = zip_read_entry(pj->zip, pj->zip_entry);
+	else if (pj->stream)
+		read_source_stream(pj->path, source); // parsed as it's read, so its read time takes in the parse
+	else
+		source->file = read_whole_file(pj->path);
+
+	if (stats_enabled && !pj->prefetched) {
+		uint64_t now = stats_clock();
+		pj->stats.read_ns = now - start;
+		STATS_ADD(read_ns, now - start);
+		start = now;
+	}
+
+	if (!source->file.buf)
+		return;
+
+	pj->size = source->file.size;
+	parse_page_source(run, pj);
+
+	if (stats_enabled) {
+		Stats_File *st = &pj->stats;
+		st->parse_ns = stats_clock() - start;
+		st->size = source->file.size;
+		st->n_docs = source->docs.n;
+		st->n_tags = source->tags.n;
+		st->n_descs = source->descs.n;
+		st->cached = pj->cached;
+		STATS_ADD(bytes_read, source->file.size);
+	}
+
+	symbols_add_source(run->symbols, source, pj->index, pj->out_name);
+	if (run->search)
+		search_add_source(run->search, worker, source, pj->index, pj->out_name);
+
+	// streams can't be read again, and --watch keeps every source anyway
+	if (run->watch || pj->stream)
+		return;
+
+	int64_t held = source->file.size + arena_size(source->arena);
+	if (__atomic_add_fetch(&run->held, held, __ATOMIC_RELAXED) > PAGE_HOLD_MAX) {
+		__atomic_sub_fetch(&run->held, held, __ATOMIC_RELAXED);
+		file_join_path(&source->file);
+		close_page_source(pj);
+		pj->released = true;
+	}
+}
+
+// For a source that parse_page let go: reads it again and parses it as it was the first time
+static void reload_page_source(Page_Run *run, Page_Job *pj)
+{
+	Source *source = open_page_source(run, pj);
+	source->file = pj->zip ? zip_read_entry(pj->zip, pj->zip_entry) : read_whole_file(pj->path);
+
+	if (source->file.buf)
+		parse_page_source(run, pj);
+	pj->released = false;
+}
+
+// Sorts the names a page looked up and drops repeats, so they can be searched
+void sort_lookups(Vector *lookups)
+{
+	uint64_t *keys = lookups->buf;
+	if (lookups->n < 2)
+		return;
+
+	qsort(keys, lookups->n, sizeof(uint64_t), compare_u64);
+
+	int n = 1;
+	for (int i = 1; i < lookups->n; i++) {
+		if (keys[i] != keys[n-1])
+			keys[n++] = keys[i];
+	}
+	lookups->n = n;
+}
+
+// Readies the sink a page is rendered into, which finds its way to the output through page_output_fd
+void begin_page_sink(Page_Run *run, Page_Job *pj, Worker_State *ws)
+{
+	Sink *out = &pj->html;
+	sink_init(out, -1);
+	out->get_fd = page_output_fd;
+	out->owner = pj;
+	out->pool = ws->chunks;
+
+	// pages that couldn't be read stay empty, and don't get an entry in the archive
+	if (run->zip_out && pj->source->file.buf)
+		sink_deflate(out, OUT_ZIP_LEVEL);
+}
+
+// Second pass, once every source is in the table of symbols
+void render_page(void *data, int job, int worker)
+{
+	Page_Run *run = data;
+	Page_Job *pj = page_job(run, job);
+	Worker_State *ws = &run->workers[worker];
+	uint64_t start = stats_enabled ? stats_clock() : 0;
+
+	if (pj->released)
+		reload_page_source(run, pj);
+	Source *source = pj->source;
+
+	Sink *out = &pj->html;
+	begin_page_sink(run, pj, ws);
+
+	// a stored page is only as good as the links on it, so it's only taken if every name it
+	//  looked up still leads where it did. --watch gets those names from the entry too.
+	Vector *lookups = run->watch ? &pj->lookups : NULL;
+	bool reused = pj->cached && cache_load_page(run->cache, source, pj->out_name, run->symbols, lookups, out);
+
+	// an entry that broke off partway leaves some of its page behind, which is thrown away
+	if (!reused && out->size > 0) {
+		sink_close(out);
+		begin_page_sink(run, pj, ws);
+	}
+
+	if (source->file.buf && !reused) {
+		Page_Ref page = { .symbols = run->symbols, .name = pj->out_name, .index = pj->index, .has_search = run->search != NULL };
+
+		// streams never look in the cache, so there's no point storing them in it
+		Cache_Entry *entry = pj->stream ? NULL : cache_store_begin(run->cache, source, pj->out_name);
+		out->tee_fd = cache_entry_fd(entry);
+		if (entry || run->watch)
+			page.lookups = &pj->lookups;
+
+		generate_html(source, &page, run->css, out);
+		sink_finish(out);
+		sort_lookups(&pj->lookups);
+
+		cache_store_end(entry, out->size, run->symbols, &pj->lookups, !out->tee_failed);
+		out->tee_fd = -1;
+	}
+	else {
+		sink_finish(out);
+	}
+
+	// with --out-folder, a finished sink has written all of the page to its own file, which is
+	//  closed now rather than when write_pages gets to it, so files don't stay open in the meantime
+	if (pj->page_fd >= 0) {
+		close(pj->page_fd);
+		pj->page_fd = -1;
+	}
+
+	// --watch keeps every source, to render its page again when something it links to changes
+	if (!run->watch) {
+		close_page_source(pj);
+		vector_free(&pj->lookups);
+	}
+
+	if (stats_enabled)
+		pj->stats.render_ns = stats_clock() - start;
+
+	pthread_mutex_lock(&run->lock);
+	pj->done = true;
+	pthread_cond_broadcast(&run->cond);
+	pthread_mutex_unlock(&run->lock);
+}
+
+// Pages are written in the order their sources were given, regardless of which finished first
+void write_pages(Page_Run *run, bool wait)
+{
+	while (run->next_out < run->n_jobs) {
+		Page_Job *pj = page_job(run, run->next_out);
+
+		pthread_mutex_lock(&run->lock);
+		while (wait && !pj->done)
+			pthread_cond_wait(&run->cond, &run->lock);
+		bool done = pj->done;
+		pthread_mutex_unlock(&run->lock);
+
+		if (!done)
+			break;
+
+		Sink *html = &pj->html;
+		fflush(stdout);
+
+		if (run->zip_out && !pj->started && html->size > 0) {
+			zip_writer_begin(run->zip_out, pj->out_name);
+			pj->started = true;
+		}
+
+		if (!run->out_folder) {
+			sink_drain(html, run->out_fd);
+		}
+		else if (html->size > 0 && html->fd < 0) {
+			// pages that couldn't be read don't get a file, and most pages already had theirs
+			int fd = page_output_fd(pj);
+			sink_drain(html, fd);
+			if (fd < 0)
+				run->write_failed = true;
+		}
+
+		if (pj->page_fd >= 0) {
+			close(pj->page_fd);
+			pj->page_fd = -1;
+		}
+
+		if (pj->started)
+			zip_writer_end(run->zip_out, html->crc, html->packed_size, html->size);
+		if (html->failed)
+			run->write_failed = true;
+
+		sink_close(html);
+
+		// the file's name points into the path, and --watch renders the page again later
+		if (!run->watch) {
+			if (pj->owns_path)
+				free(pj->path);
+			pj->path = NULL;
+		}
+
+		__atomic_store_n(&run->next_out, run->next_out + 1, __ATOMIC_RELEASE);
+	}
+}
+
+// Reads whichever of these pages are small enough in one go, then queues them all
+void submit_pages(Page_Run *run, Pool *pool, int *pages, int n)
+{
+	if (run->ring && n > 0) {
+		File *files = calloc(n, sizeof(File));
+		const char **paths = malloc(n * sizeof(char*));
+		long *sizes = malloc(n * sizeof(long));
+		int *which = malloc(n * sizeof(int));
+		int n_small = 0;
+
+		for (int i = 0; i < n; i++) {
+			Page_Job *pj = page_job(run, pages[i]);
+			if (pj->zip || !pj->path || pj->stream || pj->size >= MMAP_THRESHOLD)
+				continue;
+
+			paths[n_small] = pj->path;
+			sizes[n_small] = pj->size;
+			which[n_small] = pages[i];
+			n_small++;
+		}
+
+		uint64_t start = stats_enabled ? stats_clock() : 0;
+		int n_read = n_small > 0 ? uring_read_files(run->ring, files, paths, sizes, n_small) : 0;
+
+		if (n_read > 0) {
+			// a batch is read all at once, so each file is given its share of the time
+			uint64_t share = 0;
+			if (stats_enabled) {
+				uint64_t took = stats_clock() - start;
+				STATS_ADD(read_ns, took);
+				share = took / n_read;
+			}
+
+			for (int i = 0; i < n_small; i++) {
+				if (!files[i].buf)
+					continue;
+
+				Page_Job *pj = page_job(run, which[i]);
+				pj->stats.read_ns = share;
+				pj->file = files[i];
+				file_set_path(&pj->file, pj->path);
+				pj->prefetched = true;
+			}
+		}
+
+		free(files);
+		free(paths);
+		free(sizes);
+		free(which);
+	}
+
+	for (int i = 0; i < n; i++)
+		pool_submit(pool, pages[i]);
+}
+
+int compare_page_size(const void *a, const void *b)
+{
+	const Page_Job *pa = *(const Page_Job**)a;
+	const Page_Job *pb = *(const Page_Job**)b;
+	if (pa->size != pb->size)
+		return pa->size < pb->size ? 1 : -1;
+	return pa < pb ? -1 : pa > pb;
+}
+
+// A source that changed while watching, and what it was before
+typedef struct {
+	int page;
+	Source old;
+	char *old_path;
+	bool owned_path;
+} Page_Update;
+
+int find_watched_page(Page_Run *run, const char *path)
+{
+	// single sources may have been given as "./Foo.java" or as "Foo.java"
+	if (path[0] == '.' && path[1] == '/')
+		path += 2;
+
+	for (int i = 0; i < run->n_jobs; i++) {
+		const char *p = page_job(run, i)->watch_path;
+		if (!p)
+			continue;
+		if (p[0] == '.' && p[1] == '/')
+			p += 2;
+		if (!strcmp(p, path))
+			return i;
+	}
+	return -1;
+}
+
+void queue_update(Vector *updates, int page)
+{
+	const Page_Update *ups = updates->buf;
+	for (int i = 0; i < updates->n; i++) {
+		if (ups[i].page == page)
+			return;
+	}
+
+	Page_Update *u = vector_add(updates, sizeof(Page_Update), 1);
+	memset(u, 0, sizeof(Page_Update));
+	u->page = page;
+}
+
+// Where each name declared by the updated sources leads, before or after, with the old source
+//  and the new one always taken in the same order
+void snapshot_updates(Page_Run *run, const Page_Update *ups, int n, Vector *states)
+{
+	for (int i = 0; i < n; i++) {
+		const Source *now = page_job(run, ups[i].page)->source;
+		if (ups[i].old.file.buf)
+			symbols_snapshot(run->symbols, &ups[i].old, states);
+		if (now->file.buf)
+			symbols_snapshot(run->symbols, now, states);
+	}
+}
+
+// Renders a page again straight into its file, noting what it looks up
+bool render_page_again(Page_Run *run, Page_Job *pj)
+{
+	int fd = open_output_file(run->out_folder, pj->out_name);
+	if (fd < 0)
+		return false;
+
+	Sink out;
+	sink_init(&out, fd);
+	out.pool = run->workers[0].chunks;
+
+	pj->lookups.n = 0;
+	Page_Ref page = { .symbols = run->symbols, .name = pj->out_name, .index = pj->index, .has_search = run->search != NULL, .lookups = &pj->lookups };
+	generate_html(pj->source, &page, run->css, &out);
+	sink_finish(&out);
+	sort_lookups(&pj->lookups);
+
+	bool ok = !out.failed;
+	sink_close(&out);
+	close(fd);
+	return ok;
+}
+
+bool looks_up_any(const Vector *lookups, const Vector *changed)
+{
+	if (lookups->n == 0)
+		return false;
+
+	const uint64_t *keys = changed->buf;
+	for (int i = 0; i < changed->n; i++) {
+		if (bsearch(&keys[i], lookups->buf, lookups->n, sizeof(uint64_t), compare_u64))
+			return true;
+	}
+	return false;
+}
+
+// Brings the output folder up to date after some sources changed. Those are parsed again and
+//  their names swapped in the table of symbols. Their pages are rendered again, and so is any
+//  other page that looked up a name which now leads somewhere else, or nowhere.
+void update_pages(Page_Run *run, const Watch_Event *events, int n_events, char **roots)
+{
+	uint64_t start = stats_clock();
+	Vector updates = {0};
+
+	for (int i = 0; i < n_events; i++) {
+		const Watch_Event *e = &events[i];
+		if (!e->path) {
+			for (int j = 0; j < run->n_jobs; j++) {
+				if (page_job(run, j)->watch_path)
+					queue_update(&updates, j);
+			}
+		}
+		else if (e->is_dir) {
+			int len = strlen(e->path);
+			for (int j = 0; j < run->n_jobs; j++) {
+				const char *p = page_job(run, j)->watch_path;
+				if (p && !strncmp(p, e->path, len) && p[len] == '/')
+					queue_update(&updates, j);
+			}
+		}
+		else {
+			int idx = find_watched_page(run, e->path);
+			if (idx < 0 && !e->removed && e->root >= 0) {
+				idx = add_page(run, NULL, -1, false);
+				if (idx >= 0) {
+					Page_Job *pj = page_job(run, idx);
+					pj->watch_path = strdup(e->path);
+					pj->root = e->root;
+					pj->out_name = unique_page_name(run, page_out_name(e->path + strlen(roots[e->root])));
+				}
+			}
+			if (idx >= 0)
+				queue_update(&updates, idx);
+		}
+	}
+
+	Page_Update *ups = updates.buf;
+	int n = updates.n;
+
+	// whatever the events said, a source is read again if it's there and dropped if it isn't
+	for (int i = 0; i < n; i++) {
+		Page_Job *pj = page_job(run, ups[i].page);
+		// a page added since the first pass has no source yet
+		if (!pj->source)
+			pj->source = calloc(1, sizeof(Source));
+		ups[i].old = *pj->source;
+		ups[i].old_path = pj->path;
+		ups[i].owned_path = pj->owns_path;
+
+		Source *source = pj->source;
+		source_init(source, NULL);
+		source->sort_order = run->sort_order;
+		source->access_level = DOC_ACCESS_PRIVATE;
+
+		pj->path = strdup(pj->watch_path);
+		pj->owns_path = true;
+
+		struct stat st;
+		if (stat(pj->path, &st) == 0 && S_ISREG(st.st_mode))
+			source->file = read_whole_file(pj->path);
+
+		pj->gone = !source->file.buf;
+		if (!pj->gone) {
+			pj->size = source->file.size;
+			parse_source_file(source);
+			sort_source_docs(source);
+		}
+	}
+
+	Vector before = {0};
+	snapshot_updates(run, ups, n, &before);
+
+	bool in_place = true;
+	for (int i = 0; i < n && in_place; i++) {
+		if (ups[i].old.file.buf)
+			in_place = symbols_remove_source(run->symbols, &ups[i].old, ups[i].page);
+	}
+
+	if (in_place) {
+		for (int i = 0; i < n; i++) {
+			Page_Job *pj = page_job(run, ups[i].page);
+			if (pj->source->file.buf)
+				symbols_add_source(run->symbols, pj->source, pj->index, pj->out_name);
+		}
+		symbols_settle(run->symbols);
+	}
+	else {
+		// a name declared by more than one source lost its winner, so the table starts over
+		//  from every source, and any page could link differently now
+		symbols_destroy(run->symbols);
+		run->symbols = symbols_create();
+		for (int i = 0; i < run->n_jobs; i++) {
+			Page_Job *pj = page_job(run, i);
+			if (pj->source->file.buf)
+				symbols_add_source(run->symbols, pj->source, pj->index, pj->out_name);
+		}
+	}
+
+	Vector changed = {0};
+	if (in_place) {
+		Vector after = {0};
+		snapshot_updates(run, ups, n, &after);
+
+		const Symbol_State *b = before.buf;
+		const Symbol_State *a = after.buf;
+		for (int i = 0; i < before.n; i++) {
+			if (b[i].value != a[i].value)
+				*(uint64_t*)vector_add(&changed, sizeof(uint64_t), 1) = b[i].key;
+		}
+		if (changed.n > 1)
+			qsort(changed.buf, changed.n, sizeof(uint64_t), compare_u64);
+		vector_free(&after);
+	}
+	vector_free(&before);
+
+	for (int i = 0; i < n; i++) {
+		Page_Job *pj = page_job(run, ups[i].page);
+		if (pj->gone && ups[i].old.file.buf) {
+			char *path = output_path(run->out_folder, pj->out_name);
+			unlink(path);
+			free(path);
+			vector_free(&pj->lookups);
+		}
+	}
+
+	int n_rendered = 0;
+	for (int i = 0; i < run->n_jobs; i++) {
+		Page_Job *pj = page_job(run, i);
+		if (!pj->source->file.buf)
+			continue;
+
+		bool updated = false;
+		for (int j = 0; j < n && !updated; j++)
+			updated = ups[j].page == i;
+
+		if (!in_place || updated || looks_up_any(&pj->lookups, &changed)) {
+			if (!render_page_again(run, pj))
+				printf("Could not write \"%s\"\n", pj->out_name);
+			n_rendered++;
+		}
+	}
+	vector_free(&changed);
+
+	if (run->search) {
+		bool search_changed = false;
+		for (int i = 0; i < n; i++) {
+			Page_Job *pj = page_job(run, ups[i].page);
+			const Source *source = pj->source->file.buf ? pj->source : NULL;
+			if (search_replace_source(run->search, source, pj->index, pj->out_name))
+				search_changed = true;
+		}
+		if (search_changed)
+			write_search_index(run);
+	}
+
+	for (int i = 0; i < n; i++) {
+		source_close(&ups[i].old);
+		if (ups[i].owned_path)
+			free(ups[i].old_path);
+	}
+	vector_free(&updates);
+
+	printf("Updated %d page%s for %d changed source%s in %.1f ms\n",
+		n_rendered, n_rendered == 1 ? "" : "s", n, n == 1 ? "" : "s", (stats_clock() - start) / 1e6);
+	fflush(stdout);
+}
+
+// Keeps the output folder up to date with the sources, until they can't be watched any more
+void watch_sources(Page_Run *run, const char *exts, char **roots, int n_roots)
+{
+	Watch *w = watch_open(exts);
+	bool ok = w != NULL;
+
+	for (int i = 0; i < n_roots && ok; i++)
+		ok = watch_add_tree(w, roots[i], i);
+
+	for (int i = 0; i < run->n_jobs && ok; i++) {
+		Page_Job *pj = page_job(run, i);
+		if (pj->watch_path && pj->root < 0)
+			ok = watch_add_file(w, pj->watch_path);
+	}
+
+	if (!ok) {
+		printf("Could not watch the sources for changes\n");
+		watch_close(w);
+		return;
+	}
+
+	printf("Watching for changes\n");
+	fflush(stdout);
+
+	Vector events = {0};
+	int n;
+	while ((n = watch_wait(w, &events)) >= 0) {
+		update_pages(run, events.buf, n, roots);
+
+		Watch_Event *ev = events.buf;
+		for (int i = 0; i < n; i++)
+			free(ev[i].path);
+	}
+
+	printf("Stopped watching for changes\n");
+	vector_free(&events);
+	watch_close(w);
+}
+
 int main(int argc, char **argv)
 {
 	if (argc < 3) {
@@ -58,12 +1032,39 @@ int main(int argc, char **argv)
 
 	int sort_order = SORT_CONTENT;
 	int embed_css_mode = EMBED_AUTO;
+	int n_jobs = 1;
+	char *cache_dir = NULL;
+	char *out_zip = NULL;
+	char *out_folder = NULL;
+	bool watch = false;
+	bool use_uring = true;
+	char *exts = "java,kt,swift";
 
 	Vector source_name_list = {0};
+	Vector folder_list = {0};
+	Vector zip_list = {0};
 	Vector yes_list = {0};
 	Vector no_list = {0};
 
-	for (int i = 1; i < argc-1; i += 2) {
+	Stats stats = {0};
+	stats.open_phase = -1;
+
+	for (int i = 1; i < argc; i += 2) {
+		// the only options without a value
+		if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=json")) {
+			stats_enabled = true;
+			stats.json = argv[i][7] == '=';
+			i--;
+			continue;
+		}
+		if (!strcmp(argv[i], "--watch")) {
+			watch = true;
+			i--;
+			continue;
+		}
+		if (i == argc-1)
+			break;
+
 		if (!strcmp(argv[i], "--sort")) {
 			if (strlen(argv[i+1]) >= 5 && memcmp(argv[i+1], "alpha", 5) == 0)
 				sort_order = SORT_ALPHA;
@@ -75,26 +1076,28 @@ int main(int argc, char **argv)
 			
 		}
 		else if (!strcmp(argv[i], "--exts")) {
-			
+			exts = argv[i+1];
 		}
 		else if (!strcmp(argv[i], "--in-single")) {
 			vector_append_cstring(&source_name_list, argv[i+1]);
 			*(char*)vector_add(&source_name_list, 1, 1) = '\0';
 		}
 		else if (!strcmp(argv[i], "--in-zip")) {
-			
+			vector_append_cstring(&zip_list, argv[i+1]);
+			*(char*)vector_add(&zip_list, 1, 1) = '\0';
 		}
 		else if (!strcmp(argv[i], "--in-folder")) {
-			
+			vector_append_cstring(&folder_list, argv[i+1]);
+			*(char*)vector_add(&folder_list, 1, 1) = '\0';
 		}
 		else if (!strcmp(argv[i], "--out-single")) {
 			
 		}
 		else if (!strcmp(argv[i], "--out-zip")) {
-			
+			out_zip = argv[i+1];
 		}
 		else if (!strcmp(argv[i], "--out-folder")) {
-			
+			out_folder = argv[i+1];
 		}
 		else if (!strcmp(argv[i], "--css")) {
 			if (style_css_name)
@@ -110,28 +1113,49 @@ int main(int argc, char **argv)
 			else if (!strcmp(argv[i+1], "never"))
 				embed_css_mode = EMBED_NEVER;
 		}
+		else if (!strcmp(argv[i], "--io")) {
+			use_uring = strcmp(argv[i+1], "sync") != 0;
+		}
+		else if (!strcmp(argv[i], "--cache-dir")) {
+			cache_dir = argv[i+1];
+		}
+		else if (!strcmp(argv[i], "--jobs")) {
+			n_jobs = atoi(argv[i+1]);
+			if (n_jobs <= 0)
+				n_jobs = pool_default_size();
+			parse_threads = n_jobs;
+		}
 		else {
 			print_help();
 			return strcmp(argv[i], "--help") != 0;
 		}
 	}
 
-	if (!source_name_list.buf) {
+	if (!source_name_list.buf && !folder_list.buf && !zip_list.buf) {
 		print_help();
 		return 1;
 	}
 
+	if (watch && (!out_folder || out_zip)) {
+		printf("--watch needs --out-folder, so that each page can be replaced on its own\n");
+		return 1;
+	}
+
 	if (!style_css_name) {
 		const char *default_name = "style.css";
 		style_css_name = malloc(strlen(default_name) + 1);
 		strcpy(style_css_name, default_name);
 	}
 
+	stats_begin_phase(&stats, "setup");
+
 	File css_file = read_whole_file(style_css_name);
 	if (!css_file.buf)
 		return 2;
 
-	Vector source_list = {0};
+	Page_Run run = {0};
+	run.blocks = calloc(MAX_PAGE_BLOCKS, sizeof(Page_Job*));
+	run.watch = watch;
 
 	*(char*)vector_add(&source_name_list, 1, 1) = '\0';
 	char *fname = (char*)source_name_list.buf;
@@ -140,32 +1164,349 @@ int main(int argc, char **argv)
 	while (*fname) {
 		int name_len = strlen(fname);
 
-		Source source = {0};
-		source.file = read_whole_file(fname);
-		source.sort_order = sort_order;
-		source.access_level = DOC_ACCESS_PRIVATE;
-		*(Source*)vector_add(&source_list, sizeof(Source), 1) = source;
-
-		if (!source.file.buf) {
+		struct stat st = {0};
+		if (strcmp(fname, "-") != 0 && stat(fname, &st) != 0) {
+			printf("Could not find \"%s\"\n", fname);
 			missing_sources = true;
 			break;
 		}
 
+		int idx = add_page(&run, fname, (long)st.st_size, false);
+		if (idx >= 0)
+			page_job(&run, idx)->stream = !S_ISREG(st.st_mode);
+		if (watch && idx >= 0 && strcmp(fname, "-") != 0)
+			page_job(&run, idx)->watch_path = strdup(fname);
+
 		fname += name_len + 1;
 	}
 
+	*(char*)vector_add(&folder_list, 1, 1) = '\0';
+	char *folder = (char*)folder_list.buf;
+
+	while (!missing_sources && *folder) {
+		struct stat st;
+		if (stat(folder, &st) != 0 || !S_ISDIR(st.st_mode)) {
+			printf("Could not find \"%s\"\n", folder);
+			missing_sources = true;
+			break;
+		}
+		folder += strlen(folder) + 1;
+	}
+
+	// Archive entries are known up front, so they're scheduled along with the single sources
+	Vector zips = {0};
+	*(char*)vector_add(&zip_list, 1, 1) = '\0';
+	char *zip_name = (char*)zip_list.buf;
+
+	while (!missing_sources && *zip_name) {
+		struct stat st;
+		if (strcmp(zip_name, "-") != 0 && stat(zip_name, &st) != 0) {
+			printf("Could not find \"%s\"\n", zip_name);
+			missing_sources = true;
+			break;
+		}
+
+		Zip *zip = zip_open(zip_name, exts);
+		if (!zip) {
+			missing_sources = true;
+			break;
+		}
+		*(Zip**)vector_add(&zips, sizeof(Zip*), 1) = zip;
+
+		for (int i = 0; i < zip_n_entries(zip); i++) {
+			int idx = add_page(&run, NULL, zip_entry_size(zip, i), false);
+			if (idx < 0)
+				break;
+
+			Page_Job *pj = page_job(&run, idx);
+			pj->zip = zip;
+			pj->zip_entry = i;
+		}
+
+		zip_name += strlen(zip_name) + 1;
+	}
+
+	if (missing_sources)
+		return 0;
+
+	int n_known = run.n_jobs;
+	bool has_folders = *(char*)folder_list.buf != '\0';
+
+	run.sort_order = sort_order;
 	bool should_embed_css = embed_css_mode == EMBED_AUTO ?
-		source_list.n == 1 :
+		n_known == 1 && !has_folders :
 		embed_css_mode == EMBED_ALWAYS;
 
-	for (int i = 0; i < source_list.n; i++) {
-		Source *s = &((Source*)source_list.buf)[i];
-		if (!missing_sources) {
-			parse_source_file(s);
-			generate_html(s, &css_file, should_embed_css);
+	// an archive or a folder gets its own copy of the stylesheet, which pages link to
+	bool out_site = out_zip || out_folder;
+	Stylesheet stylesheet;
+	stylesheet_init(&stylesheet, &css_file, should_embed_css, out_site);
+	run.css = &stylesheet;
+
+	Cache cache = {0};
+	if (cache_dir) {
+		// anything that changes the output of a page besides the source itself goes into the key
+		uint64_t config = hash_bytes(css_file.buf, css_file.size, 0);
+		config = hash_bytes(css_file.name, strlen(css_file.name), config);
+		int options[] = { run.sort_order, should_embed_css, DOC_ACCESS_PRIVATE, out_site };
+		config = hash_bytes(options, sizeof(options), config);
+
+		if (cache_open(&cache, cache_dir, config))
+			run.cache = &cache;
+	}
+
+	run.out_fd = STDOUT_FILENO;
+	if (out_zip) {
+		run.zip_out = zip_writer_open(out_zip);
+		if (!run.zip_out)
+			return 2;
+		run.out_fd = zip_writer_fd(run.zip_out);
+	}
+	else if (out_folder) {
+		if (mkdir(out_folder, 0755) != 0 && errno != EEXIST) {
+			printf("Could not write \"%s\"\n", out_folder);
+			return 2;
+		}
+		run.out_folder = out_folder;
+	}
+
+	// A single source is named after its file alone, unless another single source has a file
+	//  of the same name, in which case each of them keeps the folders on its path
+	Page_Names single_names = {0};
+	Page_Names clashes = {0};
+	for (int i = 0; i < n_known; i++) {
+		Page_Job *pj = page_job(&run, i);
+		if (pj->zip || !strcmp(pj->path, "-"))
+			continue;
+
+		char *slash = strrchr(pj->path, '/');
+		char *name = page_out_name(slash ? slash + 1 : pj->path);
+		if (!page_names_add(&single_names, name) && !page_names_add(&clashes, name))
+			free(name);
+	}
+
+	// pages link to each other by these names, wherever they end up
+	for (int i = 0; i < n_known; i++) {
+		Page_Job *pj = page_job(&run, i);
+		if (pj->zip) {
+			char *entry_path = zip_entry_path(pj->zip, pj->zip_entry);
+			pj->out_name = page_out_name(entry_path);
+			free(entry_path);
+		}
+		else if (!strcmp(pj->path, "-")) {
+			pj->out_name = page_out_name(STDIN_NAME);
+		}
+		else {
+			char *slash = strrchr(pj->path, '/');
+			pj->out_name = page_out_name(slash ? slash + 1 : pj->path);
+			if (page_names_has(&clashes, pj->out_name)) {
+				free(pj->out_name);
+				pj->out_name = page_out_name(pj->path);
+			}
 		}
-		source_close(s);
+		pj->out_name = unique_page_name(&run, pj->out_name);
 	}
 
-    return 0;
+	page_names_free(&single_names, true);
+	page_names_free(&clashes, true);
+
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.cond, NULL);
+
+	stats_begin_phase(&stats, "read and parse");
+
+	run.symbols = symbols_create();
+	Pool *pool = pool_create(n_jobs, parse_page, &run);
+
+	int n_workers = pool_n_workers(pool);
+	run.workers = calloc(n_workers, sizeof(Worker_State));
+	for (int i = 0; i < n_workers; i++)
+		run.workers[i].chunks = chunk_pool_create();
+
+	// a site gets a search index, a stream of pages on stdout doesn't
+	if (out_site)
+		run.search = search_create(n_workers);
+
+	if (use_uring)
+		run.ring = uring_open();
+
+	int *order = malloc(n_known * sizeof(int));
+	for (int i = 0; i < n_known; i++)
+		order[i] = i;
+
+	if (n_workers > 1) {
+		// Schedule the largest sources first so that the long tail is made of small files
+		Page_Job **by_size = malloc(n_known * sizeof(Page_Job*));
+		for (int i = 0; i < n_known; i++)
+			by_size[i] = page_job(&run, i);
+
+		qsort(by_size, n_known, sizeof(Page_Job*), compare_page_size);
+
+		for (int i = 0; i < n_known; i++)
+			order[i] = by_size[i]->index;
+
+		free(by_size);
+	}
+
+	for (int i = 0; i < n_known; i += PREFETCH_BATCH) {
+		int n = n_known - i < PREFETCH_BATCH ? n_known - i : PREFETCH_BATCH;
+		submit_pages(&run, pool, order + i, n);
+	}
+	free(order);
+
+	int batch[PREFETCH_BATCH];
+	int n_batch = 0;
+
+	// --watch looks at each input folder as the walk saw it
+	Vector roots = {0};
+
+	// Folder contents are parsed as they're found, without waiting for the rest of the walk.
+	// Sizes aren't known without a stat per file, so these go in the order they're found.
+	folder = (char*)folder_list.buf;
+	while (*folder) {
+		Walk *walk = walk_start(folder, exts, n_jobs);
+
+		int root_len = strlen(folder);
+		while (root_len > 1 && folder[root_len-1] == '/')
+			root_len--;
+
+		int root = roots.n;
+		if (watch)
+			*(char**)vector_add(&roots, sizeof(char*), 1) = strndup(folder, root_len);
+
+		char *path;
+		while ((path = walk_next(walk))) {
+			int idx = add_page(&run, path, -1, true);
+			if (idx < 0) {
+				free(path);
+				break;
+			}
+
+			// pages keep their place in the folder, relative to the folder itself
+			Page_Job *pj = page_job(&run, idx);
+			pj->out_name = unique_page_name(&run, page_out_name(path + root_len));
+			if (watch) {
+				pj->watch_path = strdup(path);
+				pj->root = root;
+			}
+
+			batch[n_batch++] = idx;
+			if (n_batch == PREFETCH_BATCH) {
+				submit_pages(&run, pool, batch, n_batch);
+				n_batch = 0;
+			}
+		}
+
+		walk_finish(walk);
+		folder += strlen(folder) + 1;
+	}
+
+	submit_pages(&run, pool, batch, n_batch);
+	pool_finish(pool);
+	uring_close(run.ring);
+
+	// Every page can link to every other one from here on, so rendering waits for the whole table.
+	// Entries of the cache that no source asked for are stale by now.
+	cache_evict(run.cache);
+
+	stats_begin_phase(&stats, "render and write");
+	pool = pool_create(n_jobs, render_page, &run);
+
+	order = malloc(run.n_jobs * sizeof(int));
+	for (int i = 0; i < run.n_jobs; i++)
+		order[i] = i;
+
+	if (n_workers > 1) {
+		Page_Job **by_size = malloc(run.n_jobs * sizeof(Page_Job*));
+		for (int i = 0; i < run.n_jobs; i++)
+			by_size[i] = page_job(&run, i);
+
+		qsort(by_size, run.n_jobs, sizeof(Page_Job*), compare_page_size);
+
+		for (int i = 0; i < run.n_jobs; i++)
+			order[i] = by_size[i]->index;
+
+		free(by_size);
+	}
+
+	// With a single worker, each page is written as soon as it's rendered
+	for (int i = 0; i < run.n_jobs; i++) {
+		pool_submit(pool, order[i]);
+		if (n_workers == 1)
+			write_pages(&run, false);
+	}
+	free(order);
+
+	write_pages(&run, true);
+	pool_finish(pool);
+
+	stats_begin_phase(&stats, "finish");
+
+	if (out_site) {
+		if (stylesheet.in_output)
+			add_output_file(&run, stylesheet.out_name, css_file.buf, css_file.size);
+
+		write_search_index(&run);
+	}
+
+	if (run.zip_out) {
+		if (!zip_writer_close(run.zip_out) || run.write_failed)
+			printf("Could not write \"%s\"\n", out_zip);
+	}
+	else if (run.out_folder && run.write_failed) {
+		printf("Could not write \"%s\"\n", out_folder);
+	}
+
+	stats_end_phase(&stats);
+	for (int i = 0; i < run.n_jobs; i++) {
+		Page_Job *pj = page_job(&run, i);
+		pj->stats.name = pj->out_name;
+		stats_add_file(&stats, &pj->stats);
+	}
+	stats_report(&stats, stderr);
+	stats_free(&stats);
+
+	if (watch)
+		watch_sources(&run, exts, roots.buf, roots.n);
+
+	for (int i = 0; i < n_workers; i++)
+		chunk_pool_destroy(run.workers[i].chunks);
+	free(run.workers);
+
+	for (int i = 0; i < zips.n; i++)
+		zip_close(((Zip**)zips.buf)[i]);
+	vector_free(&zips);
+
+	symbols_destroy(run.symbols);
+	search_destroy(run.search);
+
+	for (int i = 0; i < run.n_jobs; i++) {
+		Page_Job *pj = page_job(&run, i);
+		close_page_source(pj);
+		if (watch) {
+			if (pj->owns_path)
+				free(pj->path);
+			free(pj->watch_path);
+			vector_free(&pj->lookups);
+		}
+		free(pj->out_name);
+	}
+
+	page_names_free(&run.names, false);
+
+	for (int i = 0; i < roots.n; i++)
+		free(((char**)roots.buf)[i]);
+	vector_free(&roots);
+
+	for (int i = 0; i < MAX_PAGE_BLOCKS && run.blocks[i]; i++)
+		free(run.blocks[i]);
+	free(run.blocks);
+
+	cache_close(&cache);
+	stylesheet_free(&stylesheet);
+
+	pthread_mutex_destroy(&run.lock);
+	pthread_cond_destroy(&run.cond);
+
+	return 0;
 }
@@ -1,5 +1,37 @@
 #!/bin/bash
 
 COMPILER=gcc
-$COMPILER -g *.c -o docs-generator
+$COMPILER -g *.c -o docs-generator -lpthread -lz
 
+# ./make.sh bench [label]
+# Builds the corpus generator and the benchmark, makes a corpus if there isn't one yet, and
+#  writes the results to bench/results/<label>.json. Set BENCH_CORPUS to use another corpus.
+if [ "$1" = "bench" ]; then
+	LIB_SOURCES=$(ls *.c | grep -v '^main\.c$')
+	$COMPILER -O2 -g bench/corpus.c -o bench/docs-corpus || exit 1
+	$COMPILER -O2 -g -I. bench/bench.c $LIB_SOURCES -o bench/docs-bench -lpthread -lz || exit 1
+
+	CORPUS=${BENCH_CORPUS:-/tmp/docs-generator-corpus}
+	if [ ! -d "$CORPUS" ]; then
+		bench/docs-corpus --out "$CORPUS" --files 2000 --size 12000 --seed 1 || exit 1
+	fi
+
+	LABEL=${2:-$(date +%Y%m%d-%H%M%S)}
+	mkdir -p bench/results
+	bench/docs-bench --in-folder "$CORPUS" --css style.css --label "$LABEL" --json "bench/results/$LABEL.json"
+fi
+
+# ./make.sh lib
+# Builds libdocsgen.a and libdocsgen.so into lib/, for programs that use docsgen.h.
+#  Only what docsgen.h declares is exported from the shared library.
+if [ "$1" = "lib" ]; then
+	LIB_SOURCES=$(ls *.c | grep -v '^main\.c$')
+	mkdir -p lib/obj
+	rm -f lib/obj/*.o
+	for SRC in $LIB_SOURCES; do
+		$COMPILER -O2 -g -fPIC -fvisibility=hidden -c "$SRC" -o "lib/obj/${SRC%.c}.o" || exit 1
+	done
+	rm -f lib/libdocsgen.a
+	ar rcs lib/libdocsgen.a lib/obj/*.o || exit 1
+	$COMPILER -shared lib/obj/*.o -o lib/libdocsgen.so -lpthread -lz || exit 1
+fi
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
 
 void span_reset(Span *s)
 {
@@ -17,6 +18,7 @@ void tag_reset(Tag *t)
     t->cmt_end = -1;
     t->code_start = -1;
     t->code_end = -1;
+    t->kind = TAG_KIND_NONE;
 }
 
 void doc_reset(Doc *d)
@@ -27,21 +29,23 @@ void doc_reset(Doc *d)
     d->parent_doc = -1;
     d->first_desc_line = -1;
     d->n_desc_lines = 0;
-    d->first_param = -1;
-    d->n_params = 0;
+    d->first_tag = -1;
+    d->n_tags = 0;
     d->code_lineno = -1;
     d->flags = 0;
     d->access = 0;
+    d->soft_keyword = 0;
+    d->access_given = false;
 }
 
-void add_param(Source *source, Doc *doc, Tag *tag)
+void add_tag(Source *source, Doc *doc, Tag *tag)
 {
-    if (doc->first_param < 0)
-        doc->first_param = source->tags.n;
+    if (doc->first_tag < 0)
+        doc->first_tag = source->tags.n;
 
     Tag *new_tag = vector_add(&source->tags, sizeof(Tag), 1);
     *new_tag = *tag;
-    doc->n_params++;
+    doc->n_tags++;
 
     tag_reset(tag);
 }
@@ -52,7 +56,7 @@ void add_dline(Source *source, Doc *doc, Span *dline)
         return;
 
     if (doc->first_desc_line < 0) {
-        int i = dline->start;
+        int64_t i = dline->start;
         bool is_empty = true;
 
         // only discard empty lines before the first non-empty line
@@ -77,32 +81,146 @@ void add_dline(Source *source, Doc *doc, Span *dline)
     span_reset(dline);
 }
 
-void maybe_add_doc(Source *source, Doc *doc, int64_t *class_index, int *class_level, bool curly_open_not_closed, int n_open_curly)
+static const unsigned int doc_kind_flags[N_DOC_KINDS] = {
+	[DOC_KIND_PARENT] = DOC_FLAG_IS_PARENT,
+	[DOC_KIND_CTOR]   = DOC_FLAG_CTOR,
+	[DOC_KIND_METHOD] = DOC_FLAG_METHOD,
+	[DOC_KIND_FIELD]  = DOC_FLAG_FIELD,
+};
+
+static void add_doc_kinds(Source *source, int idx, unsigned int flags)
 {
-    doc->parent_doc = *class_level >= 0 ? class_index[*class_level] & 0x7fffFFFF : -1;
+	for (int k = 0; k < N_DOC_KINDS; k++) {
+		if (flags & doc_kind_flags[k])
+			*(int*)vector_add(&source->kinds[k], sizeof(int), 1) = idx;
+	}
+}
+
+// Puts together the lists of each kind of doc again, for docs that were moved (sorted) or
+//  loaded from somewhere else rather than parsed
+void index_doc_kinds(Source *source)
+{
+	for (int k = 0; k < N_DOC_KINDS; k++)
+		source->kinds[k].n = 0;
+
+	for (int i = 0; i < source->docs.n; i++)
+		add_doc_kinds(source, i, doc_flags(&source->docs, i));
+}
+
+// A method named after the class it's in is a constructor
+static bool names_its_class(const Source *source, const Span *name, int parent_doc)
+{
+    if (name->start < 0 || name->end < name->start)
+        return false;
 
     const char *in = source->file.buf;
+    int64_t class_name_start = source->class_name.start;
+    int64_t class_name_end   = source->class_name.end;
 
-    if ((~doc->flags & (DOC_FLAG_PAREN | DOC_FLAG_CURLY | DOC_FLAG_EQUALS)) == DOC_FLAG_EQUALS) {
-        bool is_ctor = false;
-        if (doc->name.start >= 0 && doc->name.end >= doc->name.start) {
-            int class_name_start = source->class_name.start;
-            int class_name_end   = source->class_name.end;
-
-            if (doc->parent_doc >= 0) {
-                Doc *parent = &source->docs.buf[doc->parent_doc];
-                class_name_start = parent->name.start;
-                class_name_end   = parent->name.end;
-            }
+    if (parent_doc >= 0) {
+        const Span *parent_name = doc_name(&source->docs, parent_doc);
+        class_name_start = parent_name->start;
+        class_name_end   = parent_name->end;
+    }
 
-            if (doc->name.end - doc->name.start == class_name_end - class_name_start)
-                is_ctor = !memcmp(&in[doc->name.start], &in[class_name_start], class_name_end - class_name_start);
-        }
+    if (name->end - name->start != class_name_end - class_name_start)
+        return false;
+    return !memcmp(&in[name->start], &in[class_name_start], class_name_end - class_name_start);
+}
+
+// A large source is split into chunks that are parsed at the same time, each one from a
+//  guess at the state where it starts, see parse_source_split. Until it's merged, a chunk
+//  counts lines and braces from its own start, keeps docs, tags and descs in tables of its
+//  own, and stands in for the classes that were already open where it starts:
+//   - a doc outside the chunk's own classes gets OUTER_PARENT(n), n being how many of those
+//     have been closed since the chunk started
+//   - every '}' outside the chunk's own classes is taken to close one of them if the brace
+//     count is back where it was when that class was opened, guessing that they're nested one
+//     brace apart; each guess is kept, to be checked at the merge
+// At each line break that completes a declaration outside the chunk's own classes, the parser
+//  is in a state that only depends on the counts, and some of those are kept as checkpoints.
+// When the chunk is merged, the sequential parser carries on past the start of the chunk until
+//  it reaches a checkpoint in the same state, and from there takes what the chunk found.
+
+#define OUTER_PARENT(n) (-2 - (n))
+
+#define CHUNK_CHECKPOINTS  32
+#define CHUNK_FIRST_GAP    256
+
+typedef struct {
+	int64_t pos; // the line break the parser has just visited
+	int n_lines;
+	int n_open_curly;
+	int outer_popped;
+	int n_docs;
+	int n_tags;
+	int n_descs;
+	int n_guesses;
+} Parse_Checkpoint;
 
-        if (is_ctor)
-            doc->flags |= DOC_FLAG_CTOR;
-        else
-            doc->flags |= DOC_FLAG_METHOD;
+typedef struct {
+	int n_open_curly;
+	int outer_popped;
+	bool popped;
+} Parse_Guess;
+
+struct Parse_Chunk {
+	Source source;
+	Parser parser;
+	int64_t start;
+	int64_t end;
+	int outer_popped;
+	int max_level;
+	Vector guesses;     // Parse_Guess
+	Vector checkpoints; // Parse_Checkpoint
+	int64_t next_checkpoint;
+	int64_t checkpoint_gap;
+	pthread_t thread;
+};
+
+static void chunk_guess_pop(Parse_Chunk *chunk, int n_open_curly)
+{
+	Parse_Guess *g = vector_add(&chunk->guesses, sizeof(Parse_Guess), 1);
+	g->n_open_curly = n_open_curly;
+	g->outer_popped = chunk->outer_popped;
+	g->popped = n_open_curly == -chunk->outer_popped;
+	if (g->popped)
+		chunk->outer_popped++;
+}
+
+// Checkpoints get further apart as the chunk goes on: the sequential parser usually lines up
+//  with the chunk within a few declarations, and otherwise parses the whole chunk itself anyway
+static void chunk_checkpoint(Parse_Chunk *chunk, int64_t pos, int n_lines, int n_open_curly)
+{
+	if (pos < chunk->next_checkpoint || chunk->checkpoints.n >= CHUNK_CHECKPOINTS)
+		return;
+
+	Parse_Checkpoint *cp = vector_add(&chunk->checkpoints, sizeof(Parse_Checkpoint), 1);
+	cp->pos = pos;
+	cp->n_lines = n_lines;
+	cp->n_open_curly = n_open_curly;
+	cp->outer_popped = chunk->outer_popped;
+	cp->n_docs = chunk->source.docs.n;
+	cp->n_tags = chunk->source.tags.n;
+	cp->n_descs = chunk->source.descs.n;
+	cp->n_guesses = chunk->guesses.n;
+
+	chunk->next_checkpoint = pos + chunk->checkpoint_gap;
+	chunk->checkpoint_gap *= 2;
+}
+
+// chunk is set when this is a piece of a source parsed ahead, see parse_source_split
+void maybe_add_doc(Source *source, Doc *doc, int64_t *class_index, int *class_level, Parse_Chunk *chunk, bool curly_open_not_closed, int n_open_curly)
+{
+    if (*class_level >= 0)
+        doc->parent_doc = class_index[*class_level] & 0x7fffFFFF;
+    else
+        doc->parent_doc = chunk ? OUTER_PARENT(chunk->outer_popped) : -1;
+
+    if ((~doc->flags & (DOC_FLAG_PAREN | DOC_FLAG_CURLY | DOC_FLAG_EQUALS)) == DOC_FLAG_EQUALS) {
+        // a class from before the piece isn't known yet, so that's left for when it's merged
+        if (doc->parent_doc >= -1)
+            doc->flags |= names_its_class(source, &doc->name, doc->parent_doc) ? DOC_FLAG_CTOR : DOC_FLAG_METHOD;
     }
 
     if (doc->flags & DOC_FLAG_SEMIC)
@@ -116,7 +234,9 @@ void maybe_add_doc(Source *source, Doc *doc, int64_t *class_index, int *class_le
 
     if ((doc->flags & DOC_FLAG_IS_PARENT) && curly_open_not_closed && *class_level < MAX_CLASS_LEVELS-1) {
         *class_level += 1;
-        class_index[*class_level] = ((int64_t)n_open_curly << 32) | (int64_t)source->docs.n;
+        class_index[*class_level] = (int64_t)((uint64_t)n_open_curly << 32) | (int64_t)source->docs.n;
+        if (chunk && *class_level > chunk->max_level)
+            chunk->max_level = *class_level;
     }
 
     //if ((doc->flags & DOC_FLAG_IS_PARENT) || (doc->main.cmt_start >= 0 && doc->main.code_start >= 0)) {
@@ -125,63 +245,573 @@ void maybe_add_doc(Source *source, Doc *doc, int64_t *class_index, int *class_le
         (doc->flags & DOC_FLAG_IS_PARENT) ||
         (doc->main.cmt_start >= 0 && doc->main.code_start >= 0)
     ) {
-        Doc *new_doc = vector_add(&source->docs, sizeof(Doc), 1);
-        *new_doc = *doc;
+        // the kind flags are final from here, so each summary gets its list as the docs come in
+        add_doc_kinds(source, source->docs.n, doc->flags);
+        doc_table_add(&source->docs, doc);
     }
 
     doc_reset(doc);
 }
 
-void parse_source_file(Source *source)
+// Stage 1 of the parser: a 64-byte-at-a-time index of the bytes that can change parser state.
+// Bytes inside a run of name characters ([A-Za-z0-9_]) and inside a run of spaces/tabs are
+//  no-ops for the state machine, as long as the first byte after any other byte is visited.
+// Everything else is structural: punctuation, line breaks, non-ASCII bytes and the edges of
+//  each blank run.
+// Whether a byte at the end of a block is structural depends on the byte after the block, so
+//  until the scanner has the whole source, a block waits for the first byte of the next one.
+
+static void classify_block_scalar(const char *p, uint64_t *nonname, uint64_t *blank)
 {
-	int companion_brace_level = -1;
-
-    bool is_javadoc = false;
-    bool is_block_comment = false;
-    bool is_line_comment = false;
-    bool inside_cmd = false;
-    bool is_line_cmd = false;
-    bool is_param = false;
-    bool is_return = false;
-    bool seen_ws = false;
-    bool seen_code_atsym = false;
-    bool seen_semicolon = false;
-    bool seen_open_curly = false;
-    bool seen_close_curly = false;
-    bool seen_paren = false;
-    int n_open_paren = 0;
-    int n_lines = 0;
-    int last_nonname_idx = -1;
-    uint64_t last16 = 0;
-    uint64_t last8 = 0;
-    int utf8_left = 0;
-
-    int n_open_curly = 0;
-    int class_level = -1;
-    int64_t class_index[MAX_CLASS_LEVELS];
-
-    Doc doc; doc_reset(&doc);
-    Tag tag; tag_reset(&tag);
-    Span dline; span_reset(&dline);
+	uint64_t nn = 0, bl = 0;
+	for (int i = 0; i < 64; i++) {
+		char c = p[i];
+		bool is_nonname = c != '_' && (c < '0' || c > '9') && (c < 'A' || c > 'Z') && (c < 'a' || c > 'z');
+		nn |= (uint64_t)is_nonname << i;
+		bl |= (uint64_t)(c == ' ' || c == '\t') << i;
+	}
+	*nonname = nn;
+	*blank = bl;
+}
 
-	char *buf = source->file.buf;
-	int sz = source->file.size;
-    for (int i = 0; i < sz; i++) {
-        char c = buf[i];
-        last16 = (last16 << 8LL) | (last8 >> 56LL);
-        last8 = (last8 << 8LL) | ((int64_t)c & 0xffLL);
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static void classify_block_sse2(const char *p, uint64_t *nonname, uint64_t *blank)
+{
+	uint64_t nn = 0, bl = 0;
+	for (int i = 0; i < 64; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+		__m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+		__m128i name = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+		__m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+
+		nn |= (uint64_t)(uint16_t)~_mm_movemask_epi8(name) << i;
+		bl |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+	}
+	*nonname = nn;
+	*blank = bl;
+}
+
+__attribute__((target("avx2")))
+static void classify_block_avx2(const char *p, uint64_t *nonname, uint64_t *blank)
+{
+	uint64_t nn = 0, bl = 0;
+	for (int i = 0; i < 64; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+		__m256i upper = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('Z')), _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)));
+		__m256i lower = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('z')), _mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)));
+		__m256i digit = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('9')), _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)));
+		__m256i name = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+		__m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+
+		nn |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(name) << i;
+		bl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+	}
+	*nonname = nn;
+	*blank = bl;
+}
+#endif
+
+static void (*classify_block)(const char *p, uint64_t *nonname, uint64_t *blank) = NULL;
+
+static void scanner_select(void)
+{
+	void (*func)(const char*, uint64_t*, uint64_t*) = classify_block_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		func = classify_block_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		func = classify_block_sse2;
+#endif
+	__atomic_store_n(&classify_block, func, __ATOMIC_RELEASE);
+}
+
+static void scanner_load(Scanner *sc)
+{
+	const char *p = &sc->buf[sc->base];
+	char tail[64];
+
+	if (sc->size - sc->base < 64) {
+		memset(tail, 0, 64);
+		memcpy(tail, p, sc->size - sc->base);
+		p = tail;
+	}
+
+	uint64_t nonname, blank;
+	classify_block(p, &nonname, &blank);
+
+	int64_t next = sc->base + 64;
+	uint64_t next_blank = next < sc->size && (sc->buf[next] == ' ' || sc->buf[next] == '\t');
+
+	uint64_t interior = blank & ((blank << 1) | sc->prev_blank) & ((blank >> 1) | (next_blank << 63));
+	uint64_t marked = nonname & ~interior;
+
+	sc->bits = marked | (marked << 1) | sc->prev_marked;
+	sc->prev_blank = blank >> 63;
+	sc->prev_marked = marked >> 63;
+}
+
+static void scanner_init(Scanner *sc)
+{
+	if (!__atomic_load_n(&classify_block, __ATOMIC_ACQUIRE))
+		scanner_select();
+
+	sc->buf = NULL;
+	sc->size = 0;
+	sc->base = -64; // nothing's loaded yet
+	sc->bits = 0;
+	sc->prev_blank = false;
+	sc->prev_marked = true;
+	sc->final = false;
+}
+
+// Returns the first structural position at or after pos, or size if there are none left.
+// Before the scanner has the whole source, returns -1 instead once it needs more of it.
+static int64_t scanner_next(Scanner *sc, int64_t pos)
+{
+	while (pos < sc->size) {
+		while (pos >= sc->base + 64) {
+			if (!sc->final && sc->base + 128 >= sc->size)
+				return -1;
+			sc->base += 64;
+			scanner_load(sc);
+		}
+
+		uint64_t bits = sc->bits & (~0ULL << (pos - sc->base));
+		if (bits)
+			return sc->base + __builtin_ctzll(bits);
+
+		pos = sc->base + 64;
+	}
+	return sc->final ? sc->size : -1;
+}
+
+// Every word the parser reacts to, in code and after an '@' in Javadoc.
+// Soft keywords are only reserved in some of the languages (eg. "override" can be a Java field),
+//  so they still count as a candidate for the declaration's name, and only take effect once
+//  another word of the declaration follows them. Their access never overrides one given by a
+//  keyword that's always reserved. "open" isn't one of them: in Kotlin and Swift it's about
+//  inheritance, and it would otherwise make "private void open()" public.
+#define KW_CODE  0x1
+#define KW_TAG   0x2
+#define KW_SOFT  0x4
+
+typedef struct {
+	const char *word;
+	int context;
+	unsigned int flags;
+	short access;
+	short tag;
+} Keyword;
 
-		if (utf8_left-- > 0) {
+static const Keyword keywords[] = {
+	{"fun",          KW_CODE, DOC_FLAG_KOTLIN | DOC_FLAG_METHOD, -1, 0},
+	{"func",         KW_CODE, DOC_FLAG_SWIFT | DOC_FLAG_METHOD, -1, 0},
+	{"var",          KW_CODE, DOC_FLAG_KOTLIN | DOC_FLAG_SWIFT | DOC_FLAG_FIELD, -1, 0},
+	{"val",          KW_CODE, DOC_FLAG_KOTLIN | DOC_FLAG_FIELD | DOC_FLAG_FINAL, -1, 0},
+	{"let",          KW_CODE, DOC_FLAG_SWIFT | DOC_FLAG_FIELD | DOC_FLAG_FINAL, -1, 0},
+	{"final",        KW_CODE, DOC_FLAG_FINAL, -1, 0},
+	{"static",       KW_CODE, DOC_FLAG_STATIC, -1, 0},
+	{"struct",       KW_CODE, DOC_FLAG_STRUCT, -1, 0},
+	{"class",        KW_CODE, DOC_FLAG_CLASS, -1, 0},
+	{"interface",    KW_CODE, DOC_FLAG_INTERFACE, -1, 0},
+	{"protocol",     KW_CODE, DOC_FLAG_SWIFT | DOC_FLAG_INTERFACE, -1, 0},
+	{"extension",    KW_CODE, DOC_FLAG_EXTENSION, -1, 0},
+	{"abstract",     KW_CODE, DOC_FLAG_ABSTRACT, -1, 0},
+	{"extends",      KW_CODE, DOC_FLAG_INHERITS, -1, 0},
+	{"implements",   KW_CODE, DOC_FLAG_INHERITS, -1, 0},
+	{"synchronized", KW_CODE, DOC_FLAG_SYNC, -1, 0},
+	{"native",       KW_CODE, DOC_FLAG_NATIVE, -1, 0},
+	{"transient",    KW_CODE, 0, -1, 0},
+	{"volatile",     KW_CODE, 0, -1, 0},
+	{"strictfp",     KW_CODE, 0, -1, 0},
+	{"public",       KW_CODE, 0, DOC_ACCESS_PUBLIC, 0},
+	{"protected",    KW_CODE, 0, DOC_ACCESS_PROTECTED, 0},
+	{"private",      KW_CODE, 0, DOC_ACCESS_PRIVATE, 0},
+	{"internal",     KW_CODE | KW_SOFT, 0, DOC_ACCESS_PACKAGE, 0},
+	{"fileprivate",  KW_CODE | KW_SOFT, 0, DOC_ACCESS_PRIVATE, 0},
+	{"override",     KW_CODE | KW_SOFT, DOC_FLAG_OVERRIDE, -1, 0},
+	{"external",     KW_CODE | KW_SOFT, DOC_FLAG_NATIVE, -1, 0},
+	{"param",        KW_TAG, 0, -1, TAG_KIND_PARAM},
+	{"return",       KW_TAG, 0, -1, TAG_KIND_RETURN},
+	{"throws",       KW_TAG, 0, -1, TAG_KIND_THROWS},
+	{"exception",    KW_TAG, 0, -1, TAG_KIND_THROWS},
+	{"see",          KW_TAG, 0, -1, TAG_KIND_SEE},
+	{"deprecated",   KW_TAG, DOC_FLAG_DEPRECATED, -1, TAG_KIND_DEPRECATED},
+	{"since",        KW_TAG, 0, -1, TAG_KIND_SINCE},
+};
+
+#define N_KEYWORDS     (int)(sizeof(keywords) / sizeof(Keyword))
+#define KEYWORD_SLOTS  256
+#define KEYWORD_MIN    3
+#define KEYWORD_MAX    12
+
+// Perfect hash over (length, first three bytes, last byte).
+// The multiplier is searched for once, the first time a parser runs, so that every
+//  keyword lands in its own slot and a lookup is one hash, one load and one memcmp.
+// With the keywords spread over 7x as many slots, about one multiplier in 12 works, so
+//  the search is capped well past that. Two keywords that share a key can never be told
+//  apart, so a table with those stops the program the first time it's used.
+#define KEYWORD_SEARCH_TRIES 100000
+
+static uint64_t keyword_seed;
+static unsigned char keyword_slots[KEYWORD_SLOTS];
+static unsigned char keyword_lens[N_KEYWORDS];
+static pthread_once_t keyword_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t keyword_key(const char *word, int len)
+{
+	return (uint64_t)(uint8_t)word[0] | ((uint64_t)(uint8_t)word[1] << 8) |
+		((uint64_t)(uint8_t)word[2] << 16) | ((uint64_t)(uint8_t)word[len-1] << 24) | ((uint64_t)len << 32);
+}
+
+static inline uint32_t keyword_hash(const char *word, int len, uint64_t seed)
+{
+	return (uint32_t)((keyword_key(word, len) * seed) >> 56);
+}
+
+static void keyword_build(void)
+{
+	for (int k = 0; k < N_KEYWORDS; k++)
+		keyword_lens[k] = strlen(keywords[k].word);
+
+	for (int a = 0; a < N_KEYWORDS; a++) {
+		const char *wa = keywords[a].word;
+		for (int b = a + 1; b < N_KEYWORDS; b++) {
+			const char *wb = keywords[b].word;
+			if (keyword_key(wa, strlen(wa)) == keyword_key(wb, strlen(wb))) {
+				fprintf(stderr, "Keywords \"%s\" and \"%s\" have the same length and first and last bytes, so can't be hashed apart\n", wa, wb);
+				abort();
+			}
+		}
+	}
+
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	for (int tries = 0; tries < KEYWORD_SEARCH_TRIES; tries++) {
+		memset(keyword_slots, 0, KEYWORD_SLOTS);
+
+		int k;
+		for (k = 0; k < N_KEYWORDS; k++) {
+			const char *w = keywords[k].word;
+			uint32_t h = keyword_hash(w, strlen(w), seed);
+			if (keyword_slots[h])
+				break;
+			keyword_slots[h] = k + 1;
+		}
+
+		if (k == N_KEYWORDS) {
+			keyword_seed = seed;
+			return;
+		}
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	}
+
+	fprintf(stderr, "No perfect hash found for the %d keywords, KEYWORD_SLOTS needs to grow\n", N_KEYWORDS);
+	abort();
+}
+
+static const Keyword *keyword_lookup(const char *word, int len)
+{
+	if (len < KEYWORD_MIN || len > KEYWORD_MAX)
+		return NULL;
+
+	int slot = keyword_slots[keyword_hash(word, len, keyword_seed)];
+	if (!slot)
+		return NULL;
+
+	// the word shares a slot with keywords of any length, so the length is checked first and
+	//  the compare never reads past the end of either
+	const Keyword *kw = &keywords[slot - 1];
+	if (keyword_lens[slot - 1] != len || memcmp(kw->word, word, len) != 0)
+		return NULL;
+
+	return kw;
+}
+
+// Tags like @param and @throws name something before their description, the others are all description
+static bool tag_has_code(int kind)
+{
+	return kind == TAG_KIND_PARAM || kind == TAG_KIND_THROWS;
+}
+
+static void finish_tag(Source *source, Doc *doc, Tag *tag, int kind)
+{
+	tag->kind = kind;
+	if (kind == TAG_KIND_RETURN) {
+		doc->ret = *tag;
+		tag_reset(tag);
+	}
+	else {
+		add_tag(source, doc, tag);
+	}
+}
+
+// Sizes the doc tables up front from the number of Javadoc comments, so that large files
+//  don't spend their time regrowing them. Most documented members have a comment of a couple
+//  of lines and a tag or two, and every class or undocumented member adds a doc of its own.
+static void reserve_source_tables(Source *source)
+{
+	const char *buf = source->file.buf;
+	const char *end = buf + source->file.size;
+	int n_javadocs = 0;
+
+	const char *p = buf;
+	while (p < end && (p = memchr(p, '/', end - p))) {
+		if (end - p >= 3 && p[1] == '*' && p[2] == '*') {
+			n_javadocs++;
+			p += 3;
+		}
+		else {
+			p++;
+		}
+	}
+
+	doc_table_reserve(&source->docs, n_javadocs + n_javadocs / 4 + 8);
+	vector_reserve(&source->tags, sizeof(Tag), n_javadocs + n_javadocs / 2);
+	vector_reserve(&source->descs, sizeof(Span), n_javadocs * 2);
+}
+
+static bool is_name_byte(char c)
+{
+	return c == '_' || c == '$' || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+// The package comes before any code, so only the comments and annotations at the top of the
+//  file are skipped to find it. Swift files, and sources in the default package, don't have one.
+static void find_package_name(Source *source)
+{
+	const char *buf = source->file.buf;
+	int64_t sz = source->file.size;
+	int64_t i = 0;
+
+	while (i < sz) {
+		char c = buf[i];
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			i++;
+		}
+		else if (c == '/' && i + 1 < sz && buf[i+1] == '/') {
+			while (i < sz && buf[i] != '\n')
+				i++;
+		}
+		else if (c == '/' && i + 1 < sz && buf[i+1] == '*') {
+			i += 2;
+			while (i + 1 < sz && !(buf[i] == '*' && buf[i+1] == '/'))
+				i++;
+			i += 2;
+		}
+		else if (c == '@') {
+			// eg. Kotlin's @file:JvmName("Names")
+			while (i < sz && buf[i] != '\n')
+				i++;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (sz - i < 8 || memcmp(&buf[i], "package", 7) != 0 || (buf[i+7] != ' ' && buf[i+7] != '\t'))
+		return;
+
+	i += 8;
+	while (i < sz && (buf[i] == ' ' || buf[i] == '\t'))
+		i++;
+
+	int64_t start = i;
+	while (i < sz && (is_name_byte(buf[i]) || buf[i] == '.'))
+		i++;
+
+	if (i > start) {
+		source->package_name.start = start;
+		source->package_name.end = i - 1;
+	}
+}
+
+// Fills in extends_name and implements_names from the declaration of the source's first
+//  top-level type. Kotlin and Swift list everything after a ':', where the first name is
+//  taken as the one it extends.
+static void find_inherited_names(Source *source)
+{
+	const char *in = source->file.buf;
+	const Doc_Table *docs = &source->docs;
+
+	int d = -1;
+	for (int i = 0; i < docs->n && d < 0; i++) {
+		if ((doc_flags(docs, i) & DOC_FLAG_IS_PARENT) && doc_parent(docs, i) < 0)
+			d = i;
+	}
+	if (d < 0 || !(doc_flags(docs, d) & DOC_FLAG_INHERITS))
+		return;
+
+	const Tag *main = doc_main(docs, d);
+	if (main->code_start < 0 || main->code_end < main->code_start)
+		return;
+
+	int64_t end = main->code_end + 1;
+	bool in_list = false;
+	bool is_extends = false;
+	int depth = 0;
+
+	for (int64_t i = main->code_start; i < end;) {
+		char c = in[i];
+
+		// generic arguments and Kotlin's constructor calls aren't names of their own
+		if (c == '<' || c == '(') {
+			depth++;
+			i++;
+			continue;
+		}
+		if (c == '>' || c == ')') {
+			depth -= depth > 0;
+			i++;
 			continue;
 		}
-		else if (c < 0) {
+		if (depth > 0 || !is_name_byte(c)) {
+			if (c == ':' && depth == 0) {
+				in_list = true;
+				is_extends = source->extends_name.start < 0;
+			}
+			i++;
+			continue;
+		}
+
+		int64_t start = i;
+		while (i < end && (is_name_byte(in[i]) || (in[i] == '.' && i + 1 < end && is_name_byte(in[i+1]))))
+			i++;
+		int64_t len = i - start;
+
+		if (len == 7 && !memcmp(&in[start], "extends", 7)) {
+			in_list = true;
+			is_extends = true;
+		}
+		else if (len == 10 && !memcmp(&in[start], "implements", 10)) {
+			in_list = true;
+			is_extends = false;
+		}
+		else if (len == 5 && !memcmp(&in[start], "where", 5)) {
+			break;
+		}
+		else if (in_list) {
+			if (is_extends && source->extends_name.start < 0) {
+				source->extends_name.start = start;
+				source->extends_name.end = i - 1;
+			}
+			else {
+				Span *name = vector_add(&source->implements_names, sizeof(Span), 1);
+				name->start = start;
+				name->end = i - 1;
+			}
+			is_extends = false;
+		}
+	}
+}
+
+void parser_begin(Parser *p, Source *source)
+{
+	p->source = source;
+	p->chunk = NULL;
+	scanner_init(&p->scan);
+	p->pos = 0;
+	p->exact = false;
+	p->last_nonname_idx = -1;
+
+	p->is_javadoc = false;
+	p->is_block_comment = false;
+	p->is_line_comment = false;
+	p->inside_cmd = false;
+	p->is_line_cmd = false;
+	p->tag_kind = TAG_KIND_NONE;
+	p->seen_ws = false;
+	p->seen_code_atsym = false;
+	p->seen_semicolon = false;
+	p->seen_open_curly = false;
+	p->seen_close_curly = false;
+	p->seen_paren = false;
+	p->n_open_paren = 0;
+	p->n_lines = 0;
+
+	p->n_open_curly = 0;
+	p->class_level = -1;
+
+	doc_reset(&p->doc);
+	tag_reset(&p->tag);
+	span_reset(&p->dline);
+
+	pthread_once(&keyword_once, keyword_build);
+}
+
+// Visits every byte it can of what's arrived so far, up to limit. The state lives in locals
+//  while it runs, where the compiler can keep it in registers, and goes back into the parser
+//  at the end.
+static void parser_run(Parser *p, int64_t limit)
+{
+	Source *source = p->source;
+	Parse_Chunk *chunk = p->chunk;
+	Scanner scan = p->scan;
+	int64_t i = p->pos;
+	bool exact = p->exact;
+	int64_t last_nonname_idx = p->last_nonname_idx;
+
+    bool is_javadoc = p->is_javadoc;
+    bool is_block_comment = p->is_block_comment;
+    bool is_line_comment = p->is_line_comment;
+    bool inside_cmd = p->inside_cmd;
+    bool is_line_cmd = p->is_line_cmd;
+    int tag_kind = p->tag_kind;
+    bool seen_ws = p->seen_ws;
+    bool seen_code_atsym = p->seen_code_atsym;
+    bool seen_semicolon = p->seen_semicolon;
+    bool seen_open_curly = p->seen_open_curly;
+    bool seen_close_curly = p->seen_close_curly;
+    bool seen_paren = p->seen_paren;
+    int n_open_paren = p->n_open_paren;
+    int n_lines = p->n_lines;
+
+    int n_open_curly = p->n_open_curly;
+    int class_level = p->class_level;
+    int64_t *class_index = p->class_index;
+
+    Doc doc = p->doc;
+    Tag tag = p->tag;
+    Span dline = p->dline;
+
+	char *buf = source->file.buf;
+	int64_t sz = source->file.size;
+	int64_t end = sz < limit ? sz : limit;
+
+    while (i < limit) {
+        if (!exact) {
+            int64_t next = scanner_next(&scan, i);
+            if (next < 0)
+                break;
+            // a skipped stretch is either part of a name or the middle of a blank run
+            if (next > i && (buf[next-1] == ' ' || buf[next-1] == '\t'))
+                last_nonname_idx = next - 1;
+            i = next;
+            exact = true;
+        }
+        // the rest of the source hasn't arrived yet, or there isn't any
+        if (i >= end)
+            break;
+        exact = false;
+
+        char c = buf[i];
+
+		if (c < 0) {
+			// skip the rest of the sequence, but always visit the byte after it
 			uint8_t b = (uint8_t)c;
+			int utf8_left = 0;
 			if ((b & 0xe0) == 0xc0) utf8_left = 1;
 			else if ((b & 0xf0) == 0xe0) utf8_left = 2;
 			else if ((b & 0xf8) == 0xf0) utf8_left = 3;
+			i += utf8_left + 1;
+			exact = true;
 			continue;
 		}
-		utf8_left = 0;
 
         if (c == '\n') {
             n_lines++;
@@ -197,7 +827,7 @@ void parse_source_file(Source *source)
             is_javadoc = true;
 
             doc.main.code_end = i-3;
-            maybe_add_doc(source, &doc, class_index, &class_level, seen_open_curly && !seen_close_curly, n_open_curly);
+            maybe_add_doc(source, &doc, class_index, &class_level, chunk, seen_open_curly && !seen_close_curly, n_open_curly);
 
             doc.main.cmt_start = i-2;
         }
@@ -206,12 +836,10 @@ void parse_source_file(Source *source)
             is_block_comment = false;
             doc.main.cmt_end = i;
 
-            if (tag.code_start >= 0 && tag.code_end >= 0) {
+            bool has_code = tag_has_code(tag_kind);
+            if (has_code ? (tag.code_start >= 0 && tag.code_end >= 0) : (tag_kind != TAG_KIND_NONE && tag.cmt_start >= 0)) {
                 tag.cmt_end = i - 2;
-                if (is_return)
-                    doc.ret = tag;
-                else
-                    add_param(source, &doc, &tag);
+                finish_tag(source, &doc, &tag, tag_kind);
             }
             tag_reset(&tag);
 
@@ -223,8 +851,7 @@ void parse_source_file(Source *source)
 
             inside_cmd = false;
             is_line_cmd = false;
-            is_param = false;
-            is_return = false;
+            tag_kind = TAG_KIND_NONE;
             seen_ws = false;
             seen_code_atsym = false;
             seen_semicolon = false;
@@ -240,34 +867,32 @@ void parse_source_file(Source *source)
         else if (c == '}') {
             if (class_level >= 0 && (class_index[class_level] >> 32) == n_open_curly)
                 class_level--;
+            else if (class_level < 0 && chunk)
+                chunk_guess_pop(chunk, n_open_curly);
             n_open_curly--;
         }
 
         if (is_javadoc) {
             bool is_ws = c == '\t' || c == '\r' || c == '\n' || c == ' ';
             if (is_ws) {
+                bool has_code = tag_has_code(tag_kind);
                 if (inside_cmd) {
-                    uint64_t prev7 = last8 >> 8;
-                    if ((prev7 << 24) == 0x706172616d000000LL) { // param
-                        is_param = true;
-                    }
-                    else if ((prev7 << 16) == 0x72657475726e0000LL) { // return
-                        is_return = true;
-                    }
+                    const Keyword *kw = keyword_lookup(&buf[last_nonname_idx + 1], i - last_nonname_idx - 1);
+                    if (kw && !(kw->context & KW_TAG))
+                        kw = NULL;
+
+                    tag_kind = kw ? kw->tag : TAG_KIND_NONE;
+                    if (kw)
+                        doc.flags |= kw->flags;
+                    tag_reset(&tag);
                 }
-                else if (is_line_cmd && ((is_param && tag.code_start >= 0) || (is_return && tag.cmt_start >= 0))) {
-                    if (is_param && tag.code_end < 0) {
+                else if (is_line_cmd && (has_code ? tag.code_start >= 0 : (tag_kind != TAG_KIND_NONE && tag.cmt_start >= 0))) {
+                    if (has_code && tag.code_end < 0) {
                         tag.code_end = i - 1;
                     }
                     if (c == '\r' || c == '\n') {
                         tag.cmt_end = i - 1;
-                        if (is_return) {
-                            doc.ret = tag;
-                            tag_reset(&tag);
-                        }
-                        else {
-                            add_param(source, &doc, &tag);
-                        }
+                        finish_tag(source, &doc, &tag, tag_kind);
                     }
                 }
                 if (c == '\r' || c == '\n') {
@@ -282,13 +907,13 @@ void parse_source_file(Source *source)
             }
             else if (is_line_cmd) {
                 if (!inside_cmd) {
-                    if (is_param) {
+                    if (tag_has_code(tag_kind)) {
                         if (tag.code_start < 0)
                             tag.code_start = i;
                         else if (tag.code_end >= 0 && tag.cmt_start < 0)
                             tag.cmt_start = i;
                     }
-                    else if (is_return) {
+                    else if (tag_kind != TAG_KIND_NONE) {
                         if (tag.cmt_start < 0)
                             tag.cmt_start = i;
                     }
@@ -311,68 +936,36 @@ void parse_source_file(Source *source)
 
             if (doc.main.code_start >= 0) {
                 if (is_nonname) {
-                    uint64_t prev15 = last16;
-                    uint64_t prev7 = last8 >> 8;
                     int wlen = i - last_nonname_idx - 1;
-                    if (wlen == 3 && ((prev7 << 40) >> 40) == 0x66756eLL) { // fun
-                        doc.flags |= DOC_FLAG_KOTLIN | DOC_FLAG_METHOD;
-                    }
-                    else if (wlen == 4 && ((prev7 << 32) >> 32) == 0x66756e63LL) { // func
-                        doc.flags |= DOC_FLAG_SWIFT | DOC_FLAG_METHOD;
-                    }
-                    else if (wlen == 3 && ((prev7 << 40) >> 40) == 0x766172LL) { // var
-                        doc.flags |= DOC_FLAG_KOTLIN | DOC_FLAG_SWIFT | DOC_FLAG_FIELD;
-                    }
-                    else if (wlen == 3 && ((prev7 << 40) >> 40) == 0x76616cLL) { // val
-                        doc.flags |= DOC_FLAG_KOTLIN | DOC_FLAG_FIELD | DOC_FLAG_FINAL;
-                    }
-                    else if (wlen == 3 && ((prev7 << 40) >> 40) == 0x6c6574LL) { // let
-                        doc.flags |= DOC_FLAG_SWIFT | DOC_FLAG_FIELD | DOC_FLAG_FINAL;
-                    }
-                    else if (wlen == 5 && ((prev7 << 24) >> 24) == 0x66696e616cLL) { // final
-                        doc.flags |= DOC_FLAG_FINAL;
-                    }
-                    else if (wlen == 6 && ((prev7 << 16) >> 16) == 0x737461746963LL) { // static
-                        doc.flags |= DOC_FLAG_STATIC;
-                    }
-                    else if (wlen == 6 && ((prev7 << 16) >> 16) == 0x737472756374LL) { // struct
-                        doc.flags |= DOC_FLAG_STRUCT;
-                    }
-                    else if (wlen == 5 && ((prev7 << 24) >> 24) == 0x636c617373LL) { // class
-                        doc.flags |= DOC_FLAG_CLASS;
-                    }
-                    else if (wlen == 9 && (prev15 & 0xffff) == 0x696e && prev7 == 0x74657266616365LL) { // interface
-                        doc.flags |= DOC_FLAG_INTERFACE;
-                    }
-                    else if (wlen == 8 && (prev15 & 0xff) == 0x70 && prev7 == 0x726f746f636f6cLL) { // protocol
-                        doc.flags |= DOC_FLAG_SWIFT | DOC_FLAG_INTERFACE;
-                    }
-                    else if (wlen == 9 && (prev15 & 0xffff) == 0x6578 && prev7 == 0x74656e73696f6eLL) { // extension
-                        doc.flags |= DOC_FLAG_EXTENSION;
-                    }
-                    else if (wlen == 8 && (prev15 & 0xff) == 0x61 && prev7 == 0x62737472616374LL) { // abstract
-                        doc.flags |= DOC_FLAG_ABSTRACT;
-                    }
-                    else if (
-                        (wlen == 7 && prev7 == 0x657874656e6473LL) || // extends
-                        (wlen == 10 && (prev15 & 0xffffff) == 0x696d70 && prev7 == 0x6c656d656e7473LL) // implements
-                    ) {
-                        doc.flags |= DOC_FLAG_INHERITS;
-                    }
-                    else if (wlen == 12 && ((prev15 << 24) >> 24) == 0x73796e6368LL && prev7 == 0x726f6e697a6564LL) { // synchronized
-                        doc.flags |= DOC_FLAG_SYNC;
-                    }
-                    else if (wlen == 6 && ((prev7 << 16) >> 16) == 0x7075626c6963LL) { // public
-                        doc.access = DOC_ACCESS_PUBLIC;
+                    const Keyword *kw = keyword_lookup(&buf[last_nonname_idx + 1], wlen);
+                    if (kw && !(kw->context & KW_CODE))
+                        kw = NULL;
+
+                    bool naming = !seen_code_atsym && (doc.flags & (DOC_FLAG_INHERITS | DOC_FLAG_COLON | DOC_FLAG_SEMIC | DOC_FLAG_CURLY | DOC_FLAG_PAREN | DOC_FLAG_EQUALS)) == 0;
+
+                    // a soft keyword followed by another word wasn't the name after all
+                    if (wlen >= 1 && doc.soft_keyword) {
+                        const Keyword *soft = &keywords[doc.soft_keyword - 1];
+                        if (naming) {
+                            doc.flags |= soft->flags;
+                            if (soft->access >= 0 && !doc.access_given)
+                                doc.access = soft->access;
+                        }
+                        doc.soft_keyword = 0;
                     }
-                    else if (wlen == 9 && (prev15 & 0xffff) == 0x7072 && prev7 == 0x6f746563746564LL) { // protected
-                        doc.access = DOC_ACCESS_PROTECTED;
+
+                    if (kw && (kw->context & KW_SOFT)) {
+                        doc.soft_keyword = (short)(kw - keywords) + 1;
                     }
-                    else if (wlen == 7 && prev7 == 0x70726976617465LL) { // private
-                        doc.access = DOC_ACCESS_PRIVATE;
+                    else if (kw) {
+                        doc.flags |= kw->flags;
+                        if (kw->access >= 0) {
+                            doc.access = kw->access;
+                            doc.access_given = true;
+                        }
                     }
-                    else if (wlen >= 1) {
-                        if (!seen_code_atsym && (doc.flags & (DOC_FLAG_INHERITS | DOC_FLAG_COLON | DOC_FLAG_SEMIC | DOC_FLAG_CURLY | DOC_FLAG_PAREN | DOC_FLAG_EQUALS)) == 0) {
+                    if ((!kw || (kw->context & KW_SOFT)) && wlen >= 1) {
+                        if (naming) {
                             doc.name.start = last_nonname_idx + 1;
                             doc.name.end = i - 1;
                         }
@@ -417,7 +1010,7 @@ void parse_source_file(Source *source)
                         if (doc.main.code_end < 0)
                             doc.main.code_end = i;
 
-                        maybe_add_doc(source, &doc, class_index, &class_level, seen_open_curly && !seen_close_curly, n_open_curly);
+                        maybe_add_doc(source, &doc, class_index, &class_level, chunk, seen_open_curly && !seen_close_curly, n_open_curly);
 
                         seen_ws = false;
                         seen_code_atsym = false;
@@ -425,6 +1018,9 @@ void parse_source_file(Source *source)
                         seen_open_curly = false;
                         seen_close_curly = false;
                         seen_paren = false;
+
+                        if (chunk && class_level < 0)
+                            chunk_checkpoint(chunk, i, n_lines, n_open_curly);
                     }
                 }
             }
@@ -455,5 +1051,343 @@ void parse_source_file(Source *source)
 
 		if (c != '_' && (c < '0' || c > '9') && (c < 'A' || c > 'Z') && (c < 'a' || c > 'z'))
 			last_nonname_idx = i;
+
+        i++;
     }
+
+	p->scan = scan;
+	p->pos = i;
+	p->exact = exact;
+	p->last_nonname_idx = last_nonname_idx;
+
+	p->is_javadoc = is_javadoc;
+	p->is_block_comment = is_block_comment;
+	p->is_line_comment = is_line_comment;
+	p->inside_cmd = inside_cmd;
+	p->is_line_cmd = is_line_cmd;
+	p->tag_kind = tag_kind;
+	p->seen_ws = seen_ws;
+	p->seen_code_atsym = seen_code_atsym;
+	p->seen_semicolon = seen_semicolon;
+	p->seen_open_curly = seen_open_curly;
+	p->seen_close_curly = seen_close_curly;
+	p->seen_paren = seen_paren;
+	p->n_open_paren = n_open_paren;
+	p->n_lines = n_lines;
+
+	p->n_open_curly = n_open_curly;
+	p->class_level = class_level;
+
+	p->doc = doc;
+	p->tag = tag;
+	p->dline = dline;
+}
+
+// buf holds the first size bytes of the source, which is all of it that's known so far. It
+//  can move from one call to the next, as long as what was in it before stays the same.
+// A few bytes at the end may be left until more arrives, or until parser_finish.
+void parser_feed(Parser *p, char *buf, int64_t size)
+{
+	p->source->file.buf = buf;
+	p->source->file.size = size;
+	p->scan.buf = buf;
+	p->scan.size = size;
+	parser_run(p, INT64_MAX);
+}
+
+// Parses whatever is left, once the whole source has been fed to the parser
+void parser_finish(Parser *p)
+{
+	Source *source = p->source;
+	p->scan.buf = source->file.buf;
+	p->scan.size = source->file.size;
+	p->scan.final = true;
+	parser_run(p, INT64_MAX);
+
+	find_package_name(source);
+	find_inherited_names(source);
+}
+
+// How many threads a large source can be parsed on, counting the one that asked
+int parse_threads = 1;
+
+// Sources are only split into chunks of at least this much
+#define PARSE_SPLIT_MIN (4 << 20)
+// How far past where a chunk would start to look for a blank line to start it at instead
+#define PARSE_SPLIT_SEARCH (64 << 10)
+
+// Threads parsing chunks, across every source being parsed. They come on top of the threads
+//  that parse whole sources, so a few large sources at once don't take parse_threads each.
+static int split_threads_busy = 0;
+
+static int reserve_split_threads(int wanted)
+{
+	int busy = __atomic_load_n(&split_threads_busy, __ATOMIC_RELAXED);
+	while (true) {
+		int n = parse_threads - 1 - busy;
+		if (n > wanted)
+			n = wanted;
+		if (n <= 0)
+			return 0;
+		if (__atomic_compare_exchange_n(&split_threads_busy, &busy, busy + n, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return n;
+	}
+}
+
+// Where a chunk can start at or after from: the start of the line after a blank line, since
+//  those are mostly between declarations, where the sequential parser soonest lines up with
+//  the chunk. Failing that, the start of any line. Returns -1 if there isn't one before to.
+static int64_t find_chunk_start(const char *buf, int64_t from, int64_t to)
+{
+	int64_t search_end = from + PARSE_SPLIT_SEARCH < to ? from + PARSE_SPLIT_SEARCH : to;
+	int64_t first_line = -1;
+	int64_t prev_break = -1;
+
+	const char *p = buf + from;
+	const char *end = buf + to;
+	while (p < end && (p = memchr(p, '\n', end - p))) {
+		int64_t at = p - buf;
+		if (first_line < 0 && at + 1 < to)
+			first_line = at + 1;
+
+		if (prev_break >= 0 && at + 1 < to) {
+			int64_t i = prev_break + 1;
+			while (i < at && (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\r'))
+				i++;
+			if (i == at)
+				return at + 1;
+		}
+		if (at >= search_end)
+			break;
+
+		prev_break = at;
+		p++;
+	}
+	return first_line;
+}
+
+static void *parse_chunk(void *data)
+{
+	Parse_Chunk *chunk = data;
+	Parser *p = &chunk->parser;
+	const File *file = &chunk->source.file;
+
+	parser_begin(p, &chunk->source);
+	p->chunk = chunk;
+
+	// a chunk starts after a line break, which is structural and not blank
+	p->pos = chunk->start;
+	p->last_nonname_idx = chunk->start - 1;
+	p->scan.buf = file->buf;
+	p->scan.size = file->size;
+	p->scan.final = true;
+	p->scan.base = chunk->start - 64;
+
+	// the guess is that it starts between declarations, on a line that may be indented
+	p->seen_ws = true;
+
+	parser_run(p, chunk->end);
+	return NULL;
+}
+
+static bool tag_is_reset(const Tag *t)
+{
+	return t->cmt_start < 0 && t->cmt_end < 0 && t->code_start < 0 && t->code_end < 0 && t->kind == TAG_KIND_NONE;
+}
+
+static bool doc_is_reset(const Doc *d)
+{
+	return d->name.start < 0 && d->name.end < 0 && tag_is_reset(&d->main) && tag_is_reset(&d->ret) &&
+		d->parent_doc == -1 && d->first_desc_line == -1 && d->n_desc_lines == 0 && d->first_tag == -1 &&
+		d->n_tags == 0 && d->code_lineno == -1 && d->flags == 0 && d->access == 0 &&
+		d->soft_keyword == 0 && !d->access_given;
+}
+
+// Whether the parser is where a chunk was at one of its checkpoints: just past the line break,
+//  with nothing pending. Everything the chunk's parser did from there on follows from that and
+//  from the counts.
+static bool parser_at_checkpoint(const Parser *p, const Parse_Checkpoint *cp)
+{
+	return p->pos == cp->pos + 1 && !p->exact && p->last_nonname_idx == cp->pos &&
+		!p->is_javadoc && !p->is_block_comment && !p->is_line_comment &&
+		!p->inside_cmd && !p->is_line_cmd && p->tag_kind == TAG_KIND_NONE &&
+		!p->seen_ws && !p->seen_code_atsym && !p->seen_semicolon && !p->seen_open_curly &&
+		!p->seen_close_curly && !p->seen_paren && p->n_open_paren == 0 &&
+		doc_is_reset(&p->doc) && tag_is_reset(&p->tag) && p->dline.start < 0 && p->dline.end < 0;
+}
+
+// If the parser is at the checkpoint, and the chunk's guesses about the classes open before it
+//  hold from there on, takes what the chunk found after the checkpoint, and the chunk's state
+//  at its end, with every count and index moved along to where the parser is
+static bool chunk_adopt(Parser *p, Parse_Chunk *chunk, const Parse_Checkpoint *cp)
+{
+	if (!parser_at_checkpoint(p, cp))
+		return false;
+
+	int n_base = p->class_level + 1;
+	if (n_base + chunk->max_level >= MAX_CLASS_LEVELS - 1)
+		return false;
+
+	int64_t base[MAX_CLASS_LEVELS];
+	memcpy(base, p->class_index, n_base * sizeof(int64_t));
+	int curly_shift = p->n_open_curly - cp->n_open_curly;
+
+	const Parse_Guess *guesses = chunk->guesses.buf;
+	for (int g = cp->n_guesses; g < chunk->guesses.n; g++) {
+		int level = n_base - 1 - (guesses[g].outer_popped - cp->outer_popped);
+		bool popped = level >= 0 && (base[level] >> 32) == guesses[g].n_open_curly + curly_shift;
+		if (popped != guesses[g].popped)
+			return false;
+	}
+
+	Source *source = p->source;
+	const Source *from = &chunk->source;
+	int doc_shift = source->docs.n - cp->n_docs;
+	int tag_shift = source->tags.n - cp->n_tags;
+	int desc_shift = source->descs.n - cp->n_descs;
+	int line_shift = p->n_lines - cp->n_lines;
+	int first = source->docs.n;
+
+	doc_table_append(&source->docs, &from->docs, cp->n_docs);
+	vector_append_array(&source->tags, sizeof(Tag), (const Tag*)from->tags.buf + cp->n_tags, from->tags.n - cp->n_tags);
+	vector_append_array(&source->descs, sizeof(Span), (const Span*)from->descs.buf + cp->n_descs, from->descs.n - cp->n_descs);
+
+	uint32_t *bits = source->docs.bits.buf;
+	int *parents = source->docs.parent.buf;
+	Doc_Detail *details = source->docs.detail.buf;
+	for (int i = first; i < source->docs.n; i++) {
+		int parent = parents[i];
+		if (parent >= 0) {
+			parent += doc_shift;
+		}
+		else if (parent < -1) {
+			int level = n_base - 1 - (OUTER_PARENT(parent) - cp->outer_popped);
+			parent = level >= 0 ? base[level] & 0x7fffFFFF : -1;
+
+			// now that the class is known, so is whether a method is its constructor
+			if ((~bits[i] & (DOC_FLAG_PAREN | DOC_FLAG_CURLY | DOC_FLAG_EQUALS)) == DOC_FLAG_EQUALS)
+				bits[i] |= names_its_class(source, doc_name(&source->docs, i), parent) ? DOC_FLAG_CTOR : DOC_FLAG_METHOD;
+		}
+		parents[i] = parent;
+
+		Doc_Detail *d = &details[i];
+		if (d->first_tag >= 0)
+			d->first_tag += tag_shift;
+		if (d->first_desc_line >= 0)
+			d->first_desc_line += desc_shift;
+		if (d->code_lineno >= 0)
+			d->code_lineno += line_shift;
+	}
+
+	// the classes from before the chunk that it didn't close, then the ones it opened
+	int level = n_base - 1 - (chunk->outer_popped - cp->outer_popped);
+	*p = chunk->parser;
+	p->source = source;
+	p->chunk = NULL;
+
+	memcpy(p->class_index, base, (level + 1) * sizeof(int64_t));
+	const int64_t *opened = chunk->parser.class_index;
+	for (int l = 0; l <= chunk->parser.class_level; l++) {
+		int curly = (int)(opened[l] >> 32) + curly_shift;
+		int doc = (int)(opened[l] & 0x7fffFFFF) + doc_shift;
+		p->class_index[++level] = (int64_t)((uint64_t)curly << 32) | (int64_t)doc;
+	}
+	p->class_level = level;
+
+	p->n_lines += line_shift;
+	p->n_open_curly += curly_shift;
+	if (p->doc.first_tag >= 0)
+		p->doc.first_tag += tag_shift;
+	if (p->doc.first_desc_line >= 0)
+		p->doc.first_desc_line += desc_shift;
+	if (p->doc.code_lineno >= 0)
+		p->doc.code_lineno += line_shift;
+	return true;
+}
+
+// Parses a large source in chunks, each on its own thread but the first, which this thread
+//  parses as it would the whole source. Then it carries on into each chunk in turn until it
+//  lines up with one of the chunk's checkpoints, and takes the rest from the chunk. If it never
+//  does, eg. when a chunk starts inside a comment that's as long as the chunk, it parses the
+//  whole chunk itself, so the docs always come out the same as from parsing it all in one go.
+// Returns false, having done nothing, if the source isn't worth splitting.
+static bool parse_source_split(Source *source)
+{
+	int64_t size = source->file.size;
+	int wanted = (int)(size / PARSE_SPLIT_MIN) - 1;
+	if (wanted < 1)
+		return false;
+
+	int n_extra = reserve_split_threads(wanted);
+	if (n_extra == 0)
+		return false;
+
+	Parse_Chunk *chunks = calloc(n_extra + 1, sizeof(Parse_Chunk));
+	int n = 1;
+	for (int j = 1; j <= n_extra; j++) {
+		int64_t from = size * j / (n_extra + 1);
+		int64_t start = find_chunk_start(source->file.buf, from, size);
+		if (start > chunks[n-1].start)
+			chunks[n++].start = start;
+	}
+	for (int j = 0; j < n; j++)
+		chunks[j].end = j + 1 < n ? chunks[j+1].start : size;
+
+	for (int j = 1; j < n; j++) {
+		Parse_Chunk *chunk = &chunks[j];
+		source_init(&chunk->source, NULL);
+		chunk->source.file = source->file;
+		chunk->source.file.borrowed = true;
+		chunk->source.access_level = source->access_level;
+		chunk->source.class_name = source->class_name;
+		chunk->max_level = -1;
+		chunk->next_checkpoint = chunk->start;
+		chunk->checkpoint_gap = CHUNK_FIRST_GAP;
+		pthread_create(&chunk->thread, NULL, parse_chunk, chunk);
+	}
+
+	Parser p;
+	parser_begin(&p, source);
+	p.scan.buf = source->file.buf;
+	p.scan.size = size;
+	p.scan.final = true;
+	parser_run(&p, chunks[0].end);
+
+	for (int j = 1; j < n; j++) {
+		Parse_Chunk *chunk = &chunks[j];
+		pthread_join(chunk->thread, NULL);
+
+		bool adopted = false;
+		const Parse_Checkpoint *cps = chunk->checkpoints.buf;
+		for (int k = 0; k < chunk->checkpoints.n && !adopted; k++) {
+			parser_run(&p, cps[k].pos + 1);
+			adopted = chunk_adopt(&p, chunk, &cps[k]);
+		}
+		if (!adopted)
+			parser_run(&p, chunk->end);
+
+		source_close(&chunk->source);
+		vector_free(&chunk->guesses);
+		vector_free(&chunk->checkpoints);
+	}
+	__atomic_sub_fetch(&split_threads_busy, n_extra, __ATOMIC_RELAXED);
+	free(chunks);
+
+	parser_finish(&p);
+
+	// docs taken from the chunks skipped the lists of each kind
+	index_doc_kinds(source);
+	return true;
+}
+
+void parse_source_file(Source *source)
+{
+	reserve_source_tables(source);
+
+	if (parse_threads > 1 && parse_source_split(source))
+		return;
+
+	Parser p;
+	parser_begin(&p, source);
+	parser_finish(&p);
 }
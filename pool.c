@@ -0,0 +1,179 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+	pthread_mutex_t lock;
+	Vector jobs;
+	int head;
+} Job_Queue;
+
+struct Pool {
+	pthread_t *threads;
+	Job_Queue *queues;
+	int n_workers;
+	unsigned next_queue;
+
+	void (*func)(void *data, int job, int worker);
+	void *data;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int pending;
+	bool closing;
+};
+
+typedef struct {
+	Pool *pool;
+	int worker;
+} Worker_Start;
+
+static bool queue_take(Job_Queue *q, int *job)
+{
+	bool found = false;
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->jobs.n) {
+		*job = ((int*)q->jobs.buf)[q->head++];
+		found = true;
+		if (q->head == q->jobs.n) {
+			q->head = 0;
+			q->jobs.n = 0;
+		}
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+// Jobs are taken from the front of each queue, both by the owner and by thieves,
+// so that work submitted in priority order (eg. largest file first) stays in that order.
+static bool pool_take(Pool *pool, int worker, int *job)
+{
+	for (int i = 0; i < pool->n_workers; i++) {
+		if (queue_take(&pool->queues[(worker + i) % pool->n_workers], job)) {
+			__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void *pool_worker(void *arg)
+{
+	Worker_Start *start = arg;
+	Pool *pool = start->pool;
+	int worker = start->worker;
+	free(start);
+
+	while (true) {
+		int job;
+		if (pool_take(pool, worker, &job)) {
+			pool->func(pool->data, job, worker);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0 && !pool->closing)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		bool done = pool->closing && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (done)
+			break;
+	}
+
+	return NULL;
+}
+
+int pool_default_size(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+Pool *pool_create(int n_workers, void (*func)(void *data, int job, int worker), void *data)
+{
+	Pool *pool = calloc(1, sizeof(Pool));
+	pool->func = func;
+	pool->data = data;
+
+	// With fewer than two workers, jobs are run on the submitting thread
+	if (n_workers < 2)
+		return pool;
+
+	pool->n_workers = n_workers;
+	pool->queues = calloc(n_workers, sizeof(Job_Queue));
+	pool->threads = calloc(n_workers, sizeof(pthread_t));
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (int i = 0; i < n_workers; i++)
+		pthread_mutex_init(&pool->queues[i].lock, NULL);
+
+	for (int i = 0; i < n_workers; i++) {
+		Worker_Start *start = malloc(sizeof(Worker_Start));
+		start->pool = pool;
+		start->worker = i;
+		pthread_create(&pool->threads[i], NULL, pool_worker, start);
+	}
+
+	return pool;
+}
+
+int pool_n_workers(Pool *pool)
+{
+	return pool->n_workers > 0 ? pool->n_workers : 1;
+}
+
+void pool_submit(Pool *pool, int job)
+{
+	if (pool->n_workers == 0) {
+		pool->func(pool->data, job, 0);
+		return;
+	}
+
+	// jobs may be submitted from inside other jobs, so the round robin is shared
+	unsigned next = __atomic_fetch_add(&pool->next_queue, 1, __ATOMIC_RELAXED);
+	Job_Queue *q = &pool->queues[next % pool->n_workers];
+
+	// counted before it's pushed, so that a thief taking it straight away can't take pending below zero
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&q->lock);
+	*(int*)vector_add(&q->jobs, sizeof(int), 1) = job;
+	pthread_mutex_unlock(&q->lock);
+
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_finish(Pool *pool)
+{
+	if (pool->n_workers > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pool->closing = true;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+
+		for (int i = 0; i < pool->n_workers; i++)
+			pthread_join(pool->threads[i], NULL);
+
+		for (int i = 0; i < pool->n_workers; i++) {
+			pthread_mutex_destroy(&pool->queues[i].lock);
+			vector_free(&pool->queues[i].jobs);
+		}
+
+		pthread_mutex_destroy(&pool->lock);
+		pthread_cond_destroy(&pool->cond);
+		free(pool->queues);
+		free(pool->threads);
+	}
+
+	free(pool);
+}
@@ -0,0 +1,544 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A search index for the whole site, written next to the pages: every named doc with its
+//  flags, access, page and the first line of its description.
+// Each worker collects the docs of the sources it parsed, without locks. At the end the
+//  parts are sorted together by name and cut into chunks by name prefix:
+//   search/index.json        the prefix of every chunk, with how many entries and bytes it has
+//   search/<prefix>.json     [name, flags, access, href, parent, description] for each entry
+// A prefix starts at two characters and gets one longer for as long as its chunk is too big.
+// search.js fetches the chunks that can match what's being typed, as many as fit in
+//  SEARCH_FETCH_BUDGET bytes, and says the list is cut short when that leaves any out.
+
+#define SEARCH_CHUNK_MAX   2000
+#define SEARCH_PREFIX_MIN  2
+#define SEARCH_PREFIX_MAX  8
+#define SEARCH_DESC_MAX    160
+#define SEARCH_FETCH_BUDGET (1 << 20)
+
+// A part's text is compacted once at least this much of it, and half of it, is dead
+#define SEARCH_COMPACT_MIN  (64 << 10)
+
+typedef struct {
+	int key;      // offset of the name in the part's text, as written by search_key_char
+	int key_len;
+	int json;     // offset of the entry's JSON
+	int json_len;
+	int anchor;   // offset of the '#' and id in the JSON's href, left out if the doc doesn't carry the id
+	int anchor_len;
+	int symbol;   // offset of the qualified name the doc is in the table of symbols under
+	int symbol_len;
+	int page_idx;
+	int doc;
+	bool shown;   // the doc is somewhere on its page, see doc_carries_id
+} Search_Record;
+
+typedef struct {
+	Vector records;
+	Vector text;
+	int dead; // bytes of text that belong to records --watch has dropped
+} Search_Part;
+
+struct Search_Index {
+	Search_Part *parts;
+	int n_parts;
+};
+
+Search_Index *search_create(int n_workers)
+{
+	Search_Index *index = calloc(1, sizeof(Search_Index));
+	index->parts = calloc(n_workers, sizeof(Search_Part));
+	index->n_parts = n_workers;
+	return index;
+}
+
+void search_destroy(Search_Index *index)
+{
+	if (!index)
+		return;
+
+	for (int i = 0; i < index->n_parts; i++) {
+		vector_free(&index->parts[i].records);
+		vector_free(&index->parts[i].text);
+	}
+	free(index->parts);
+	free(index);
+}
+
+static void json_append_escaped(Vector *out, const char *str, int len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for (int i = 0; i < len; i++) {
+		char c = str[i];
+		if (c == '"' || c == '\\') {
+			char *p = vector_add(out, 1, 2);
+			p[0] = '\\';
+			p[1] = c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			char *p = vector_add(out, 1, 6);
+			memcpy(p, "\\u00", 4);
+			p[4] = hex[(c >> 4) & 0xf];
+			p[5] = hex[c & 0xf];
+		}
+		else {
+			*(char*)vector_add(out, 1, 1) = c;
+		}
+	}
+}
+
+static void json_append_string(Vector *out, const char *str, int len)
+{
+	*(char*)vector_add(out, 1, 1) = '"';
+	json_append_escaped(out, str, len);
+	*(char*)vector_add(out, 1, 1) = '"';
+}
+
+static void json_append_int(Vector *out, int value)
+{
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), "%d", value);
+	vector_append_array(out, 1, buf, len);
+}
+
+// The first line of the description, without the blanks and stars around it, and cut short
+//  (on a character boundary) if it's long
+static void doc_summary_line(const Source *source, int doc, const char **str, int *len)
+{
+	*str = NULL;
+	*len = 0;
+	int first = doc_detail(&source->docs, doc)->first_desc_line;
+	if (first < 0)
+		return;
+
+	const char *in = source->file.buf;
+	const Span *line = &((const Span*)source->descs.buf)[first];
+	int64_t start = line->start;
+	int64_t end = line->end;
+	if (start < 0 || end < start)
+		return;
+
+	while (start <= end && (in[start] == ' ' || in[start] == '\t' || in[start] == '*'))
+		start++;
+	while (end >= start && (in[end] == ' ' || in[end] == '\t' || in[end] == '\r' || in[end] == '\n'))
+		end--;
+
+	int64_t n = end - start + 1;
+	if (n > SEARCH_DESC_MAX) {
+		n = SEARCH_DESC_MAX;
+		while (n > 0 && ((unsigned char)in[start + n] & 0xc0) == 0x80)
+			n--;
+	}
+
+	*str = &in[start];
+	*len = n > 0 ? (int)n : 0;
+}
+
+// Names are sorted and cut into chunks lower-cased, and since prefixes end up in file names,
+//  with anything but a name character as '_'. search.js does the same to find a chunk.
+static char search_key_char(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c + ('a' - 'A');
+	if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+		return c;
+	return '_';
+}
+
+// Called from a worker, with that worker's part, once per parsed source
+void search_add_source(Search_Index *index, int worker, const Source *source, int page_idx, const char *page_name)
+{
+	Search_Part *part = &index->parts[worker];
+	const char *in = source->file.buf;
+	const Doc_Table *docs = &source->docs;
+	Vector key = {0};
+
+	for (int i = 0; i < docs->n; i++) {
+		const Span *name = doc_name(docs, i);
+		int anchor = symbol_key(source, i, &key);
+		if (key.n == 0)
+			continue;
+
+		Search_Record *rec = vector_add(&part->records, sizeof(Search_Record), 1);
+		rec->page_idx = page_idx;
+		rec->doc = i;
+		rec->shown = doc_carries_id(doc_flags(docs, i));
+
+		int name_len = name->end - name->start + 1;
+		rec->key = part->text.n;
+		rec->key_len = name_len;
+		char *lower = vector_add(&part->text, 1, name_len);
+		for (int j = 0; j < name_len; j++)
+			lower[j] = search_key_char(in[name->start + j]);
+
+		rec->symbol = part->text.n;
+		rec->symbol_len = key.n;
+		vector_append_array(&part->text, 1, key.buf, key.n);
+
+		// the parent is everything in the qualified name before the doc's own name
+		int parent_len = key.n - name_len - 1;
+		if (parent_len < 0)
+			parent_len = 0;
+
+		const char *desc;
+		int desc_len;
+		doc_summary_line(source, i, &desc, &desc_len);
+
+		rec->json = part->text.n;
+		*(char*)vector_add(&part->text, 1, 1) = '[';
+		json_append_string(&part->text, &in[name->start], name_len);
+		*(char*)vector_add(&part->text, 1, 1) = ',';
+		json_append_int(&part->text, (int)doc_flags(docs, i));
+		*(char*)vector_add(&part->text, 1, 1) = ',';
+		json_append_int(&part->text, doc_access(docs, i));
+		*(char*)vector_add(&part->text, 1, 1) = ',';
+
+		// href: the page, then the doc's id on it, which only one of the docs with a name has
+		*(char*)vector_add(&part->text, 1, 1) = '"';
+		json_append_escaped(&part->text, page_name, strlen(page_name));
+		rec->anchor = part->text.n;
+		*(char*)vector_add(&part->text, 1, 1) = '#';
+		json_append_escaped(&part->text, (char*)key.buf + anchor, key.n - anchor);
+		rec->anchor_len = part->text.n - rec->anchor;
+		*(char*)vector_add(&part->text, 1, 1) = '"';
+
+		*(char*)vector_add(&part->text, 1, 1) = ',';
+		json_append_string(&part->text, key.buf, parent_len);
+		*(char*)vector_add(&part->text, 1, 1) = ',';
+		json_append_string(&part->text, desc, desc_len);
+		*(char*)vector_add(&part->text, 1, 1) = ']';
+		rec->json_len = part->text.n - rec->json;
+	}
+
+	vector_free(&key);
+}
+
+typedef struct {
+	const Search_Record *rec;
+	const char *text;
+	bool has_anchor;
+} Search_Entry;
+
+static int compare_search_entries(const void *a, const void *b)
+{
+	const Search_Entry *x = a;
+	const Search_Entry *y = b;
+
+	int len = x->rec->key_len < y->rec->key_len ? x->rec->key_len : y->rec->key_len;
+	int c = memcmp(x->text + x->rec->key, y->text + y->rec->key, len);
+	if (c != 0)
+		return c;
+	if (x->rec->key_len != y->rec->key_len)
+		return x->rec->key_len < y->rec->key_len ? -1 : 1;
+	if (x->rec->page_idx != y->rec->page_idx)
+		return x->rec->page_idx < y->rec->page_idx ? -1 : 1;
+	return x->rec->doc - y->rec->doc;
+}
+
+static int entry_prefix_len(const Search_Entry *e, int len)
+{
+	return e->rec->key_len < len ? e->rec->key_len : len;
+}
+
+// Whether two entries have the same prefix of this length (or are both shorter, and equal)
+static bool same_prefix(const Search_Entry *a, const Search_Entry *b, int len)
+{
+	int la = entry_prefix_len(a, len);
+	int lb = entry_prefix_len(b, len);
+	return la == lb && !memcmp(a->text + a->rec->key, b->text + b->rec->key, la);
+}
+
+typedef struct {
+	Output_Add add;
+	void *ctx;
+	Vector manifest;
+	int n_chunks;
+} Search_Writer;
+
+static void write_chunk(Search_Writer *sw, const Search_Entry *entries, int n, int prefix_len)
+{
+	Vector name = {0};
+	vector_append_array(&name, 1, entries[0].text + entries[0].rec->key, entry_prefix_len(&entries[0], prefix_len));
+
+	Vector chunk = {0};
+	*(char*)vector_add(&chunk, 1, 1) = '[';
+	for (int i = 0; i < n; i++) {
+		if (i > 0)
+			vector_append_cstring(&chunk, ",\n");
+
+		// a doc that doesn't carry the id on its page is linked to the page itself
+		const Search_Record *rec = entries[i].rec;
+		const char *json = entries[i].text + rec->json;
+		if (entries[i].has_anchor) {
+			vector_append_array(&chunk, 1, json, rec->json_len);
+		}
+		else {
+			int cut = rec->anchor - rec->json;
+			vector_append_array(&chunk, 1, json, cut);
+			vector_append_array(&chunk, 1, json + cut + rec->anchor_len, rec->json_len - cut - rec->anchor_len);
+		}
+	}
+	vector_append_cstring(&chunk, "]\n");
+
+	if (sw->n_chunks++ > 0)
+		*(char*)vector_add(&sw->manifest, 1, 1) = ',';
+	json_append_string(&sw->manifest, name.buf, name.n);
+	vector_append_cstring(&sw->manifest, ":[");
+	json_append_int(&sw->manifest, n);
+	*(char*)vector_add(&sw->manifest, 1, 1) = ',';
+	json_append_int(&sw->manifest, chunk.n);
+	*(char*)vector_add(&sw->manifest, 1, 1) = ']';
+
+	char path[64];
+	snprintf(path, sizeof(path), "search/%.*s.json", name.n, (char*)name.buf);
+	sw->add(sw->ctx, path, chunk.buf, chunk.n);
+
+	vector_free(&chunk);
+	vector_free(&name);
+}
+
+// Writes the entries sharing a prefix of prefix_len, splitting them on the next character if there are too many
+static void write_chunks(Search_Writer *sw, const Search_Entry *entries, int n, int prefix_len)
+{
+	int i = 0;
+	while (i < n) {
+		int j = i + 1;
+		while (j < n && same_prefix(&entries[i], &entries[j], prefix_len))
+			j++;
+
+		// names no longer than the prefix can't be split any further, so they stay together
+		int k = i;
+		while (k < j && entries[k].rec->key_len <= prefix_len)
+			k++;
+
+		if (j - i > SEARCH_CHUNK_MAX && prefix_len < SEARCH_PREFIX_MAX && j - k > 0) {
+			if (k > i)
+				write_chunk(sw, entries + i, k - i, prefix_len);
+			write_chunks(sw, entries + k, j - k, prefix_len + 1);
+		}
+		else {
+			write_chunk(sw, entries + i, j - i, prefix_len);
+		}
+		i = j;
+	}
+}
+
+#define SEARCH_STR_(x) #x
+#define SEARCH_STR(x)  SEARCH_STR_(x)
+
+static const char search_js[] =
+	"// Lazily loads the chunks of the search index that can match what's typed, and lists the matches\n"
+	"(function() {\n"
+	"\tvar root = document.currentScript.src.replace(/[^\\/]*$/, '');\n"
+	"\tvar manifest = null, chunks = {}, timer = 0, budget = " SEARCH_STR(SEARCH_FETCH_BUDGET) ";\n"
+	"\tvar kinds = [[0x200, 'class'], [0x400, 'interface'], [0x100, 'struct'], [0x800, 'extension'],\n"
+	"\t\t[0x80, 'constructor'], [0x40, 'method'], [0x20, 'field']];\n"
+	"\n"
+	"\tfunction load(name) {\n"
+	"\t\tif (!chunks[name])\n"
+	"\t\t\tchunks[name] = fetch(root + 'search/' + name + '.json').then(function(r) { return r.json(); });\n"
+	"\t\treturn chunks[name];\n"
+	"\t}\n"
+	"\n"
+	"\tfunction fileName(q) {\n"
+	"\t\t// byte by byte, as the generator saw the name\n"
+	"\t\treturn unescape(encodeURIComponent(q)).replace(/[^a-z0-9]/g, '_');\n"
+	"\t}\n"
+	"\n"
+	"\t// every chunk whose prefix q starts with, and those whose prefix starts with q for as long\n"
+	"\t//  as they fit in the budget. found.cut says whether any were left out.\n"
+	"\tfunction chunksFor(q) {\n"
+	"\t\tvar f = fileName(q), found = [], bytes = 0;\n"
+	"\t\tfound.cut = false;\n"
+	"\t\tfor (var p in manifest) {\n"
+	"\t\t\tif (f.lastIndexOf(p, 0) === 0) {\n"
+	"\t\t\t\tfound.push(p);\n"
+	"\t\t\t}\n"
+	"\t\t\telse if (p.lastIndexOf(f, 0) === 0) {\n"
+	"\t\t\t\tfound.cut = found.cut || bytes + manifest[p][1] > budget;\n"
+	"\t\t\t\tif (!found.cut) {\n"
+	"\t\t\t\t\tbytes += manifest[p][1];\n"
+	"\t\t\t\t\tfound.push(p);\n"
+	"\t\t\t\t}\n"
+	"\t\t\t}\n"
+	"\t\t}\n"
+	"\t\treturn found;\n"
+	"\t}\n"
+	"\n"
+	"\tfunction kind(flags) {\n"
+	"\t\tfor (var i = 0; i < kinds.length; i++)\n"
+	"\t\t\tif (flags & kinds[i][0]) return kinds[i][1];\n"
+	"\t\treturn '';\n"
+	"\t}\n"
+	"\n"
+	"\tfunction show(list, found, cut) {\n"
+	"\t\tlist.textContent = '';\n"
+	"\t\tfound.slice(0, 50).forEach(function(e) {\n"
+	"\t\t\tvar li = document.createElement('li'), a = document.createElement('a');\n"
+	"\t\t\ta.href = root + e[3];\n"
+	"\t\t\ta.textContent = (e[4] ? e[4] + '.' : '') + e[0];\n"
+	"\t\t\tli.appendChild(a);\n"
+	"\t\t\tli.appendChild(document.createTextNode(' ' + kind(e[1]) + (e[5] ? ' - ' + e[5] : '')));\n"
+	"\t\t\tlist.appendChild(li);\n"
+	"\t\t});\n"
+	"\t\tif (cut || found.length > 50) {\n"
+	"\t\t\tvar more = document.createElement('li');\n"
+	"\t\t\tmore.textContent = 'More matches than shown here, type more of the name to see them';\n"
+	"\t\t\tlist.appendChild(more);\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\n"
+	"\tfunction search(input, list) {\n"
+	"\t\tvar q = input.value.trim().toLowerCase();\n"
+	"\t\tif (q.length < 2 || !manifest) { list.textContent = ''; return; }\n"
+	"\t\tvar names = chunksFor(q);\n"
+	"\t\tPromise.all(names.map(load)).then(function(parts) {\n"
+	"\t\t\tif (input.value.trim().toLowerCase() !== q) return;\n"
+	"\t\t\tvar found = [];\n"
+	"\t\t\tparts.forEach(function(p) {\n"
+	"\t\t\t\tp.forEach(function(e) { if (e[0].toLowerCase().lastIndexOf(q, 0) === 0) found.push(e); });\n"
+	"\t\t\t});\n"
+	"\t\t\tshow(list, found, names.cut);\n"
+	"\t\t});\n"
+	"\t}\n"
+	"\n"
+	"\tdocument.addEventListener('DOMContentLoaded', function() {\n"
+	"\t\tvar input = document.createElement('input'), list = document.createElement('ul');\n"
+	"\t\tinput.type = 'search';\n"
+	"\t\tinput.placeholder = 'Search';\n"
+	"\t\tinput.className = 'search';\n"
+	"\t\tlist.className = 'search-results';\n"
+	"\t\tdocument.body.insertBefore(list, document.body.firstChild);\n"
+	"\t\tdocument.body.insertBefore(input, list);\n"
+	"\t\tinput.addEventListener('input', function() {\n"
+	"\t\t\tclearTimeout(timer);\n"
+	"\t\t\ttimer = setTimeout(function() {\n"
+	"\t\t\t\tif (manifest) return search(input, list);\n"
+	"\t\t\t\tfetch(root + 'search/index.json').then(function(r) { return r.json(); })\n"
+	"\t\t\t\t\t.then(function(m) { manifest = m.chunks; search(input, list); });\n"
+	"\t\t\t}, 100);\n"
+	"\t\t});\n"
+	"\t});\n"
+	"})();\n";
+
+// What an entry comes to in the index: its JSON, and whether it can be the doc its name leads to
+static void search_record_state(Vector *out, const Search_Part *part, const Search_Record *rec)
+{
+	vector_append_array(out, 1, (char*)part->text.buf + rec->json, rec->json_len);
+	vector_append_array(out, 1, &rec->doc, sizeof(int));
+}
+
+// Each record's text is in one piece, from its key to the end of its JSON
+static int search_record_size(const Search_Record *rec)
+{
+	return rec->json + rec->json_len - rec->key;
+}
+
+// Copies the text of the records that are left into a new buffer, so that what --watch
+//  dropped doesn't pile up over a long session
+static void search_compact_part(Search_Part *part)
+{
+	Vector text = {0};
+	vector_reserve(&text, 1, part->text.n - part->dead);
+
+	Search_Record *recs = part->records.buf;
+	for (int j = 0; j < part->records.n; j++) {
+		int move = text.n - recs[j].key;
+		vector_append_array(&text, 1, (char*)part->text.buf + recs[j].key, search_record_size(&recs[j]));
+		recs[j].key += move;
+		recs[j].symbol += move;
+		recs[j].json += move;
+		recs[j].anchor += move;
+	}
+
+	vector_free(&part->text);
+	part->text = text;
+	part->dead = 0;
+}
+
+// For --watch: swaps the entries of a page for those of its new source, or for none if it's
+//  gone. Returns whether that changed anything.
+bool search_replace_source(Search_Index *index, const Source *source, int page_idx, const char *page_name)
+{
+	Vector before = {0};
+	for (int i = 0; i < index->n_parts; i++) {
+		Search_Part *part = &index->parts[i];
+		Search_Record *recs = part->records.buf;
+
+		// the page's entries are dropped, and their text is left where it is until there's enough of it
+		int kept = 0;
+		for (int j = 0; j < part->records.n; j++) {
+			if (recs[j].page_idx == page_idx) {
+				search_record_state(&before, part, &recs[j]);
+				part->dead += search_record_size(&recs[j]);
+			}
+			else {
+				recs[kept++] = recs[j];
+			}
+		}
+		part->records.n = kept;
+
+		if (part->dead >= SEARCH_COMPACT_MIN && part->dead * 2 >= part->text.n)
+			search_compact_part(part);
+	}
+
+	Search_Part *part = &index->parts[0];
+	int first = part->records.n;
+	if (source)
+		search_add_source(index, 0, source, page_idx, page_name);
+
+	Vector after = {0};
+	const Search_Record *recs = part->records.buf;
+	for (int j = first; j < part->records.n; j++)
+		search_record_state(&after, part, &recs[j]);
+
+	bool changed = before.n != after.n || (before.n > 0 && memcmp(before.buf, after.buf, before.n) != 0);
+	vector_free(&before);
+	vector_free(&after);
+	return changed;
+}
+
+// Merges what every worker collected, and hands the chunks, their index and search.js to add.
+// symbols has to be complete by now: it decides which docs link to an id of their own.
+void search_write(Search_Index *index, Symbols *symbols, Output_Add add, void *ctx)
+{
+	int n = 0;
+	for (int i = 0; i < index->n_parts; i++)
+		n += index->parts[i].records.n;
+
+	Search_Entry *entries = malloc((n > 0 ? n : 1) * sizeof(Search_Entry));
+	int k = 0;
+	for (int i = 0; i < index->n_parts; i++) {
+		Search_Part *part = &index->parts[i];
+		const Search_Record *recs = part->records.buf;
+		for (int j = 0; j < part->records.n; j++) {
+			const char *text = part->text.buf;
+			const Symbol *sym = symbols_find(symbols, text + recs[j].symbol, recs[j].symbol_len);
+			entries[k].rec = &recs[j];
+			entries[k].text = text;
+			entries[k].has_anchor = recs[j].shown && sym && sym->page_idx == recs[j].page_idx && sym->doc == recs[j].doc;
+			k++;
+		}
+	}
+
+	qsort(entries, n, sizeof(Search_Entry), compare_search_entries);
+
+	Search_Writer sw = {0};
+	sw.add = add;
+	sw.ctx = ctx;
+	vector_append_cstring(&sw.manifest, "{\"version\":2,\"chunks\":{");
+	write_chunks(&sw, entries, n, SEARCH_PREFIX_MIN);
+	vector_append_cstring(&sw.manifest, "}}\n");
+
+	add(ctx, "search/index.json", sw.manifest.buf, sw.manifest.n);
+	add(ctx, "search.js", search_js, sizeof(search_js) - 1);
+
+	vector_free(&sw.manifest);
+	free(entries);
+}
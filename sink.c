@@ -0,0 +1,448 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+// A page is built up in fixed-size chunks. Once SINK_BATCH chunks are full they are handed
+//  to the destination with a single writev. If the page can't be written yet (another page
+//  comes before it), the chunks are kept, and past SINK_MAX_HELD chunks they are spilled to
+//  an unlinked temporary file, so a page never holds more than a few MB no matter its size.
+
+#define SINK_CHUNK_SIZE  (64 * 1024)
+#define SINK_BATCH       4
+#define SINK_MAX_HELD    16
+#define POOL_MAX_CHUNKS  64
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static bool write_all_iov(int fd, struct iovec *iov, int n_iov)
+{
+	while (n_iov > 0) {
+		int batch = n_iov < IOV_MAX ? n_iov : IOV_MAX;
+		ssize_t wrote = writev(fd, iov, batch);
+		if (wrote < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		while (n_iov > 0 && (size_t)wrote >= iov->iov_len) {
+			wrote -= iov->iov_len;
+			iov++;
+			n_iov--;
+		}
+		if (n_iov > 0) {
+			iov->iov_base = (char*)iov->iov_base + wrote;
+			iov->iov_len -= wrote;
+		}
+	}
+	return true;
+}
+
+// A sink made with sink_init_callback hands each chunk to its function instead of a file
+static bool write_all_callback(Sink *sink, const struct iovec *iov, int n_iov)
+{
+	for (int i = 0; i < n_iov; i++) {
+		if (iov[i].iov_len > 0 && !sink->write(sink->write_ctx, iov[i].iov_base, iov[i].iov_len))
+			return false;
+	}
+	return true;
+}
+
+static bool write_all_dest(Sink *sink, struct iovec *iov, int n_iov)
+{
+	return sink->write ? write_all_callback(sink, iov, n_iov) : write_all_iov(sink->fd, iov, n_iov);
+}
+
+// Writes to the page's destination, counted for --stats
+static bool sink_write_out(Sink *sink, struct iovec *iov, int n_iov)
+{
+	if (!stats_enabled)
+		return write_all_dest(sink, iov, n_iov);
+
+	long bytes = 0;
+	for (int i = 0; i < n_iov; i++)
+		bytes += iov[i].iov_len;
+
+	uint64_t start = stats_clock();
+	bool ok = write_all_dest(sink, iov, n_iov);
+	STATS_ADD(write_ns, stats_clock() - start);
+	STATS_ADD(bytes_written, bytes);
+	return ok;
+}
+
+// Chunks outlive the page they were used for: sink_close hands them back to the pool of the
+//  worker that rendered the page, and that worker's next page starts from them.
+// The page is usually closed by the thread writing output, not the worker, hence the lock.
+struct Chunk_Pool {
+	pthread_mutex_t lock;
+	Vector chunks;
+};
+
+Chunk_Pool *chunk_pool_create(void)
+{
+	Chunk_Pool *pool = calloc(1, sizeof(Chunk_Pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	return pool;
+}
+
+void chunk_pool_destroy(Chunk_Pool *pool)
+{
+	if (!pool)
+		return;
+
+	char **chunks = pool->chunks.buf;
+	for (int i = 0; i < pool->chunks.n; i++)
+		free(chunks[i]);
+
+	vector_free(&pool->chunks);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static void chunk_pool_put(Chunk_Pool *pool, char *chunk)
+{
+	if (pool) {
+		pthread_mutex_lock(&pool->lock);
+		bool kept = pool->chunks.n < POOL_MAX_CHUNKS;
+		if (kept)
+			*(char**)vector_add(&pool->chunks, sizeof(char*), 1) = chunk;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (kept)
+			return;
+	}
+	free(chunk);
+}
+
+void sink_init(Sink *sink, int fd)
+{
+	memset(sink, 0, sizeof(Sink));
+	sink->fd = fd;
+	sink->tee_fd = -1;
+	sink->spill_fd = -1;
+}
+
+// For a page that goes to a function rather than a file, eg. through the library
+void sink_init_callback(Sink *sink, Sink_Write write, void *ctx)
+{
+	sink_init(sink, -1);
+	sink->write = write;
+	sink->write_ctx = ctx;
+}
+
+// From here on the page is compressed as raw deflate data (as in a ZIP entry) before it's
+//  held or written. sink->size still counts the bytes given to the sink, and the tee still
+//  gets them as they were. packed_size and crc are complete once the sink is finished.
+void sink_deflate(Sink *sink, int level)
+{
+	z_stream *zs = calloc(1, sizeof(z_stream));
+	if (deflateInit2(zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(zs);
+		sink->failed = true;
+		return;
+	}
+	sink->zs = zs;
+	sink->crc = crc32(0, NULL, 0);
+}
+
+static char *sink_new_chunk(Sink *sink)
+{
+	if (sink->spare.n > 0) {
+		sink->spare.n--;
+		return ((char**)sink->spare.buf)[sink->spare.n];
+	}
+
+	char *chunk = NULL;
+	if (sink->pool) {
+		pthread_mutex_lock(&sink->pool->lock);
+		if (sink->pool->chunks.n > 0) {
+			sink->pool->chunks.n--;
+			chunk = ((char**)sink->pool->chunks.buf)[sink->pool->chunks.n];
+		}
+		pthread_mutex_unlock(&sink->pool->lock);
+	}
+
+	return chunk ? chunk : malloc(SINK_CHUNK_SIZE);
+}
+
+static void sink_recycle_chunks(Sink *sink)
+{
+	struct iovec *iov = sink->held.buf;
+	for (int i = 0; i < sink->held.n; i++)
+		*(char**)vector_add(&sink->spare, sizeof(char*), 1) = iov[i].iov_base;
+	sink->held.n = 0;
+}
+
+// The spill file goes in $TMPDIR, or /tmp without it. If it can't be made or written, the page
+//  fails and the held chunks are dropped all the same, since holding on to them would be unbounded.
+static void sink_spill(Sink *sink)
+{
+	if (sink->spill_fd < 0 && !sink->failed) {
+		const char *dir = getenv("TMPDIR");
+		if (!dir || !*dir)
+			dir = "/tmp";
+
+		char path[PATH_MAX];
+		if (snprintf(path, sizeof(path), "%s/docs-generator-XXXXXX", dir) < (int)sizeof(path))
+			sink->spill_fd = mkstemp(path);
+		if (sink->spill_fd >= 0)
+			unlink(path);
+	}
+
+	if (sink->spill_fd < 0 || !write_all_iov(sink->spill_fd, sink->held.buf, sink->held.n))
+		sink->failed = true;
+
+	sink_recycle_chunks(sink);
+}
+
+// Copies whatever was spilled to the temporary file into the destination, in order
+static void sink_unspill(Sink *sink)
+{
+	if (sink->spill_fd < 0)
+		return;
+
+	char *chunk = sink_new_chunk(sink);
+	off_t off = 0;
+
+	while (true) {
+		ssize_t got = pread(sink->spill_fd, chunk, SINK_CHUNK_SIZE, off);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+
+		struct iovec iov = { chunk, (size_t)got };
+		if (!sink_write_out(sink, &iov, 1))
+			sink->failed = true;
+		off += got;
+	}
+
+	*(char**)vector_add(&sink->spare, sizeof(char*), 1) = chunk;
+	close(sink->spill_fd);
+	sink->spill_fd = -1;
+}
+
+static void sink_hold(Sink *sink, char *chunk, int n)
+{
+	struct iovec *iov = vector_add(&sink->held, sizeof(struct iovec), 1);
+	iov->iov_base = chunk;
+	iov->iov_len = n;
+}
+
+// Compresses a full chunk into as many packed chunks as it takes, holding each one as it fills up
+static void sink_compress(Sink *sink, const char *data, int len, bool last)
+{
+	z_stream *zs = sink->zs;
+	zs->next_in = (Bytef*)data;
+	zs->avail_in = len;
+	if (len > 0)
+		sink->crc = crc32(sink->crc, (const Bytef*)data, len);
+
+	int ret = Z_OK;
+	do {
+		if (!sink->packed) {
+			sink->packed = sink_new_chunk(sink);
+			sink->packed_n = 0;
+		}
+
+		zs->next_out = (Bytef*)sink->packed + sink->packed_n;
+		zs->avail_out = SINK_CHUNK_SIZE - sink->packed_n;
+
+		ret = deflate(zs, last ? Z_FINISH : Z_NO_FLUSH);
+		int wrote = SINK_CHUNK_SIZE - sink->packed_n - zs->avail_out;
+		sink->packed_n += wrote;
+		sink->packed_size += wrote;
+
+		if (sink->packed_n == SINK_CHUNK_SIZE || (last && ret == Z_STREAM_END && sink->packed_n > 0)) {
+			sink_hold(sink, sink->packed, sink->packed_n);
+			sink->packed = NULL;
+		}
+	} while (last ? ret == Z_OK : zs->avail_in > 0 || zs->avail_out == 0);
+
+	if (last) {
+		if (ret != Z_STREAM_END)
+			sink->failed = true;
+		deflateEnd(zs);
+		free(zs);
+		sink->zs = NULL;
+	}
+}
+
+static void sink_push_chunk(Sink *sink, bool last)
+{
+	if (!sink->chunk || sink->n == 0) {
+		if (last && sink->zs)
+			sink_compress(sink, NULL, 0, true);
+		return;
+	}
+
+	if (sink->tee_fd >= 0) {
+		struct iovec one = { sink->chunk, (size_t)sink->n };
+		if (!write_all_iov(sink->tee_fd, &one, 1))
+			sink->tee_failed = true;
+	}
+
+	if (sink->zs) {
+		sink_compress(sink, sink->chunk, sink->n, last);
+		*(char**)vector_add(&sink->spare, sizeof(char*), 1) = sink->chunk;
+	}
+	else {
+		sink_hold(sink, sink->chunk, sink->n);
+	}
+
+	sink->chunk = NULL;
+	sink->n = 0;
+}
+
+// Hands every full chunk to the destination, or to the spill file if there isn't one yet
+void sink_flush(Sink *sink)
+{
+	if (sink->held.n == 0)
+		return;
+
+	if (sink->fd < 0 && sink->get_fd) {
+		sink->fd = sink->get_fd(sink->owner);
+		if (sink->fd >= 0)
+			sink_unspill(sink);
+	}
+
+	if (sink->fd >= 0 || sink->write) {
+		struct iovec *iov = sink->held.buf;
+		int n_iov = sink->held.n;
+
+		// write_all_iov may advance the iovecs, so keep hold of the chunk pointers
+		char **chunks = vector_add(&sink->spare, sizeof(char*), n_iov);
+		for (int i = 0; i < n_iov; i++)
+			chunks[i] = iov[i].iov_base;
+
+		if (!sink_write_out(sink, iov, n_iov))
+			sink->failed = true;
+
+		sink->held.n = 0;
+	}
+	else if (sink->held.n >= SINK_MAX_HELD) {
+		sink_spill(sink);
+	}
+}
+
+void sink_write(Sink *sink, const void *data, int len)
+{
+	const char *p = data;
+	while (len > 0) {
+		if (!sink->chunk)
+			sink->chunk = sink_new_chunk(sink);
+
+		int room = SINK_CHUNK_SIZE - sink->n;
+		int n = len < room ? len : room;
+		memcpy(sink->chunk + sink->n, p, n);
+		sink->n += n;
+		sink->size += n;
+		p += n;
+		len -= n;
+
+		if (sink->n == SINK_CHUNK_SIZE) {
+			sink_push_chunk(sink, false);
+			if (sink->held.n >= SINK_BATCH)
+				sink_flush(sink);
+		}
+	}
+}
+
+void sink_append_cstring(Sink *sink, const char *str)
+{
+	if (str)
+		sink_write(sink, str, strlen(str));
+}
+
+void sink_append_utf8_html(Sink *sink, const char *str, int64_t len)
+{
+	if (!str || len <= 0)
+		return;
+
+	int utf8_left = 0;
+	bool stop = false;
+
+	while (len > 0 && !stop) {
+		if (!sink->chunk)
+			sink->chunk = sink_new_chunk(sink);
+
+		// escape as much as is guaranteed to fit in what's left of the chunk
+		int room = SINK_CHUNK_SIZE - sink->n;
+		if (room < 6) {
+			sink_push_chunk(sink, false);
+			if (sink->held.n >= SINK_BATCH)
+				sink_flush(sink);
+			continue;
+		}
+
+		int piece = room / 6;
+		if (piece > len)
+			piece = (int)len;
+
+		int wrote = html_escape(str, piece, sink->chunk + sink->n, &utf8_left, &stop);
+		sink->n += wrote;
+		sink->size += wrote;
+		str += piece;
+		len -= piece;
+	}
+}
+
+// Called once the page is complete: anything left over is pushed out if the destination is known
+void sink_finish(Sink *sink)
+{
+	sink_push_chunk(sink, true);
+	sink_flush(sink);
+}
+
+// Writes whatever the sink is still holding to fd, for pages that were finished before they could be written
+void sink_drain(Sink *sink, int fd)
+{
+	sink_push_chunk(sink, true);
+	if (sink->fd < 0) {
+		sink->fd = fd;
+		sink_unspill(sink);
+	}
+	sink_flush(sink);
+}
+
+void sink_close(Sink *sink)
+{
+	if (sink->chunk)
+		chunk_pool_put(sink->pool, sink->chunk);
+	if (sink->packed)
+		chunk_pool_put(sink->pool, sink->packed);
+
+	if (sink->zs) {
+		deflateEnd(sink->zs);
+		free(sink->zs);
+	}
+
+	struct iovec *iov = sink->held.buf;
+	for (int i = 0; i < sink->held.n; i++)
+		chunk_pool_put(sink->pool, iov[i].iov_base);
+
+	char **spare = sink->spare.buf;
+	for (int i = 0; i < sink->spare.n; i++)
+		chunk_pool_put(sink->pool, spare[i]);
+
+	vector_free(&sink->held);
+	vector_free(&sink->spare);
+
+	if (sink->spill_fd >= 0)
+		close(sink->spill_fd);
+
+	sink->chunk = NULL;
+	sink->packed = NULL;
+	sink->zs = NULL;
+	sink->spill_fd = -1;
+}
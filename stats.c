@@ -0,0 +1,210 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// What --stats reports: wall and CPU time for each phase of the run, what went in and out,
+//  what each source turned into, and the slowest sources.
+// Counters that live on hot paths are behind STATS_ADD, which checks stats_enabled before
+//  anything else, so with --stats off they cost a branch that's always taken the same way.
+
+#define STATS_SLOWEST 10
+
+bool stats_enabled = false;
+Stats_Counters stats_counters;
+
+uint64_t stats_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t stats_cpu_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_end_phase(Stats *stats)
+{
+	if (!stats_enabled || stats->open_phase < 0)
+		return;
+
+	Stats_Phase *p = &((Stats_Phase*)stats->phases.buf)[stats->open_phase];
+	p->wall_ns = stats_clock() - p->wall_ns;
+	p->cpu_ns = stats_cpu_clock() - p->cpu_ns;
+	stats->open_phase = -1;
+}
+
+// Ends whichever phase was going on, and starts timing the next one
+void stats_begin_phase(Stats *stats, const char *name)
+{
+	if (!stats_enabled)
+		return;
+
+	stats_end_phase(stats);
+
+	stats->open_phase = stats->phases.n;
+	Stats_Phase *p = vector_add(&stats->phases, sizeof(Stats_Phase), 1);
+	p->name = name;
+	p->wall_ns = stats_clock();
+	p->cpu_ns = stats_cpu_clock();
+}
+
+void stats_add_file(Stats *stats, const Stats_File *file)
+{
+	if (stats_enabled)
+		vector_append_array(&stats->files, sizeof(Stats_File), file, 1);
+}
+
+static uint64_t file_total_ns(const Stats_File *f)
+{
+	return f->read_ns + f->parse_ns + f->render_ns;
+}
+
+static int compare_slowest(const void *a, const void *b)
+{
+	uint64_t ta = file_total_ns(*(const Stats_File**)a);
+	uint64_t tb = file_total_ns(*(const Stats_File**)b);
+	return ta != tb ? (ta < tb ? 1 : -1) : 0;
+}
+
+static double seconds(uint64_t ns)
+{
+	return (double)ns / 1e9;
+}
+
+static double mb_per_s(long bytes, uint64_t ns)
+{
+	return ns > 0 ? (double)bytes / (1024.0 * 1024.0) / seconds(ns) : 0;
+}
+
+static void print_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; str && *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', out);
+		if ((unsigned char)*str >= 0x20)
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+static void report_text(Stats *stats, FILE *out, const Stats_File **slowest, int n_slowest, long totals[3], long peak_rss_kb)
+{
+	Stats_Counters *c = &stats_counters;
+	int n_files = stats->files.n;
+
+	fprintf(out, "\n%-16s %10s %10s\n", "phase", "wall s", "cpu s");
+	const Stats_Phase *phases = stats->phases.buf;
+	for (int i = 0; i < stats->phases.n; i++)
+		fprintf(out, "%-16s %10.3f %10.3f\n", phases[i].name, seconds(phases[i].wall_ns), seconds(phases[i].cpu_ns));
+
+	fprintf(out, "\nread     %12ld bytes  %8.3f s  %8.1f MB/s\n", c->bytes_read, seconds(c->read_ns), mb_per_s(c->bytes_read, c->read_ns));
+	fprintf(out, "written  %12ld bytes  %8.3f s  %8.1f MB/s\n", c->bytes_written, seconds(c->write_ns), mb_per_s(c->bytes_written, c->write_ns));
+	fprintf(out, "(times are summed over every thread)\n");
+
+	double per = n_files > 0 ? 1.0 / n_files : 0;
+	fprintf(out, "\nfiles %d: docs %ld (%.1f each), tags %ld (%.1f each), desc lines %ld (%.1f each)\n",
+		n_files, totals[0], totals[0] * per, totals[1], totals[1] * per, totals[2], totals[2] * per);
+	fprintf(out, "vectors: %ld grows, %ld copies, %ld bytes copied\n", c->vector_grows, c->vector_copies, c->vector_copied_bytes);
+	fprintf(out, "peak RSS: %.1f MB\n", peak_rss_kb / 1024.0);
+
+	if (n_slowest > 0) {
+		fprintf(out, "\nslowest files:          read s    parse s   render s      bytes  docs  tags  descs\n");
+		for (int i = 0; i < n_slowest; i++) {
+			const Stats_File *f = slowest[i];
+			fprintf(out, "%-20.20s %10.4f %10.4f %10.4f %10ld %5d %5d %6d%s\n",
+				f->name, seconds(f->read_ns), seconds(f->parse_ns), seconds(f->render_ns),
+				f->size, f->n_docs, f->n_tags, f->n_descs, f->cached ? "  (cached)" : "");
+		}
+	}
+}
+
+static void print_json_file(FILE *out, const Stats_File *f)
+{
+	fprintf(out, "{\"name\":");
+	print_json_string(out, f->name);
+	fprintf(out, ",\"bytes\":%ld,\"docs\":%d,\"tags\":%d,\"desc_lines\":%d,\"read_s\":%.6f,\"parse_s\":%.6f,\"render_s\":%.6f,\"cached\":%s}",
+		f->size, f->n_docs, f->n_tags, f->n_descs,
+		seconds(f->read_ns), seconds(f->parse_ns), seconds(f->render_ns), f->cached ? "true" : "false");
+}
+
+static void report_json(Stats *stats, FILE *out, const Stats_File **slowest, int n_slowest, long totals[3], long peak_rss_kb)
+{
+	Stats_Counters *c = &stats_counters;
+
+	fprintf(out, "{\"phases\":[");
+	const Stats_Phase *phases = stats->phases.buf;
+	for (int i = 0; i < stats->phases.n; i++) {
+		fprintf(out, "%s{\"name\":", i > 0 ? "," : "");
+		print_json_string(out, phases[i].name);
+		fprintf(out, ",\"wall_s\":%.6f,\"cpu_s\":%.6f}", seconds(phases[i].wall_ns), seconds(phases[i].cpu_ns));
+	}
+
+	fprintf(out, "],\n\"read\":{\"bytes\":%ld,\"seconds\":%.6f},", c->bytes_read, seconds(c->read_ns));
+	fprintf(out, "\"written\":{\"bytes\":%ld,\"seconds\":%.6f},\n", c->bytes_written, seconds(c->write_ns));
+	fprintf(out, "\"totals\":{\"files\":%d,\"docs\":%ld,\"tags\":%ld,\"desc_lines\":%ld},", stats->files.n, totals[0], totals[1], totals[2]);
+	fprintf(out, "\"vectors\":{\"grows\":%ld,\"copies\":%ld,\"copied_bytes\":%ld},", c->vector_grows, c->vector_copies, c->vector_copied_bytes);
+	fprintf(out, "\"peak_rss_kb\":%ld,\n", peak_rss_kb);
+
+	fprintf(out, "\"slowest\":[");
+	for (int i = 0; i < n_slowest; i++) {
+		fprintf(out, "%s\n", i > 0 ? "," : "");
+		print_json_file(out, slowest[i]);
+	}
+
+	fprintf(out, "],\n\"files\":[");
+	const Stats_File *files = stats->files.buf;
+	for (int i = 0; i < stats->files.n; i++) {
+		fprintf(out, "%s\n", i > 0 ? "," : "");
+		print_json_file(out, &files[i]);
+	}
+	fprintf(out, "]}\n");
+}
+
+void stats_report(Stats *stats, FILE *out)
+{
+	if (!stats_enabled)
+		return;
+
+	stats_end_phase(stats);
+
+	const Stats_File *files = stats->files.buf;
+	int n_files = stats->files.n;
+
+	long totals[3] = {0};
+	const Stats_File **by_time = malloc((n_files > 0 ? n_files : 1) * sizeof(Stats_File*));
+	for (int i = 0; i < n_files; i++) {
+		totals[0] += files[i].n_docs;
+		totals[1] += files[i].n_tags;
+		totals[2] += files[i].n_descs;
+		by_time[i] = &files[i];
+	}
+	qsort(by_time, n_files, sizeof(Stats_File*), compare_slowest);
+	int n_slowest = n_files < STATS_SLOWEST ? n_files : STATS_SLOWEST;
+
+	struct rusage usage;
+	long peak_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+	if (stats->json)
+		report_json(stats, out, by_time, n_slowest, totals, peak_rss_kb);
+	else
+		report_text(stats, out, by_time, n_slowest, totals, peak_rss_kb);
+
+	fflush(out);
+	free(by_time);
+}
+
+void stats_free(Stats *stats)
+{
+	vector_free(&stats->phases);
+	vector_free(&stats->files);
+}
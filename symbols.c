@@ -0,0 +1,470 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Every class, method and field of every source, under its package-qualified name
+//  (eg. "com.example.Foo.Inner.add"), so that a page can link to anything on any other page
+//  with one lookup. Workers add their sources as soon as they're parsed. The table is split
+//  into stripes with a lock each, picked by the hash, so workers rarely wait on each other.
+// Once every source is in, the table is only read, and lookups don't take any locks.
+// Types are also kept under their simple name, for references that aren't qualified.
+//  A simple name shared by types from different packages is ambiguous, and doesn't resolve.
+// With --watch, a source that changed is taken out of the table and put back in, which only
+//  touches the names it declares. Slots count how many docs declare them for that.
+
+#define SYMBOL_STRIPES 64
+
+#define SEED_QUALIFIED 0
+#define SEED_SIMPLE    1
+
+typedef struct {
+	uint64_t hash;
+	const char *key; // interned in the stripe's arena, or NULL for an empty slot
+	int key_len;
+	bool simple;
+	bool ambiguous;
+	bool dirty;  // a simple name that lost one of its types, and needs working out again
+	int n_defs;  // docs that declare this name, the winner included
+	int n_found; // used while settling
+	Symbol sym; // for a simple name, sym.name is the qualified name it stands for
+} Symbol_Slot;
+
+typedef struct {
+	pthread_mutex_t lock;
+	Symbol_Slot *slots;
+	int cap;
+	int n;
+	Arena names;
+} Symbol_Stripe;
+
+struct Symbols {
+	Symbol_Stripe stripes[SYMBOL_STRIPES];
+};
+
+Symbols *symbols_create(void)
+{
+	Symbols *symbols = calloc(1, sizeof(Symbols));
+	for (int i = 0; i < SYMBOL_STRIPES; i++)
+		pthread_mutex_init(&symbols->stripes[i].lock, NULL);
+	return symbols;
+}
+
+void symbols_destroy(Symbols *symbols)
+{
+	if (!symbols)
+		return;
+
+	for (int i = 0; i < SYMBOL_STRIPES; i++) {
+		Symbol_Stripe *st = &symbols->stripes[i];
+		free(st->slots);
+		arena_free(&st->names);
+		pthread_mutex_destroy(&st->lock);
+	}
+	free(symbols);
+}
+
+static Symbol_Stripe *symbols_stripe(Symbols *symbols, uint64_t hash)
+{
+	return &symbols->stripes[hash >> 58];
+}
+
+static Symbol_Slot *stripe_find(Symbol_Stripe *st, uint64_t hash, const char *key, int len, bool simple)
+{
+	if (st->cap == 0)
+		return NULL;
+
+	int mask = st->cap - 1;
+	for (int idx = hash & mask; st->slots[idx].key; idx = (idx + 1) & mask) {
+		Symbol_Slot *slot = &st->slots[idx];
+		if (slot->hash == hash && slot->key_len == len && slot->simple == simple && !memcmp(slot->key, key, len))
+			return slot;
+	}
+	return NULL;
+}
+
+static void stripe_grow(Symbol_Stripe *st)
+{
+	int new_cap = st->cap ? st->cap * 2 : 256;
+	Symbol_Slot *slots = calloc(new_cap, sizeof(Symbol_Slot));
+
+	for (int i = 0; i < st->cap; i++) {
+		Symbol_Slot *slot = &st->slots[i];
+		if (!slot->key)
+			continue;
+
+		int idx = slot->hash & (new_cap - 1);
+		while (slots[idx].key)
+			idx = (idx + 1) & (new_cap - 1);
+		slots[idx] = *slot;
+	}
+
+	free(st->slots);
+	st->slots = slots;
+	st->cap = new_cap;
+}
+
+static Symbol_Slot *stripe_insert(Symbol_Stripe *st, uint64_t hash, const char *key, int len, bool simple)
+{
+	// up to three quarters full: slots are big, and a stripe of a large tree has a lot of them
+	if ((st->n + 1) * 4 > st->cap * 3)
+		stripe_grow(st);
+
+	int idx = hash & (st->cap - 1);
+	while (st->slots[idx].key)
+		idx = (idx + 1) & (st->cap - 1);
+
+	char *name = arena_alloc(&st->names, len + 1);
+	memcpy(name, key, len);
+	name[len] = '\0';
+
+	Symbol_Slot *slot = &st->slots[idx];
+	slot->hash = hash;
+	slot->key = name;
+	slot->key_len = len;
+	slot->simple = simple;
+	st->n++;
+	return slot;
+}
+
+// Whichever source was given first wins, so the result doesn't depend on which worker got there first
+static bool symbol_comes_first(const Symbol *a, const Symbol *b)
+{
+	return a->page_idx != b->page_idx ? a->page_idx < b->page_idx : a->doc < b->doc;
+}
+
+// Returns the interned copy of the qualified name, and the anchor of whichever doc won it
+static const char *symbols_add(Symbols *symbols, const char *key, int len, int anchor, const Symbol *sym, const char **anchor_out)
+{
+	uint64_t hash = hash_bytes(key, len, SEED_QUALIFIED);
+	Symbol_Stripe *st = symbols_stripe(symbols, hash);
+
+	pthread_mutex_lock(&st->lock);
+
+	Symbol_Slot *slot = stripe_find(st, hash, key, len, false);
+	if (!slot) {
+		slot = stripe_insert(st, hash, key, len, false);
+		slot->sym = *sym;
+		slot->sym.name = slot->key;
+		slot->sym.anchor = slot->key + anchor;
+	}
+	else if (symbol_comes_first(sym, &slot->sym)) {
+		const char *anchor_ptr = slot->sym.anchor;
+		slot->sym = *sym;
+		slot->sym.name = slot->key;
+		slot->sym.anchor = anchor_ptr;
+	}
+	slot->n_defs++;
+	const char *interned = slot->key;
+	*anchor_out = slot->sym.anchor;
+
+	pthread_mutex_unlock(&st->lock);
+	return interned;
+}
+
+static void symbols_add_simple(Symbols *symbols, const char *name, int len, const Symbol *sym)
+{
+	uint64_t hash = hash_bytes(name, len, SEED_SIMPLE);
+	Symbol_Stripe *st = symbols_stripe(symbols, hash);
+
+	pthread_mutex_lock(&st->lock);
+
+	Symbol_Slot *slot = stripe_find(st, hash, name, len, true);
+	if (!slot) {
+		slot = stripe_insert(st, hash, name, len, true);
+		slot->sym = *sym;
+	}
+	else {
+		if (slot->sym.name != sym->name)
+			slot->ambiguous = true;
+		if (symbol_comes_first(sym, &slot->sym))
+			slot->sym = *sym;
+	}
+	slot->n_defs++;
+
+	pthread_mutex_unlock(&st->lock);
+}
+
+// Writes the qualified name of a doc into key: the package, then every class around the doc,
+//  then the doc's own name. Returns where the part after the package starts, which is also
+//  the doc's id on its page. Docs without a name leave key empty.
+int symbol_key(const Source *source, int doc, Vector *key)
+{
+	const char *in = source->file.buf;
+	const Doc_Table *docs = &source->docs;
+	key->n = 0;
+
+	int chain[MAX_CLASS_LEVELS + 1];
+	int depth = 0;
+	for (int d = doc; d >= 0 && depth <= MAX_CLASS_LEVELS; d = doc_parent(docs, d)) {
+		const Span *name = doc_name(docs, d);
+		if (name->start < 0 || name->end < name->start)
+			return 0;
+
+		chain[depth++] = d;
+		// parents always come first in the source, so anything else is broken
+		if (doc_parent(docs, d) >= d)
+			break;
+	}
+
+	int anchor = 0;
+	const Span *pkg = &source->package_name;
+	if (pkg->start >= 0 && pkg->end >= pkg->start) {
+		vector_append_array(key, 1, &in[pkg->start], pkg->end - pkg->start + 1);
+		*(char*)vector_add(key, 1, 1) = '.';
+		anchor = key->n;
+	}
+
+	for (int i = depth - 1; i >= 0; i--) {
+		const Span *name = doc_name(docs, chain[i]);
+		vector_append_array(key, 1, &in[name->start], name->end - name->start + 1);
+		if (i > 0)
+			*(char*)vector_add(key, 1, 1) = '.';
+	}
+
+	return anchor;
+}
+
+// Called from the workers, once per source
+void symbols_add_source(Symbols *symbols, const Source *source, int page_idx, const char *page_name)
+{
+	const char *in = source->file.buf;
+	const Doc_Table *docs = &source->docs;
+	Vector key = {0};
+
+	for (int i = 0; i < docs->n; i++) {
+		int anchor = symbol_key(source, i, &key);
+		if (key.n == 0)
+			continue;
+
+		Symbol sym = {0};
+		sym.page = page_name;
+		sym.page_idx = page_idx;
+		sym.doc = i;
+		sym.is_type = (doc_flags(docs, i) & DOC_FLAG_IS_PARENT) != 0;
+
+		sym.name = symbols_add(symbols, key.buf, key.n, anchor, &sym, &sym.anchor);
+
+		if (sym.is_type) {
+			const Span *name = doc_name(docs, i);
+			symbols_add_simple(symbols, &in[name->start], name->end - name->start + 1, &sym);
+		}
+	}
+
+	vector_free(&key);
+}
+
+const Symbol *symbols_find(Symbols *symbols, const char *key, int len)
+{
+	uint64_t hash = hash_bytes(key, len, SEED_QUALIFIED);
+	Symbol_Slot *slot = stripe_find(symbols_stripe(symbols, hash), hash, key, len, false);
+	return slot ? &slot->sym : NULL;
+}
+
+// The one type with this simple name, if there is exactly one
+const Symbol *symbols_find_type(Symbols *symbols, const char *name, int len)
+{
+	uint64_t hash = hash_bytes(name, len, SEED_SIMPLE);
+	Symbol_Slot *slot = stripe_find(symbols_stripe(symbols, hash), hash, name, len, true);
+	return slot && !slot->ambiguous ? &slot->sym : NULL;
+}
+
+uint64_t symbols_key_hash(const char *key, int len, bool simple)
+{
+	return hash_bytes(key, len, simple ? SEED_SIMPLE : SEED_QUALIFIED);
+}
+
+// Where a name leads, as far as a page linking to it can tell
+static uint64_t slot_state(const Symbol_Slot *slot)
+{
+	if (!slot)
+		return 0;
+
+	uint64_t h = hash_bytes(slot->sym.name, strlen(slot->sym.name), slot->hash);
+	h = hash_bytes(slot->sym.page, strlen(slot->sym.page), h);
+	h = hash_bytes(slot->sym.anchor, strlen(slot->sym.anchor), h);
+	int extra[] = { slot->sym.is_type, slot->ambiguous };
+	return hash_bytes(extra, sizeof(extra), h) | 1;
+}
+
+static void snapshot_name(Symbols *symbols, const char *key, int len, bool simple, Vector *states)
+{
+	uint64_t hash = symbols_key_hash(key, len, simple);
+	Symbol_Slot *slot = stripe_find(symbols_stripe(symbols, hash), hash, key, len, simple);
+
+	Symbol_State *state = vector_add(states, sizeof(Symbol_State), 1);
+	state->key = hash;
+	state->value = slot_state(slot);
+}
+
+// Adds the state of every name the source declares to states, always in the same order, so
+//  that two snapshots of the same source can be compared entry by entry
+void symbols_snapshot(Symbols *symbols, const Source *source, Vector *states)
+{
+	const char *in = source->file.buf;
+	const Doc_Table *docs = &source->docs;
+	Vector key = {0};
+
+	for (int i = 0; i < docs->n; i++) {
+		symbol_key(source, i, &key);
+		if (key.n == 0)
+			continue;
+
+		snapshot_name(symbols, key.buf, key.n, false, states);
+		if (doc_flags(docs, i) & DOC_FLAG_IS_PARENT) {
+			const Span *name = doc_name(docs, i);
+			snapshot_name(symbols, &in[name->start], name->end - name->start + 1, true, states);
+		}
+	}
+
+	vector_free(&key);
+}
+
+// Empties a slot, and moves back any later slots that were pushed past it, so nothing is lost
+static void stripe_delete(Symbol_Stripe *st, Symbol_Slot *slot)
+{
+	int mask = st->cap - 1;
+	int hole = slot - st->slots;
+
+	for (int idx = (hole + 1) & mask; st->slots[idx].key; idx = (idx + 1) & mask) {
+		int home = st->slots[idx].hash & mask;
+		if (((idx - hole) & mask) <= ((idx - home) & mask)) {
+			st->slots[hole] = st->slots[idx];
+			hole = idx;
+		}
+	}
+
+	memset(&st->slots[hole], 0, sizeof(Symbol_Slot));
+	st->n--;
+}
+
+static bool symbols_release(Symbols *symbols, const char *key, int len, bool simple, int page_idx, bool first_pass)
+{
+	uint64_t hash = symbols_key_hash(key, len, simple);
+	Symbol_Stripe *st = symbols_stripe(symbols, hash);
+	Symbol_Slot *slot = stripe_find(st, hash, key, len, simple);
+	if (!slot)
+		return true;
+
+	if (first_pass)
+		slot->n_defs--;
+	else if (slot->n_defs <= 0)
+		stripe_delete(st, slot);
+	else if (simple)
+		slot->dirty = true;
+	else if (slot->sym.page_idx == page_idx)
+		return false;
+
+	return true;
+}
+
+// Takes the names a source declared out of the table, for a source that changed or is gone.
+// Returns false if that can't be done in place, because another source also declares a name
+//  this one had won, and the table has to be built again to tell which one takes over.
+// Only for a table that nothing else is using. symbols_settle has to follow.
+bool symbols_remove_source(Symbols *symbols, const Source *source, int page_idx)
+{
+	const char *in = source->file.buf;
+	const Doc_Table *docs = &source->docs;
+	Vector key = {0};
+	bool ok = true;
+
+	// every doc gives up its claim first, so that a name declared twice in the source
+	//  (eg. an overloaded method) is known to be unclaimed before it's looked at
+	for (int pass = 0; pass < 2 && ok; pass++) {
+		for (int i = 0; i < docs->n && ok; i++) {
+			symbol_key(source, i, &key);
+			if (key.n == 0)
+				continue;
+
+			ok = symbols_release(symbols, key.buf, key.n, false, page_idx, pass == 0);
+			if (ok && (doc_flags(docs, i) & DOC_FLAG_IS_PARENT)) {
+				const Span *name = doc_name(docs, i);
+				ok = symbols_release(symbols, &in[name->start], name->end - name->start + 1, true, page_idx, pass == 0);
+			}
+		}
+	}
+
+	vector_free(&key);
+	return ok;
+}
+
+// Works out every simple name that lost a type again, from the qualified types that are left
+void symbols_settle(Symbols *symbols)
+{
+	bool any = false;
+	for (int i = 0; i < SYMBOL_STRIPES; i++) {
+		Symbol_Stripe *st = &symbols->stripes[i];
+		for (int j = 0; j < st->cap; j++) {
+			Symbol_Slot *slot = &st->slots[j];
+			if (slot->key && slot->dirty) {
+				slot->n_found = 0;
+				slot->ambiguous = false;
+				any = true;
+			}
+		}
+	}
+	if (!any)
+		return;
+
+	for (int i = 0; i < SYMBOL_STRIPES; i++) {
+		Symbol_Stripe *st = &symbols->stripes[i];
+		for (int j = 0; j < st->cap; j++) {
+			Symbol_Slot *slot = &st->slots[j];
+			if (!slot->key || slot->simple || !slot->sym.is_type)
+				continue;
+
+			const char *name = slot->key;
+			for (int k = slot->key_len - 1; k >= 0; k--) {
+				if (slot->key[k] == '.') {
+					name = &slot->key[k + 1];
+					break;
+				}
+			}
+			int len = slot->key_len - (name - slot->key);
+
+			uint64_t hash = symbols_key_hash(name, len, true);
+			Symbol_Slot *simple = stripe_find(symbols_stripe(symbols, hash), hash, name, len, true);
+			if (!simple || !simple->dirty)
+				continue;
+
+			if (simple->n_found == 0 || symbol_comes_first(&slot->sym, &simple->sym))
+				simple->sym = slot->sym;
+			if (++simple->n_found > 1)
+				simple->ambiguous = true;
+		}
+	}
+
+	for (int i = 0; i < SYMBOL_STRIPES; i++) {
+		Symbol_Stripe *st = &symbols->stripes[i];
+		for (int j = 0; j < st->cap; j++) {
+			Symbol_Slot *slot = &st->slots[j];
+			if (!slot->key || !slot->dirty)
+				continue;
+
+			// declared, but not by a type that won its name: nothing to link to
+			if (slot->n_found == 0)
+				slot->ambiguous = true;
+			slot->dirty = false;
+		}
+	}
+}
+
+// Where the name that symbols_key_hash gave key leads now, in the same terms as a snapshot.
+// Only the hash is compared: it's how a page's lookups are kept, without the names themselves.
+uint64_t symbols_state(Symbols *symbols, uint64_t key)
+{
+	Symbol_Stripe *st = symbols_stripe(symbols, key);
+	if (st->cap == 0)
+		return 0;
+
+	int mask = st->cap - 1;
+	for (int idx = key & mask; st->slots[idx].key; idx = (idx + 1) & mask) {
+		if (st->slots[idx].hash == key)
+			return slot_state(&st->slots[idx]);
+	}
+	return 0;
+}
@@ -0,0 +1,314 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Reads batches of small sources through io_uring, instead of an open, fstat, read and close
+//  per file. Each file is a hard-linked chain of three requests:
+//   openat into a slot of the ring's file table -> read from that slot -> close the slot
+// so a whole batch costs a single system call. Hard links keep the chain going after a short
+//  read (which is what a read of a whole file normally is), so the slot is always closed.
+// Anything that doesn't work out is left for read_whole_file, so the worst case is the
+//  synchronous path. The ring is only used from one thread.
+
+#define URING_ENTRIES 192
+#define URING_BATCH   (URING_ENTRIES / 3)
+
+struct Uring {
+	int fd;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	// files of unknown size are read into here first, one MMAP_THRESHOLD slot each,
+	//  since a fresh buffer that size for every small file costs more than the copy
+	char *scratch;
+
+	bool broken;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static bool uring_supports(int fd, const int *ops, int n_ops)
+{
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+
+	bool ok = uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+	for (int i = 0; ok && i < n_ops; i++) {
+		ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+
+	free(probe);
+	return ok;
+}
+
+void uring_close(Uring *ring)
+{
+	if (!ring)
+		return;
+
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	free(ring->scratch);
+	free(ring);
+}
+
+// Returns NULL if io_uring isn't there (old kernel, seccomp, disabled by sysctl) or is missing anything needed
+Uring *uring_open(void)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	int fd = uring_setup(URING_ENTRIES, &p);
+	if (fd < 0)
+		return NULL;
+
+	Uring *ring = calloc(1, sizeof(Uring));
+	ring->fd = fd;
+
+	int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !uring_supports(fd, ops, sizeof(ops) / sizeof(int))) {
+		uring_close(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (ring->cq_ring_size > ring->sq_ring_size)
+		ring->sq_ring_size = ring->cq_ring_size;
+	ring->cq_ring_size = ring->sq_ring_size;
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		uring_close(ring);
+		return NULL;
+	}
+	ring->cq_ring = ring->sq_ring;
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uring_close(ring);
+		return NULL;
+	}
+
+	char *sq = ring->sq_ring;
+	ring->sq_head  = (unsigned*)(sq + p.sq_off.head);
+	ring->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+	ring->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+
+	char *cq = ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+	ring->cqes    = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	// an empty table of file slots for the opens to go into
+	int slots[URING_BATCH];
+	for (int i = 0; i < URING_BATCH; i++)
+		slots[i] = -1;
+
+	if (uring_register(fd, IORING_REGISTER_FILES, slots, URING_BATCH) != 0) {
+		uring_close(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+static struct io_uring_sqe *uring_get_sqe(Uring *ring)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned idx = tail & *ring->sq_mask;
+
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+// user_data holds the file's index in the batch, times 4, plus which step of the chain it was
+enum { STEP_OPEN, STEP_READ, STEP_CLOSE };
+
+static int uring_read_batch(Uring *ring, File *files, const char **paths, const long *sizes, int n)
+{
+	int *read_len = calloc(n, sizeof(int));
+	bool *opened = calloc(n, sizeof(bool));
+
+	for (int i = 0; i < n; i++) {
+		// read one byte more than expected, to tell if the file grew since it was measured
+		long want;
+		char *dst;
+		if (sizes[i] >= 0) {
+			want = sizes[i] + 1;
+			dst = files[i].buf = malloc(want + 1);
+		}
+		else {
+			if (!ring->scratch)
+				ring->scratch = malloc((size_t)URING_BATCH * MMAP_THRESHOLD);
+			want = MMAP_THRESHOLD;
+			dst = ring->scratch + (size_t)i * MMAP_THRESHOLD;
+			files[i].buf = NULL;
+		}
+		read_len[i] = -1;
+
+		struct io_uring_sqe *sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->flags = IOSQE_IO_HARDLINK;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)paths[i];
+		// no O_CLOEXEC: it's refused for direct descriptors, which are never inherited anyway
+		sqe->open_flags = O_RDONLY;
+		sqe->file_index = i + 1;
+		sqe->user_data = (uint64_t)i * 4 + STEP_OPEN;
+
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_READ;
+		sqe->flags = IOSQE_IO_HARDLINK | IOSQE_FIXED_FILE;
+		sqe->fd = i;
+		sqe->addr = (uint64_t)(uintptr_t)dst;
+		sqe->len = (unsigned)want;
+		sqe->off = 0;
+		sqe->user_data = (uint64_t)i * 4 + STEP_READ;
+
+		sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = i + 1;
+		sqe->user_data = (uint64_t)i * 4 + STEP_CLOSE;
+	}
+
+	int total = n * 3;
+	int to_submit = total;
+	int completed = 0;
+
+	while (completed < total) {
+		int ret = uring_enter(ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		to_submit -= ret;
+
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			int i = (int)(cqe->user_data / 4);
+			int step = (int)(cqe->user_data % 4);
+
+			if (step == STEP_OPEN) {
+				opened[i] = cqe->res >= 0;
+
+				// a kernel without direct descriptors for openat can't do any of this
+				if (cqe->res == -EINVAL)
+					ring->broken = true;
+			}
+			else if (step == STEP_READ) {
+				read_len[i] = cqe->res;
+			}
+			completed++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	// The kernel may still be writing into buffers of requests that never completed,
+	//  so those are given up on rather than freed.
+	if (completed < total) {
+		ring->broken = true;
+		ring->scratch = NULL;
+		for (int i = 0; i < n; i++)
+			files[i].buf = NULL;
+		free(read_len);
+		free(opened);
+		return 0;
+	}
+
+	int n_read = 0;
+	for (int i = 0; i < n; i++) {
+		long want = sizes[i] >= 0 ? sizes[i] + 1 : MMAP_THRESHOLD;
+		int len = read_len[i];
+
+		// too big, gone, or not readable: read_whole_file takes it from here, and reports any error
+		if (!opened[i] || len < 0 || len >= want) {
+			free(files[i].buf);
+			files[i].buf = NULL;
+			continue;
+		}
+
+		if (sizes[i] >= 0) {
+			files[i].buf = realloc(files[i].buf, len + 1);
+		}
+		else {
+			files[i].buf = malloc(len + 1);
+			memcpy(files[i].buf, ring->scratch + (size_t)i * MMAP_THRESHOLD, len);
+		}
+		files[i].buf[len] = 0;
+		files[i].size = len;
+		n_read++;
+	}
+
+	free(read_len);
+	free(opened);
+	return n_read;
+}
+
+// Reads as many of the given files as it can, in batches. Sizes are the sizes the files are
+//  expected to have, or -1 if they aren't known, in which case only files smaller than
+//  MMAP_THRESHOLD are read. Files that weren't read are left with a NULL buf.
+int uring_read_files(Uring *ring, File *files, const char **paths, const long *sizes, int n)
+{
+	int n_read = 0;
+	for (int i = 0; i < n && !ring->broken; i += URING_BATCH) {
+		int batch = n - i < URING_BATCH ? n - i : URING_BATCH;
+		n_read += uring_read_batch(ring, files + i, paths + i, sizes + i, batch);
+	}
+	return n_read;
+}
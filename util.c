@@ -4,32 +4,171 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Arena blocks are kept after a reset, so whatever the arena holds next reuses memory that
+//  is already mapped instead of going back to malloc.
+// An arena's first block is small and each new one is twice the last, so that the many arenas
+//  of small sources share the heap's pages instead of each touching a block of its own.
+#define ARENA_BLOCK_MIN  (4 * 1024)
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+struct Arena_Block {
+	Arena_Block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+
+	Arena_Block *b = arena->head;
+	if (!b || b->size - b->used < size) {
+		// take a kept block if it's big enough, otherwise make a new one
+		Arena_Block **prev = &arena->spare;
+		b = arena->spare;
+		while (b && b->size < size) {
+			prev = &b->next;
+			b = b->next;
+		}
 
-void *vector_add(Vector *vec, int elem_size, int count)
+		if (b) {
+			*prev = b->next;
+		}
+		else {
+			size_t block_size = arena->head ? arena->head->size * 2 : ARENA_BLOCK_MIN;
+			if (block_size > ARENA_BLOCK_SIZE)
+				block_size = ARENA_BLOCK_SIZE;
+			if (block_size < size)
+				block_size = size;
+			b = malloc(sizeof(Arena_Block) + block_size);
+			b->size = block_size;
+		}
+
+		b->used = 0;
+		b->next = arena->head;
+		arena->head = b;
+	}
+
+	void *ptr = &b->data[b->used];
+	b->used += size;
+	return ptr;
+}
+
+// Grows the most recent allocation where it is, if there's room left in its block
+bool arena_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size)
 {
-	if (count <= 0)
-		return NULL;
+	Arena_Block *b = arena->head;
+	if (!b)
+		return false;
 
-	int new_size = vec->n + count;
+	old_size = (old_size + 15) & ~(size_t)15;
+	new_size = (new_size + 15) & ~(size_t)15;
 
-    if (!vec->buf || new_size >= vec->cap) {
-        int old_cap = vec->cap;
-        int new_cap = old_cap;
+	if ((char*)ptr + old_size != &b->data[b->used] || b->used - old_size + new_size > b->size)
+		return false;
 
-        if (new_cap < 16)
-            new_cap = 16;
-        while (new_size >= new_cap)
-            new_cap = (int)((float)new_cap * 1.7f) + 1;
+	b->used = b->used - old_size + new_size;
+	return true;
+}
 
-        void *new_buf = malloc(new_cap * elem_size);
-        if (vec->buf) {
-            memcpy(new_buf, vec->buf, old_cap * elem_size);
-            free(vec->buf);
+void arena_reset(Arena *arena)
+{
+	while (arena->head) {
+		Arena_Block *b = arena->head;
+		arena->head = b->next;
+		b->next = arena->spare;
+		arena->spare = b;
+	}
+}
+
+// The memory the arena's blocks take up, whether or not all of it is in use
+size_t arena_size(const Arena *arena)
+{
+	size_t size = 0;
+	for (const Arena_Block *b = arena->head; b; b = b->next)
+		size += sizeof(Arena_Block) + b->size;
+	return size;
+}
+
+void arena_free(Arena *arena)
+{
+	arena_reset(arena);
+	while (arena->spare) {
+		Arena_Block *b = arena->spare;
+		arena->spare = b->next;
+		free(b);
+	}
+}
+
+// Heap buffers grow with realloc, which for large blocks remaps pages instead of copying them.
+// Arena buffers grow in place when they were the last thing allocated, otherwise they move.
+static void vector_grow(Vector *vec, int elem_size, int min_cap)
+{
+    int old_cap = vec->cap;
+    int new_cap = old_cap;
+
+    if (new_cap < 16)
+        new_cap = 16;
+    while (min_cap >= new_cap)
+        new_cap = (int)((float)new_cap * 1.7f) + 1;
+
+    STATS_ADD(vector_grows, 1);
+
+    if (vec->arena) {
+        if (!vec->buf || !arena_extend(vec->arena, vec->buf, (size_t)old_cap * elem_size, (size_t)new_cap * elem_size)) {
+            void *new_buf = arena_alloc(vec->arena, (size_t)new_cap * elem_size);
+            if (vec->buf) {
+                memcpy(new_buf, vec->buf, (size_t)old_cap * elem_size);
+                STATS_ADD(vector_copies, 1);
+                STATS_ADD(vector_copied_bytes, (size_t)old_cap * elem_size);
+            }
+            vec->buf = new_buf;
+        }
+    }
+    else {
+        // only the old address is kept, as an integer, so nothing reads the block realloc freed
+        uintptr_t old_addr = (uintptr_t)vec->buf;
+        void *new_buf = realloc(vec->buf, (size_t)new_cap * elem_size);
+
+        // realloc only copies if it couldn't grow the block where it was
+        if (old_addr && (uintptr_t)new_buf != old_addr) {
+            STATS_ADD(vector_copies, 1);
+            STATS_ADD(vector_copied_bytes, (size_t)old_cap * elem_size);
         }
         vec->buf = new_buf;
-        vec->cap = new_cap;
     }
 
+    vec->cap = new_cap;
+}
+
+// Makes room for at least count more elements, so that the next count adds don't move the buffer
+void vector_reserve(Vector *vec, int elem_size, int count)
+{
+    if (count <= 0)
+        return;
+
+    if (!vec->buf || vec->n + count >= vec->cap)
+        vector_grow(vec, elem_size, vec->n + count);
+}
+
+void *vector_add(Vector *vec, int elem_size, int count)
+{
+	if (count <= 0)
+		return NULL;
+
+	int new_size = vec->n + count;
+
+	if (!vec->buf || new_size >= vec->cap)
+		vector_grow(vec, elem_size, new_size);
+
 	char *ptr = &((char*)vec->buf)[vec->n * elem_size];
 	vec->n = new_size;
 	return (void*)ptr;
@@ -55,79 +194,278 @@ void vector_append_cstring(Vector *vec, const char *str)
 	memcpy(space, str, len);
 }
 
-void vector_append_utf8_html(Vector *vec, const char *str, int len)
+// Finds the first byte that can't be copied as-is: ASCII control characters other than
+//  tab and newline, DEL, the HTML specials &<>" and NUL. Bytes >= 0x80 are never escaped.
+static int scan_html_clean_scalar(const char *str, int len)
+{
+	int i = 0;
+	for (; i < len; i++) {
+		char c = str[i];
+		if ((c >= 0 && c < ' ' && c != '\n' && c != '\t') || c == 0x7f || c == '&' || c == '<' || c == '>' || c == '"')
+			break;
+	}
+	return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static int scan_html_clean_sse2(const char *str, int len)
+{
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+		__m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-1)), _mm_cmplt_epi8(v, _mm_set1_epi8(' ')));
+		ctrl = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))), ctrl);
+		__m128i special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')), _mm_cmpeq_epi8(v, _mm_set1_epi8('<'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))
+		);
+		special = _mm_or_si128(special, _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f))));
+
+		int mask = _mm_movemask_epi8(special);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + scan_html_clean_scalar(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int scan_html_clean_avx2(const char *str, int len)
+{
+	int i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+		__m256i ctrl = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(' ' - 1)), _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)));
+		ctrl = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))), ctrl);
+		__m256i special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')))
+		);
+		special = _mm256_or_si256(special, _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f))));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + scan_html_clean_sse2(str + i, len - i);
+}
+#endif
+
+static int (*scan_html_clean)(const char *str, int len) = NULL;
+
+static void scan_html_select(void)
+{
+	int (*func)(const char*, int) = scan_html_clean_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		func = scan_html_clean_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		func = scan_html_clean_sse2;
+#endif
+	__atomic_store_n(&scan_html_clean, func, __ATOMIC_RELEASE);
+}
+
+// Tracks how many more bytes belong to the current UTF-8 sequence, the same way as the
+//  byte-at-a-time escaper did: bytes inside a sequence are copied verbatim, whatever they are
+static int utf8_skip_state(const char *str, int start, int end, int utf8_left)
+{
+	for (int i = start; i < end; i++) {
+		char c = str[i];
+		if (utf8_left-- > 0)
+			continue;
+
+		if (c < 0) {
+			uint8_t b = c;
+			if ((b & 0xe0) == 0xc0) utf8_left = 1;
+			else if ((b & 0xf0) == 0xe0) utf8_left = 2;
+			else if ((b & 0xf8) == 0xf0) utf8_left = 3;
+		}
+		else {
+			utf8_left = 0;
+		}
+	}
+	return utf8_left;
+}
+
+// Escapes str into out, which must have room for len * 6 bytes, returning the number of bytes written.
+// utf8_left carries an unfinished UTF-8 sequence from one call to the next.
+// Stops at a NUL byte, which sets *stop.
+int html_escape(const char *str, int len, char *out, int *utf8_left, bool *stop)
+{
+	if (!__atomic_load_n(&scan_html_clean, __ATOMIC_ACQUIRE))
+		scan_html_select();
+
+	static const char hex[] = "0123456789abcdef";
+
+	char *op = out;
+	int left = *utf8_left;
+	int i = 0;
+
+	while (i < len) {
+		int run = scan_html_clean(str + i, len - i);
+		int end = i + run;
+
+		if (run > 0) {
+			memcpy(op, str + i, run);
+			op += run;
+
+			// a sequence can only still be open if one of the last 3 bytes is non-ASCII
+			if (run < 4 || ((str[end-1] | str[end-2] | str[end-3]) & 0x80))
+				left = utf8_skip_state(str, i, end, left);
+			else
+				left = 0;
+		}
+
+		if (end >= len)
+			break;
+
+		char c = str[end];
+		if (c == 0) {
+			*stop = true;
+			break;
+		}
+
+		if (left-- > 0) {
+			*op++ = c;
+		}
+		else {
+			left = 0;
+			op[0] = '&';
+			op[1] = '#';
+			op[2] = 'x';
+			op[3] = hex[(c >> 4) & 0xf];
+			op[4] = hex[c & 0xf];
+			op[5] = ';';
+			op += 6;
+		}
+
+		i = end + 1;
+	}
+
+	*utf8_left = left;
+	return (int)(op - out);
+}
+
+// Text is escaped a piece at a time, so that what's reserved for it stays small
+#define ESCAPE_PIECE (64 << 10)
+// A Vector counts in int, and grows by 1.7x at a time, so escaped text is kept under this
+#define ESCAPE_MAX   (1 << 30)
+
+// Returns false, having added nothing, if the escaped text might not fit
+bool vector_append_utf8_html(Vector *vec, const char *str, int64_t len)
 {
 	if (!str || len <= 0)
-		return;
+		return true;
 
-	char esc_c = 0;
-	bool done = false;
-	int esc_left = 0;
+	int start_n = vec->n;
 	int utf8_left = 0;
-	char *out;
-	const char *ip = str;
-
-	int to_copy = len;
-	int prev_copy = to_copy;
-
-	while (ip - str < len && to_copy > 0) {
-		out = vector_add(vec, 1, to_copy);
-
-		char *op = out;
-		while (op - out < prev_copy) {
-			if (esc_left > 0) {
-				if (esc_left == 6) *op++ = '&';
-				else if (esc_left == 5) *op++ = '#';
-				else if (esc_left == 4) *op++ = 'x';
-				else if (esc_left == 3) *op++ = "0123456789abcdef"[(esc_c >> 4) & 0xf];
-				else if (esc_left == 2) *op++ = "0123456789abcdef"[esc_c & 0xf];
-				else if (esc_left == 1) *op++ = ';';
-				esc_left--;
-				continue;
-			}
+	bool stop = false;
 
-			char c = *ip;
-			if (c == 0) {
-				done = true;
-				break;
-			}
+	while (len > 0 && !stop) {
+		int piece = len < ESCAPE_PIECE ? (int)len : ESCAPE_PIECE;
 
-			if (utf8_left-- > 0) {
-				*op++ = *ip++;
-			}
-			else if (c < 0) {
-				uint8_t b = c;
-				if ((b & 0xe0) == 0xc0) utf8_left = 1;
-				else if ((b & 0xf0) == 0xe0) utf8_left = 2;
-				else if ((b & 0xf8) == 0xf0) utf8_left = 3;
-				*op++ = *ip++;
-			}
-			else {
-				utf8_left = 0;
-				if ((c < ' ' && c != '\n' && c != '\t') || c > '~' || c == '&' || c == '<' || c == '>' || c == '"') {
-					esc_c = *ip++;
-					esc_left = 6;
-					to_copy += esc_left - 1;
-				}
-				else {
-					*op++ = *ip++;
-				}
-			}
+		// reserve for the worst case, where every byte becomes a 6-byte escape
+		if (vec->n > ESCAPE_MAX - piece * 6) {
+			vec->n = start_n;
+			return false;
 		}
+		int n = vec->n;
+		char *out = vector_add(vec, 1, piece * 6);
+		vec->n = n + html_escape(str, piece, out, &utf8_left, &stop);
 
-		to_copy -= prev_copy;
-		prev_copy = to_copy;
+		str += piece;
+		len -= piece;
 	}
+	return true;
 }
 
 void vector_free(Vector *vec)
 {
     if (vec->buf) {
-        free(vec->buf);
+        // arena memory is released all at once by arena_reset
+        if (!vec->arena)
+            free(vec->buf);
         vec->buf = NULL;
     }
 }
 
+// For qsort and bsearch over hashes
+int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Reads everything left in a stream that can't be sized or mapped up front (stdin, pipes, ttys).
+// With a parser, each piece is parsed as soon as it's in rather than once the stream ends.
+static char *read_stream(int fd, int64_t *size_out, Parser *parser)
+{
+	char *buf = NULL;
+	size_t cap = 0;
+	size_t n = 0;
+	while (true) {
+		if (cap - n < 4096) {
+			size_t new_cap = cap > 0 ? cap * 2 : 65536;
+			char *grown = realloc(buf, new_cap);
+			if (!grown) {
+				free(buf);
+				return NULL;
+			}
+			buf = grown;
+			cap = new_cap;
+		}
+
+		ssize_t got = read(fd, buf + n, cap - n - 1);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0) {
+			if (got < 0) {
+				free(buf);
+				return NULL;
+			}
+			break;
+		}
+		n += got;
+
+		if (parser)
+			parser_feed(parser, buf, n);
+	}
+
+	buf[n] = 0;
+	*size_out = n;
+	return buf;
+}
+
+// Maps a regular file read-only, followed by at least one zero byte.
+// The parser and escaper treat the buffer as NUL-terminated, so the file is mapped
+//  over the start of an anonymous reservation one page larger than the file.
+// Any tail of the file's last page reads as zero, as does the spare page if the file
+//  ends on a page boundary.
+static char *map_file(int fd, size_t sz, size_t *map_size_out)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t map_size = ((sz + page - 1) / page) * page + page;
+
+	char *base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if (mmap(base, sz, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, map_size);
+		return NULL;
+	}
+
+	// the advice values aren't flags, so each one is its own call
+	madvise(base, sz, MADV_SEQUENTIAL);
+	madvise(base, sz, MADV_WILLNEED);
+
+	*map_size_out = map_size;
+	return base;
+}
+
 File read_whole_file(char *path)
 {
 	File file = {0};
@@ -138,59 +476,309 @@ File read_whole_file(char *path)
 		return file;
 	}
 
+	if (path_len == 1 && path[0] == '-') {
+		int64_t sz = 0;
+		file.buf = read_stream(STDIN_FILENO, &sz, NULL);
+		if (!file.buf) {
+			printf("Could not read from stdin\n");
+			return file;
+		}
+		file.size = sz;
+		file.path = NULL;
+		file.name = STDIN_NAME;
+		return file;
+	}
+
 	if (path[path_len-1] == '/' || path[path_len-1] == '\\') {
 		path[path_len-1] = '\0';
 		path_len--;
 	}
 
-	FILE *f = fopen(path, "rb");
-	if (!f) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
 		printf("Could not find \"%s\"\n", path);
 		return file;
 	}
 
-	fseek(f, 0, SEEK_END);
-	int sz = ftell(f);
-	rewind(f);
-
-	if (sz < 0) {
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (S_ISREG(st.st_mode) && st.st_size < 0)) {
 		printf("Could not read from \"%s\"\n", path);
+		close(fd);
 		return file;
 	}
 
-	char *buf = malloc(sz + 1);
-	if (sz > 0) fread(buf, 1, sz, f);
-	buf[sz] = 0;
-	fclose(f);
+	char *buf = NULL;
+	int64_t sz = 0;
+
+	if (!S_ISREG(st.st_mode)) {
+		buf = read_stream(fd, &sz, NULL);
+	}
+	else {
+		sz = st.st_size;
+		if (sz >= MMAP_THRESHOLD)
+			buf = map_file(fd, sz, &file.map_size);
+
+		if (!buf) {
+			buf = malloc(sz + 1);
+			int64_t off = 0;
+			while (off < sz) {
+				ssize_t got = read(fd, buf + off, sz - off);
+				if (got < 0 && errno == EINTR)
+					continue;
+				if (got <= 0)
+					break;
+				off += got;
+			}
+			sz = off;
+			buf[sz] = 0;
+		}
+	}
+	close(fd);
+
+	if (!buf) {
+		printf("Could not read from \"%s\"\n", path);
+		return file;
+	}
 
 	file.buf = buf;
 	file.size = sz;
+	file_set_path(&file, path);
+
+	return file;
+}
+
+// Reads a source that can only be read front to back, ie. stdin ("-") or a pipe, parsing it as
+//  it comes in so that the parse is done soon after the stream ends rather than starting then.
+// Fills in source->file, whose buf is left NULL if the stream couldn't be read.
+// Memory isn't bounded: the whole text is kept, since docs refer to it by offset, and the page
+//  is only rendered once every source is in.
+void read_source_stream(char *path, Source *source)
+{
+	bool is_stdin = !strcmp(path, "-");
+	int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not find \"%s\"\n", path);
+		return;
+	}
+
+	Parser parser;
+	parser_begin(&parser, source);
+
+	int64_t sz = 0;
+	char *buf = read_stream(fd, &sz, &parser);
+	if (!is_stdin)
+		close(fd);
+
+	if (!buf) {
+		if (is_stdin)
+			printf("Could not read from stdin\n");
+		else
+			printf("Could not read from \"%s\"\n", path);
+		source->file.buf = NULL;
+		source->file.size = 0;
+		return;
+	}
+
+	source->file.buf = buf;
+	source->file.size = sz;
+	if (is_stdin) {
+		source->file.path = NULL;
+		source->file.name = STDIN_NAME;
+	}
+	else {
+		file_set_path(&source->file, path);
+	}
+
+	parser_finish(&parser);
+}
 
+// Splits path into the file's folder and name. The path is modified and is used by the file from then on.
+void file_set_path(File *file, char *path)
+{
 	char *last_slash = strrchr(path, '/');
 	if (!last_slash)
 		last_slash = strrchr(path, '\\');
 
 	if (last_slash) {
+		file->sep = *last_slash;
 		*last_slash = '\0';
-		file.path = path;
-		file.name = last_slash + 1;
+		file->path = path;
+		file->name = last_slash + 1;
 	}
 	else {
-		file.path = NULL;
-		file.name = path;
+		file->path = NULL;
+		file->name = path;
 	}
+}
 
-	return file;
+// Undoes file_set_path, so that the path it was given can be opened again
+void file_join_path(File *file)
+{
+	if (file->sep)
+		file->name[-1] = file->sep;
+	file->sep = 0;
 }
 
-void source_close(Source *s)
+void file_close(File *f)
 {
-	if (s->file.buf) {
-		free(s->file.buf);
-		s->file.buf = NULL;
+	if (!f->buf)
+		return;
+
+	if (f->borrowed)
+		;
+	else if (f->map_size > 0)
+		munmap(f->buf, f->map_size);
+	else
+		free(f->buf);
+
+	f->buf = NULL;
+	f->map_size = 0;
+	f->borrowed = false;
+}
+
+// exts is a comma-separated list of extensions (with or without the dot), or NULL to match anything
+bool extension_in_list(const char *name, const char *exts)
+{
+	if (!exts || !*exts)
+		return true;
+
+	const char *dot = strrchr(name, '.');
+	if (!dot)
+		return false;
+
+	dot++;
+	int ext_len = strlen(dot);
+
+	const char *p = exts;
+	while (*p) {
+		const char *comma = strchr(p, ',');
+		int len = comma ? comma - p : (int)strlen(p);
+
+		const char *ext = p;
+		if (len > 0 && *ext == '.') {
+			ext++;
+			len--;
+		}
+
+		if (len == ext_len && len > 0 && !memcmp(ext, dot, len))
+			return true;
+
+		if (!comma)
+			break;
+		p = comma + 1;
 	}
+	return false;
+}
+
+void doc_table_reserve(Doc_Table *t, int count)
+{
+	vector_reserve(&t->bits, sizeof(uint32_t), count);
+	vector_reserve(&t->parent, sizeof(int), count);
+	vector_reserve(&t->name, sizeof(Span), count);
+	vector_reserve(&t->main, sizeof(Tag), count);
+	vector_reserve(&t->detail, sizeof(Doc_Detail), count);
+}
 
-	vector_free(&s->docs);
+void doc_table_add(Doc_Table *t, const Doc *doc)
+{
+	*(uint32_t*)vector_add(&t->bits, sizeof(uint32_t), 1) = (doc->flags & DOC_FLAGS_MASK) | ((uint32_t)doc->access << DOC_ACCESS_SHIFT);
+	*(int*)vector_add(&t->parent, sizeof(int), 1) = doc->parent_doc;
+	*(Span*)vector_add(&t->name, sizeof(Span), 1) = doc->name;
+	*(Tag*)vector_add(&t->main, sizeof(Tag), 1) = doc->main;
+
+	Doc_Detail *detail = vector_add(&t->detail, sizeof(Doc_Detail), 1);
+	detail->ret = doc->ret;
+	detail->code_lineno = doc->code_lineno;
+	detail->first_desc_line = doc->first_desc_line;
+	detail->n_desc_lines = doc->n_desc_lines;
+	detail->first_tag = doc->first_tag;
+	detail->n_tags = doc->n_tags;
+
+	t->n++;
+}
+
+// Adds rows first and on of another table to the end of this one, as they are. Any doc
+//  numbers in them (parents, first tags and descs) are for the caller to rebase.
+void doc_table_append(Doc_Table *t, const Doc_Table *from, int first)
+{
+	int n = from->n - first;
+	if (n <= 0)
+		return;
+
+	vector_append_array(&t->bits, sizeof(uint32_t), (const uint32_t*)from->bits.buf + first, n);
+	vector_append_array(&t->parent, sizeof(int), (const int*)from->parent.buf + first, n);
+	vector_append_array(&t->name, sizeof(Span), (const Span*)from->name.buf + first, n);
+	vector_append_array(&t->main, sizeof(Tag), (const Tag*)from->main.buf + first, n);
+	vector_append_array(&t->detail, sizeof(Doc_Detail), (const Doc_Detail*)from->detail.buf + first, n);
+	t->n += n;
+}
+
+static void reorder_column(Vector *column, int elem_size, const int *order, int n, char *scratch)
+{
+	const char *from = column->buf;
+	for (int i = 0; i < n; i++)
+		memcpy(scratch + i * elem_size, from + order[i] * elem_size, elem_size);
+	memcpy(column->buf, scratch, n * elem_size);
+}
+
+// Moves every doc to where order says, ie. row i becomes what was row order[i].
+// Parents still hold the old row numbers, for the caller to map.
+void doc_table_reorder(Doc_Table *t, const int *order)
+{
+	if (t->n < 2)
+		return;
+
+	char *scratch = malloc(t->n * sizeof(Doc_Detail));
+	reorder_column(&t->bits, sizeof(uint32_t), order, t->n, scratch);
+	reorder_column(&t->parent, sizeof(int), order, t->n, scratch);
+	reorder_column(&t->name, sizeof(Span), order, t->n, scratch);
+	reorder_column(&t->main, sizeof(Tag), order, t->n, scratch);
+	reorder_column(&t->detail, sizeof(Doc_Detail), order, t->n, scratch);
+	free(scratch);
+}
+
+void doc_table_free(Doc_Table *t)
+{
+	vector_free(&t->bits);
+	vector_free(&t->parent);
+	vector_free(&t->name);
+	vector_free(&t->main);
+	vector_free(&t->detail);
+	t->n = 0;
+}
+
+// arena, if given, holds the source's tables and nothing else, so that they can go in one go
+void source_init(Source *s, Arena *arena)
+{
+	memset(s, 0, sizeof(Source));
+	s->package_name.start = s->package_name.end = -1;
+	s->class_name.start = s->class_name.end = -1;
+	s->extends_name.start = s->extends_name.end = -1;
+	s->arena = arena;
+	s->implements_names.arena = arena;
+	s->docs.bits.arena = arena;
+	s->docs.parent.arena = arena;
+	s->docs.name.arena = arena;
+	s->docs.main.arena = arena;
+	s->docs.detail.arena = arena;
+	s->tags.arena = arena;
+	s->descs.arena = arena;
+	for (int k = 0; k < N_DOC_KINDS; k++)
+		s->kinds[k].arena = arena;
+}
+
+void source_close(Source *s)
+{
+	file_close(&s->file);
+
+	vector_free(&s->implements_names);
+	doc_table_free(&s->docs);
 	vector_free(&s->tags);
 	vector_free(&s->descs);
+	for (int k = 0; k < N_DOC_KINDS; k++)
+		vector_free(&s->kinds[k]);
+
+	// including every copy left behind when an arena vector had to move to grow
+	if (s->arena)
+		arena_free(s->arena);
 }
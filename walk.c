@@ -0,0 +1,267 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Folders are listed in parallel on a pool of their own, ahead of the caller.
+// walk_next() hands out paths in a fixed depth-first order (entries sorted by name),
+//  waiting only when it reaches a folder that hasn't been listed yet, so the order
+//  doesn't depend on which folder a thread got to first.
+// File types come from getdents, so files are only ever stat'd when the file system
+//  doesn't report a type, or to find out what a symbolic link points to.
+
+#define WALK_DENTS_SIZE (32 * 1024)
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+typedef struct {
+	char *name;
+	int child; // index of the folder in Walk.dirs, or -1 for a file
+} Walk_Entry;
+
+typedef struct {
+	char *path;
+	Vector names;
+	Vector entries;
+	bool listed;
+} Walk_Dir;
+
+typedef struct {
+	int dir;
+	int next_entry;
+} Walk_Cursor;
+
+struct Walk {
+	Pool *pool;
+	char *exts;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	Vector dirs; // Walk_Dir*
+
+	Vector stack; // Walk_Cursor, only touched by the caller of walk_next
+};
+
+static Walk_Dir *walk_get_dir(Walk *walk, int idx)
+{
+	pthread_mutex_lock(&walk->lock);
+	Walk_Dir *dir = ((Walk_Dir**)walk->dirs.buf)[idx];
+	pthread_mutex_unlock(&walk->lock);
+	return dir;
+}
+
+static int walk_add_dir(Walk *walk, char *path)
+{
+	Walk_Dir *dir = calloc(1, sizeof(Walk_Dir));
+	dir->path = path;
+
+	pthread_mutex_lock(&walk->lock);
+	int idx = walk->dirs.n;
+	*(Walk_Dir**)vector_add(&walk->dirs, sizeof(Walk_Dir*), 1) = dir;
+	pthread_mutex_unlock(&walk->lock);
+
+	return idx;
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+	int dir_len = strlen(dir);
+	int name_len = strlen(name);
+
+	char *path = malloc(dir_len + name_len + 2);
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
+}
+
+static int compare_entry_name(const void *a, const void *b)
+{
+	return strcmp(((const Walk_Entry*)a)->name, ((const Walk_Entry*)b)->name);
+}
+
+static void walk_list_dir(void *data, int job, int worker)
+{
+	(void)worker;
+	Walk *walk = data;
+	Walk_Dir *dir = walk_get_dir(walk, job);
+
+	int fd = openat(AT_FDCWD, dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	// Names are packed into one buffer behind a type byte, since the buffer may move as it grows
+	Vector offsets = {0};
+	char dents[WALK_DENTS_SIZE];
+
+	while (fd >= 0) {
+		long got = syscall(SYS_getdents64, fd, dents, sizeof(dents));
+		if (got <= 0)
+			break;
+
+		for (long off = 0; off < got;) {
+			struct linux_dirent64 *d = (struct linux_dirent64*)(dents + off);
+			off += d->d_reclen;
+
+			// hidden files and folders (.git, .gradle, ...) are never sources
+			if (d->d_name[0] == '.')
+				continue;
+
+			unsigned char type = d->d_type;
+			if (type == DT_UNKNOWN || type == DT_LNK) {
+				struct stat st;
+				if (fstatat(fd, d->d_name, &st, 0) != 0)
+					continue;
+
+				// links to folders are not followed, so that the walk can't loop
+				if (S_ISREG(st.st_mode))
+					type = DT_REG;
+				else if (S_ISDIR(st.st_mode) && d->d_type == DT_UNKNOWN)
+					type = DT_DIR;
+				else
+					continue;
+			}
+
+			if (type == DT_REG) {
+				if (!extension_in_list(d->d_name, walk->exts))
+					continue;
+			}
+			else if (type != DT_DIR) {
+				continue;
+			}
+
+			*(int*)vector_add(&offsets, sizeof(int), 1) = dir->names.n;
+			*(char*)vector_add(&dir->names, 1, 1) = (char)type;
+			vector_append_cstring(&dir->names, d->d_name);
+			*(char*)vector_add(&dir->names, 1, 1) = '\0';
+		}
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	Walk_Entry *entries = vector_add(&dir->entries, sizeof(Walk_Entry), offsets.n);
+	for (int i = 0; i < offsets.n; i++) {
+		char *p = (char*)dir->names.buf + ((int*)offsets.buf)[i];
+		entries[i].name = p + 1;
+		entries[i].child = *p == (char)DT_DIR ? -2 : -1;
+	}
+	vector_free(&offsets);
+
+	if (dir->entries.n > 1)
+		qsort(dir->entries.buf, dir->entries.n, sizeof(Walk_Entry), compare_entry_name);
+
+	for (int i = 0; i < dir->entries.n; i++) {
+		Walk_Entry *e = &((Walk_Entry*)dir->entries.buf)[i];
+		if (e->child == -2)
+			e->child = walk_add_dir(walk, join_path(dir->path, e->name));
+	}
+
+	pthread_mutex_lock(&walk->lock);
+	dir->listed = true;
+	pthread_cond_broadcast(&walk->cond);
+	pthread_mutex_unlock(&walk->lock);
+
+	// queue the sub-folders once this folder is complete, in case they run on this thread
+	for (int i = 0; i < dir->entries.n; i++) {
+		Walk_Entry *e = &((Walk_Entry*)dir->entries.buf)[i];
+		if (e->child >= 0)
+			pool_submit(walk->pool, e->child);
+	}
+}
+
+// exts is a comma-separated list of file extensions to keep, or NULL to keep every file
+Walk *walk_start(const char *folder, const char *exts, int n_workers)
+{
+	Walk *walk = calloc(1, sizeof(Walk));
+	pthread_mutex_init(&walk->lock, NULL);
+	pthread_cond_init(&walk->cond, NULL);
+
+	if (exts) {
+		int len = strlen(exts);
+		walk->exts = malloc(len + 1);
+		memcpy(walk->exts, exts, len + 1);
+	}
+
+	int len = strlen(folder);
+	while (len > 1 && folder[len-1] == '/')
+		len--;
+
+	char *root = malloc(len + 1);
+	memcpy(root, folder, len);
+	root[len] = '\0';
+
+	int root_idx = walk_add_dir(walk, root);
+	Walk_Cursor *cur = vector_add(&walk->stack, sizeof(Walk_Cursor), 1);
+	cur->dir = root_idx;
+	cur->next_entry = 0;
+
+	walk->pool = pool_create(n_workers, walk_list_dir, walk);
+	pool_submit(walk->pool, root_idx);
+
+	return walk;
+}
+
+// Returns the next source file under the folder (to be freed by the caller), or NULL once there are none left
+char *walk_next(Walk *walk)
+{
+	while (walk->stack.n > 0) {
+		Walk_Cursor *cur = &((Walk_Cursor*)walk->stack.buf)[walk->stack.n - 1];
+		Walk_Dir *dir = walk_get_dir(walk, cur->dir);
+
+		pthread_mutex_lock(&walk->lock);
+		while (!dir->listed)
+			pthread_cond_wait(&walk->cond, &walk->lock);
+		pthread_mutex_unlock(&walk->lock);
+
+		if (cur->next_entry >= dir->entries.n) {
+			walk->stack.n--;
+			continue;
+		}
+
+		Walk_Entry *e = &((Walk_Entry*)dir->entries.buf)[cur->next_entry++];
+		if (e->child >= 0) {
+			Walk_Cursor *sub = vector_add(&walk->stack, sizeof(Walk_Cursor), 1);
+			sub->dir = e->child;
+			sub->next_entry = 0;
+			continue;
+		}
+
+		return join_path(dir->path, e->name);
+	}
+
+	return NULL;
+}
+
+void walk_finish(Walk *walk)
+{
+	pool_finish(walk->pool);
+
+	Walk_Dir **dirs = walk->dirs.buf;
+	for (int i = 0; i < walk->dirs.n; i++) {
+		free(dirs[i]->path);
+		vector_free(&dirs[i]->names);
+		vector_free(&dirs[i]->entries);
+		free(dirs[i]);
+	}
+
+	vector_free(&walk->dirs);
+	vector_free(&walk->stack);
+	free(walk->exts);
+
+	pthread_mutex_destroy(&walk->lock);
+	pthread_cond_destroy(&walk->cond);
+	free(walk);
+}
@@ -0,0 +1,292 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+// Tells --watch which sources changed. Every folder of an input tree gets an inotify watch,
+//  and so does the folder of each single source. After the first event, events are gathered
+//  until none have come for WATCH_SETTLE_MS, so that an editor saving a file in several steps
+//  (write to a new file, rename it over the old one, touch a backup...) is a single change.
+
+#define WATCH_SETTLE_MS 40
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_ONLYDIR)
+
+typedef struct {
+	int wd;
+	char *path;
+	int root; // the input folder this is in, or -1 for the folder of single sources
+} Watch_Dir;
+
+struct Watch {
+	int fd;
+	const char *exts;
+	Vector dirs;  // Watch_Dir
+	Vector files; // char*, single sources, which are the only files looked at in their folders
+};
+
+Watch *watch_open(const char *exts)
+{
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	Watch *w = calloc(1, sizeof(Watch));
+	w->fd = fd;
+	w->exts = exts;
+	return w;
+}
+
+void watch_close(Watch *w)
+{
+	if (!w)
+		return;
+
+	Watch_Dir *dirs = w->dirs.buf;
+	for (int i = 0; i < w->dirs.n; i++)
+		free(dirs[i].path);
+	char **files = w->files.buf;
+	for (int i = 0; i < w->files.n; i++)
+		free(files[i]);
+
+	vector_free(&w->dirs);
+	vector_free(&w->files);
+	close(w->fd);
+	free(w);
+}
+
+static Watch_Dir *watch_find_dir(Watch *w, int wd)
+{
+	Watch_Dir *dirs = w->dirs.buf;
+	for (int i = 0; i < w->dirs.n; i++) {
+		if (dirs[i].wd == wd)
+			return &dirs[i];
+	}
+	return NULL;
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+	int dir_len = strlen(dir);
+	int name_len = strlen(name);
+	char *path = malloc(dir_len + name_len + 2);
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
+}
+
+static void watch_note(Vector *events, char *path, int root, bool removed, bool is_dir)
+{
+	Watch_Event *ev = events->buf;
+	for (int i = 0; i < events->n; i++) {
+		if (ev[i].path && path && !strcmp(ev[i].path, path)) {
+			ev[i].removed = removed;
+			ev[i].is_dir = is_dir;
+			free(path);
+			return;
+		}
+	}
+
+	Watch_Event *e = vector_add(events, sizeof(Watch_Event), 1);
+	e->path = path;
+	e->root = root;
+	e->removed = removed;
+	e->is_dir = is_dir;
+}
+
+static bool watch_add_dir(Watch *w, const char *path, int root)
+{
+	int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+	if (wd < 0)
+		return false;
+
+	// a folder that's both an input folder and the folder of a single source keeps its first role
+	if (watch_find_dir(w, wd))
+		return true;
+
+	Watch_Dir *d = vector_add(&w->dirs, sizeof(Watch_Dir), 1);
+	d->wd = wd;
+	d->path = strdup(path);
+	d->root = root;
+	return true;
+}
+
+// Watches a folder and every folder under it, except hidden ones, like the walk that found
+//  the sources. If events is given, every source found is noted in it as changed, for a
+//  folder that was only just created or moved in.
+static bool watch_add_tree_noting(Watch *w, const char *folder, int root, Vector *events)
+{
+	if (!watch_add_dir(w, folder, root))
+		return false;
+
+	DIR *dir = opendir(folder);
+	if (!dir)
+		return true;
+
+	struct dirent *d;
+	while ((d = readdir(dir))) {
+		if (d->d_name[0] == '.')
+			continue;
+
+		char *path = join_path(folder, d->d_name);
+		struct stat st;
+		if (lstat(path, &st) != 0) {
+			free(path);
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			watch_add_tree_noting(w, path, root, events);
+			free(path);
+		}
+		else if (events && S_ISREG(st.st_mode) && extension_in_list(d->d_name, w->exts)) {
+			watch_note(events, path, root, false, false);
+		}
+		else {
+			free(path);
+		}
+	}
+
+	closedir(dir);
+	return true;
+}
+
+bool watch_add_tree(Watch *w, const char *folder, int root)
+{
+	return watch_add_tree_noting(w, folder, root, NULL);
+}
+
+// Watches a single source, through its folder
+bool watch_add_file(Watch *w, const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+
+	bool ok = watch_add_dir(w, dir, -1);
+	free(dir);
+
+	if (ok)
+		*(char**)vector_add(&w->files, sizeof(char*), 1) = strdup(path);
+	return ok;
+}
+
+static bool watch_is_file(Watch *w, const char *path)
+{
+	char **files = w->files.buf;
+	for (int i = 0; i < w->files.n; i++) {
+		// single sources may have been given as "./Foo.java" or as "Foo.java"
+		const char *a = files[i];
+		const char *b = path;
+		if (a[0] == '.' && a[1] == '/')
+			a += 2;
+		if (b[0] == '.' && b[1] == '/')
+			b += 2;
+		if (!strcmp(a, b))
+			return true;
+	}
+	return false;
+}
+
+static void watch_handle(Watch *w, const struct inotify_event *ev, Vector *events)
+{
+	if (ev->mask & IN_Q_OVERFLOW) {
+		// events were lost, so anything could have changed
+		watch_note(events, NULL, -1, false, false);
+		return;
+	}
+
+	Watch_Dir *dir = watch_find_dir(w, ev->wd);
+	if (!dir)
+		return;
+
+	if (ev->mask & (IN_IGNORED | IN_DELETE_SELF)) {
+		// the folder is gone; what was in it is reported by its parent
+		if (ev->mask & IN_IGNORED) {
+			free(dir->path);
+			*dir = ((Watch_Dir*)w->dirs.buf)[--w->dirs.n];
+		}
+		return;
+	}
+
+	if (ev->len == 0 || ev->name[0] == '.')
+		return;
+
+	int root = dir->root;
+	char *path = join_path(dir->path, ev->name);
+	bool removed = (ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+
+	if (ev->mask & IN_ISDIR) {
+		if (root < 0) {
+			free(path);
+		}
+		else if (removed) {
+			watch_note(events, path, root, true, true);
+		}
+		else {
+			watch_add_tree_noting(w, path, root, events);
+			free(path);
+		}
+		return;
+	}
+
+	// a new file is only interesting once it's been written and closed
+	if (ev->mask & IN_CREATE) {
+		free(path);
+		return;
+	}
+
+	bool wanted = root >= 0 ? extension_in_list(ev->name, w->exts) : watch_is_file(w, path);
+	if (wanted)
+		watch_note(events, path, root, removed, false);
+	else
+		free(path);
+}
+
+// Waits until sources change, then until they've stopped changing for a moment, and fills
+//  events with what happened to each one. The paths in events belong to the caller.
+// Returns the number of events, or -1 if the watch stopped working.
+int watch_wait(Watch *w, Vector *events)
+{
+	char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	events->n = 0;
+
+	bool settling = false;
+	while (true) {
+		struct pollfd pfd = { w->fd, POLLIN, 0 };
+		int ret = poll(&pfd, 1, settling ? WATCH_SETTLE_MS : -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (ret == 0) {
+			if (events->n > 0)
+				return events->n;
+			settling = false;
+			continue;
+		}
+
+		ssize_t got = read(w->fd, buf, sizeof(buf));
+		if (got < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+
+		for (char *p = buf; p < buf + got; ) {
+			const struct inotify_event *ev = (const struct inotify_event*)p;
+			watch_handle(w, ev, events);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+		settling = true;
+	}
+}
@@ -0,0 +1,620 @@
+#include "docs-generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Reads source files out of a ZIP archive (or JAR) without unpacking it.
+// The archive is read with read_whole_file, so anything large is memory-mapped.
+// Only the central directory is parsed up front. Entries are read by zip_read_entry,
+//  which runs on the worker that renders the page, so deflated entries are inflated in
+//  parallel, and stored entries are handed to the parser as a pointer into the archive.
+
+#define ZIP_LOCAL_SIG       0x04034b50
+#define ZIP_CENTRAL_SIG     0x02014b50
+#define ZIP_END_SIG         0x06054b50
+#define ZIP64_END_SIG       0x06064b50
+#define ZIP64_LOCATOR_SIG   0x07064b50
+
+#define ZIP_LOCAL_SIZE      30
+#define ZIP_CENTRAL_SIZE    46
+#define ZIP_END_SIZE        22
+#define ZIP64_END_SIZE      56
+#define ZIP64_LOCATOR_SIZE  20
+
+#define ZIP_METHOD_STORED   0
+#define ZIP_METHOD_DEFLATED 8
+
+#define ZIP_FLAG_ENCRYPTED  1
+
+typedef struct {
+	int path;  // offsets into Zip.names, as the buffer moves while it's filled
+	int name;
+	uint64_t local_offset;
+	uint64_t comp_size;
+	uint64_t size;
+	uint32_t crc;
+	int method;
+} Zip_Entry;
+
+struct Zip {
+	File archive;
+	char *archive_path;
+	Vector entries;
+	Vector names;
+};
+
+static uint16_t rd16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t rd64(const uint8_t *p)
+{
+	return rd32(p) | ((uint64_t)rd32(p + 4) << 32);
+}
+
+// The end record is at the very end, unless the archive has a comment (of up to 64 KB)
+static const uint8_t *zip_find_end(const uint8_t *buf, size_t size)
+{
+	if (size < ZIP_END_SIZE)
+		return NULL;
+
+	size_t lowest = size > ZIP_END_SIZE + 0xffff ? size - ZIP_END_SIZE - 0xffff : 0;
+	for (size_t off = size - ZIP_END_SIZE + 1; off-- > lowest;) {
+		if (rd32(buf + off) == ZIP_END_SIG && off + ZIP_END_SIZE + rd16(buf + off + 20) <= size)
+			return buf + off;
+	}
+	return NULL;
+}
+
+// Sizes and offsets that don't fit in 32 bits are moved to an extra field, in this order
+static void zip64_extra(const uint8_t *extra, int len, Zip_Entry *e, bool big_size, bool big_comp, bool big_offset)
+{
+	for (int off = 0; off + 4 <= len;) {
+		int id = rd16(extra + off);
+		int field_len = rd16(extra + off + 2);
+		const uint8_t *p = extra + off + 4;
+		const uint8_t *end = p + field_len;
+		off += 4 + field_len;
+
+		if (id != 0x0001 || off > len)
+			continue;
+
+		if (big_size && p + 8 <= end)     { e->size = rd64(p); p += 8; }
+		if (big_comp && p + 8 <= end)     { e->comp_size = rd64(p); p += 8; }
+		if (big_offset && p + 8 <= end)   { e->local_offset = rd64(p); p += 8; }
+		break;
+	}
+}
+
+static bool zip_read_directory(Zip *zip, const char *exts)
+{
+	const uint8_t *buf = (const uint8_t*)zip->archive.buf;
+	size_t size = zip->archive.size;
+
+	const uint8_t *end = zip_find_end(buf, size);
+	if (!end)
+		return false;
+
+	uint64_t n_entries = rd16(end + 10);
+	uint64_t dir_size = rd32(end + 12);
+	uint64_t dir_offset = rd32(end + 16);
+
+	size_t end_off = end - buf;
+	if (end_off >= ZIP64_LOCATOR_SIZE && rd32(end - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIG) {
+		uint64_t end64_off = rd64(end - ZIP64_LOCATOR_SIZE + 8);
+		if (end64_off + ZIP64_END_SIZE <= size && rd32(buf + end64_off) == ZIP64_END_SIG) {
+			n_entries = rd64(buf + end64_off + 32);
+			dir_size = rd64(buf + end64_off + 40);
+			dir_offset = rd64(buf + end64_off + 48);
+		}
+	}
+
+	if (dir_offset > size || dir_size > size - dir_offset)
+		return false;
+
+	const uint8_t *p = buf + dir_offset;
+	const uint8_t *dir_end = p + dir_size;
+
+	vector_reserve(&zip->entries, sizeof(Zip_Entry), n_entries < 0x100000 ? (int)n_entries : 0x100000);
+
+	for (uint64_t i = 0; i < n_entries; i++) {
+		if (dir_end - p < ZIP_CENTRAL_SIZE || rd32(p) != ZIP_CENTRAL_SIG)
+			return false;
+
+		int flags = rd16(p + 8);
+		int name_len = rd16(p + 28);
+		int extra_len = rd16(p + 30);
+		int comment_len = rd16(p + 32);
+
+		const uint8_t *name = p + ZIP_CENTRAL_SIZE;
+		const uint8_t *extra = name + name_len;
+		const uint8_t *next = extra + extra_len + comment_len;
+		if (next > dir_end)
+			return false;
+
+		Zip_Entry e = {0};
+		e.method = rd16(p + 10);
+		e.crc = rd32(p + 16);
+		e.comp_size = rd32(p + 20);
+		e.size = rd32(p + 24);
+		e.local_offset = rd32(p + 42);
+
+		zip64_extra(extra, extra_len, &e, e.size == 0xffffffff, e.comp_size == 0xffffffff, e.local_offset == 0xffffffff);
+		p = next;
+
+		// folders end with a slash, and only files with the right extension are sources
+		if (name_len == 0 || name[name_len-1] == '/')
+			continue;
+
+		char path[1024];
+		if (name_len >= (int)sizeof(path))
+			continue;
+
+		memcpy(path, name, name_len);
+		path[name_len] = '\0';
+
+		if (!extension_in_list(path, exts))
+			continue;
+
+		if ((flags & ZIP_FLAG_ENCRYPTED) || (e.method != ZIP_METHOD_STORED && e.method != ZIP_METHOD_DEFLATED)) {
+			printf("Could not read \"%s\" from \"%s\" (unsupported compression)\n", path, zip->archive_path);
+			continue;
+		}
+
+		if (e.size >= INT32_MAX || e.local_offset > size) {
+			printf("Could not read \"%s\" from \"%s\" (too large)\n", path, zip->archive_path);
+			continue;
+		}
+
+		// split into folder and name the same way read_whole_file does
+		char *last_slash = strrchr(path, '/');
+		if (last_slash) {
+			*last_slash = '\0';
+			e.path = zip->names.n;
+			vector_append_cstring(&zip->names, path);
+			*(char*)vector_add(&zip->names, 1, 1) = '\0';
+			e.name = zip->names.n;
+			vector_append_cstring(&zip->names, last_slash + 1);
+		}
+		else {
+			e.path = -1;
+			e.name = zip->names.n;
+			vector_append_cstring(&zip->names, path);
+		}
+		*(char*)vector_add(&zip->names, 1, 1) = '\0';
+
+		*(Zip_Entry*)vector_add(&zip->entries, sizeof(Zip_Entry), 1) = e;
+	}
+
+	return true;
+}
+
+// exts is a comma-separated list of file extensions to keep, or NULL to keep every file
+Zip *zip_open(const char *path, const char *exts)
+{
+	Zip *zip = calloc(1, sizeof(Zip));
+
+	// read_whole_file takes the folder off the path it's given
+	int len = strlen(path);
+	char *path_copy = malloc(len + 1);
+	memcpy(path_copy, path, len + 1);
+
+	zip->archive_path = malloc(len + 1);
+	memcpy(zip->archive_path, path, len + 1);
+
+	zip->archive = read_whole_file(path_copy);
+	if (!zip->archive.buf) {
+		free(path_copy);
+		zip_close(zip);
+		return NULL;
+	}
+
+	// the archive's name and path point into path_copy
+	zip->archive.name = NULL;
+	zip->archive.path = NULL;
+	free(path_copy);
+
+	if (!zip_read_directory(zip, exts)) {
+		printf("Could not read \"%s\" as a ZIP archive\n", path);
+		zip_close(zip);
+		return NULL;
+	}
+
+	return zip;
+}
+
+int zip_n_entries(Zip *zip)
+{
+	return zip->entries.n;
+}
+
+long zip_entry_size(Zip *zip, int idx)
+{
+	return (long)((Zip_Entry*)zip->entries.buf)[idx].size;
+}
+
+// The entry's full path inside the archive, to be freed by the caller
+char *zip_entry_path(Zip *zip, int idx)
+{
+	Zip_Entry *e = &((Zip_Entry*)zip->entries.buf)[idx];
+	char *names = zip->names.buf;
+	const char *name = &names[e->name];
+
+	Vector path = {0};
+	if (e->path >= 0) {
+		vector_append_cstring(&path, &names[e->path]);
+		*(char*)vector_add(&path, 1, 1) = '/';
+	}
+	vector_append_cstring(&path, name);
+	*(char*)vector_add(&path, 1, 1) = '\0';
+	return path.buf;
+}
+
+static bool zip_inflate(const uint8_t *in, uint64_t in_size, char *out, uint64_t out_size)
+{
+	z_stream zs = {0};
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+		return false;
+
+	int ret = Z_OK;
+	uint64_t in_left = in_size;
+	uint64_t out_left = out_size;
+	zs.next_in = (Bytef*)in;
+	zs.next_out = (Bytef*)out;
+
+	// avail_in and avail_out are 32-bit, so feed the input in pieces
+	while (ret == Z_OK) {
+		if (zs.avail_in == 0) {
+			uInt piece = in_left < 0x40000000 ? (uInt)in_left : 0x40000000;
+			zs.avail_in = piece;
+			in_left -= piece;
+		}
+		if (zs.avail_out == 0) {
+			uInt piece = out_left < 0x40000000 ? (uInt)out_left : 0x40000000;
+			zs.avail_out = piece;
+			out_left -= piece;
+		}
+
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret == Z_BUF_ERROR && zs.avail_in == 0 && in_left == 0)
+			break;
+	}
+
+	bool ok = ret == Z_STREAM_END && zs.total_out == out_size;
+	inflateEnd(&zs);
+	return ok;
+}
+
+// Safe to call from any thread. Stored entries point into the archive and are left alone by file_close.
+File zip_read_entry(Zip *zip, int idx)
+{
+	File file = {0};
+	Zip_Entry *e = &((Zip_Entry*)zip->entries.buf)[idx];
+
+	char *names = zip->names.buf;
+	file.path = e->path >= 0 ? &names[e->path] : NULL;
+	file.name = &names[e->name];
+
+	const uint8_t *buf = (const uint8_t*)zip->archive.buf;
+	size_t size = zip->archive.size;
+	const uint8_t *data = NULL;
+
+	uint64_t off = e->local_offset;
+	if (off + ZIP_LOCAL_SIZE <= size && rd32(buf + off) == ZIP_LOCAL_SIG) {
+		uint64_t data_off = off + ZIP_LOCAL_SIZE + rd16(buf + off + 26) + rd16(buf + off + 28);
+		if (data_off <= size && e->comp_size <= size - data_off)
+			data = buf + data_off;
+	}
+
+	if (data && e->method == ZIP_METHOD_STORED && e->comp_size == e->size) {
+		if (crc32(0, data, (uInt)e->size) == e->crc) {
+			file.buf = (char*)data;
+			file.size = (int)e->size;
+			file.borrowed = true;
+			return file;
+		}
+	}
+	else if (data && e->method == ZIP_METHOD_DEFLATED) {
+		char *out = malloc(e->size + 1);
+		if (zip_inflate(data, e->comp_size, out, e->size) && crc32(0, (Bytef*)out, (uInt)e->size) == e->crc) {
+			out[e->size] = 0;
+			file.buf = out;
+			file.size = (int)e->size;
+			return file;
+		}
+		free(out);
+	}
+
+	if (file.path)
+		printf("Could not read \"%s/%s\" from \"%s\"\n", file.path, file.name, zip->archive_path);
+	else
+		printf("Could not read \"%s\" from \"%s\"\n", file.name, zip->archive_path);
+
+	file.path = NULL;
+	file.name = NULL;
+	return file;
+}
+
+void zip_close(Zip *zip)
+{
+	if (!zip)
+		return;
+
+	file_close(&zip->archive);
+	vector_free(&zip->entries);
+	vector_free(&zip->names);
+	free(zip->archive_path);
+	free(zip);
+}
+
+// Writing. Pages are compressed by their sinks (see sink_deflate) on the worker that renders them,
+//  and land in the archive in page order, so the writer only adds the headers around them.
+// Entry sizes aren't known when a page starts going out, so each entry ends with a data descriptor.
+
+#define ZIP_DESCRIPTOR_SIG      0x08074b50
+#define ZIP_FLAG_DESCRIPTOR     8
+#define ZIP_FLAG_UTF8           0x800
+#define ZIP_VERSION             20
+#define ZIP64_VERSION           45
+
+// A fixed timestamp (1980-01-01 00:00), so that the same input always gives the same archive
+#define ZIP_DOS_TIME            0
+#define ZIP_DOS_DATE            ((0 << 9) | (1 << 5) | 1)
+
+typedef struct {
+	int name;
+	int name_len;
+	int method;
+	uint32_t crc;
+	uint64_t comp_size;
+	uint64_t size;
+	uint64_t local_offset;
+} Zip_Out_Entry;
+
+struct Zip_Writer {
+	int fd;
+	bool owns_fd;
+	bool failed;
+	uint64_t offset;
+	Vector entries;
+	Vector names;
+	bool in_entry;
+};
+
+static void wr16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void wr64(uint8_t *p, uint64_t v)
+{
+	wr32(p, (uint32_t)v);
+	wr32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void zip_write(Zip_Writer *zw, const void *data, size_t len)
+{
+	const char *p = data;
+	zw->offset += len;
+
+	while (len > 0) {
+		ssize_t wrote = write(zw->fd, p, len);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0) {
+			zw->failed = true;
+			return;
+		}
+		p += wrote;
+		len -= wrote;
+	}
+}
+
+// "-" writes the archive to stdout
+Zip_Writer *zip_writer_open(const char *path)
+{
+	int fd = STDOUT_FILENO;
+	if (strcmp(path, "-") != 0) {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			printf("Could not create \"%s\"\n", path);
+			return NULL;
+		}
+	}
+
+	Zip_Writer *zw = calloc(1, sizeof(Zip_Writer));
+	zw->fd = fd;
+	zw->owns_fd = fd != STDOUT_FILENO;
+	return zw;
+}
+
+int zip_writer_fd(Zip_Writer *zw)
+{
+	return zw->fd;
+}
+
+static Zip_Out_Entry *zip_writer_add_entry(Zip_Writer *zw, const char *name, int method)
+{
+	Zip_Out_Entry *e = vector_add(&zw->entries, sizeof(Zip_Out_Entry), 1);
+	memset(e, 0, sizeof(Zip_Out_Entry));
+
+	e->name_len = strlen(name);
+	e->name = zw->names.n;
+	vector_append_array(&zw->names, 1, name, e->name_len);
+
+	e->method = method;
+	e->local_offset = zw->offset;
+	return e;
+}
+
+static void zip_write_local_header(Zip_Writer *zw, Zip_Out_Entry *e, int flags)
+{
+	uint8_t hdr[ZIP_LOCAL_SIZE];
+	wr32(hdr, ZIP_LOCAL_SIG);
+	wr16(hdr + 4, ZIP_VERSION);
+	wr16(hdr + 6, flags);
+	wr16(hdr + 8, e->method);
+	wr16(hdr + 10, ZIP_DOS_TIME);
+	wr16(hdr + 12, ZIP_DOS_DATE);
+	wr32(hdr + 14, e->crc);
+	wr32(hdr + 18, (uint32_t)e->comp_size);
+	wr32(hdr + 22, (uint32_t)e->size);
+	wr16(hdr + 26, e->name_len);
+	wr16(hdr + 28, 0);
+
+	zip_write(zw, hdr, sizeof(hdr));
+	zip_write(zw, (char*)zw->names.buf + e->name, e->name_len);
+}
+
+// Starts a deflated entry whose data is then written straight to zip_writer_fd()
+void zip_writer_begin(Zip_Writer *zw, const char *name)
+{
+	Zip_Out_Entry *e = zip_writer_add_entry(zw, name, ZIP_METHOD_DEFLATED);
+	zip_write_local_header(zw, e, ZIP_FLAG_DESCRIPTOR | ZIP_FLAG_UTF8);
+	zw->in_entry = true;
+}
+
+void zip_writer_end(Zip_Writer *zw, uint32_t crc, uint64_t comp_size, uint64_t size)
+{
+	if (!zw->in_entry)
+		return;
+
+	Zip_Out_Entry *e = &((Zip_Out_Entry*)zw->entries.buf)[zw->entries.n - 1];
+	e->crc = crc;
+	e->comp_size = comp_size;
+	e->size = size;
+	zw->offset += comp_size;
+	zw->in_entry = false;
+
+	// pages are never near 4 GB, so the descriptor always has 32-bit sizes
+	uint8_t desc[16];
+	wr32(desc, ZIP_DESCRIPTOR_SIG);
+	wr32(desc + 4, crc);
+	wr32(desc + 8, (uint32_t)comp_size);
+	wr32(desc + 12, (uint32_t)size);
+	zip_write(zw, desc, sizeof(desc));
+}
+
+// Adds a whole entry that's already in memory, uncompressed
+void zip_writer_add(Zip_Writer *zw, const char *name, const void *data, int len)
+{
+	Zip_Out_Entry *e = zip_writer_add_entry(zw, name, ZIP_METHOD_STORED);
+	e->crc = crc32(0, data, len);
+	e->comp_size = len;
+	e->size = len;
+
+	zip_write_local_header(zw, e, ZIP_FLAG_UTF8);
+	zip_write(zw, data, len);
+}
+
+// Writes the central directory, switching to ZIP64 records if there are too many entries
+//  or the archive has grown past 4 GB. Returns false if anything failed to write.
+bool zip_writer_close(Zip_Writer *zw)
+{
+	uint64_t dir_offset = zw->offset;
+	Zip_Out_Entry *entries = zw->entries.buf;
+
+	for (int i = 0; i < zw->entries.n; i++) {
+		Zip_Out_Entry *e = &entries[i];
+		bool big_offset = e->local_offset >= 0xffffffff;
+		int flags = ZIP_FLAG_UTF8 | (e->method == ZIP_METHOD_DEFLATED ? ZIP_FLAG_DESCRIPTOR : 0);
+
+		uint8_t hdr[ZIP_CENTRAL_SIZE];
+		wr32(hdr, ZIP_CENTRAL_SIG);
+		wr16(hdr + 4, (3 << 8) | (big_offset ? ZIP64_VERSION : ZIP_VERSION)); // made on Unix
+		wr16(hdr + 6, big_offset ? ZIP64_VERSION : ZIP_VERSION);
+		wr16(hdr + 8, flags);
+		wr16(hdr + 10, e->method);
+		wr16(hdr + 12, ZIP_DOS_TIME);
+		wr16(hdr + 14, ZIP_DOS_DATE);
+		wr32(hdr + 16, e->crc);
+		wr32(hdr + 20, (uint32_t)e->comp_size);
+		wr32(hdr + 24, (uint32_t)e->size);
+		wr16(hdr + 28, e->name_len);
+		wr16(hdr + 30, big_offset ? 12 : 0);
+		wr16(hdr + 32, 0);
+		wr16(hdr + 34, 0);
+		wr16(hdr + 36, 0);
+		wr32(hdr + 38, 0100644u << 16);
+		wr32(hdr + 42, big_offset ? 0xffffffff : (uint32_t)e->local_offset);
+
+		zip_write(zw, hdr, sizeof(hdr));
+		zip_write(zw, (char*)zw->names.buf + e->name, e->name_len);
+
+		if (big_offset) {
+			uint8_t extra[12];
+			wr16(extra, 0x0001);
+			wr16(extra + 2, 8);
+			wr64(extra + 4, e->local_offset);
+			zip_write(zw, extra, sizeof(extra));
+		}
+	}
+
+	uint64_t dir_size = zw->offset - dir_offset;
+	uint64_t n_entries = zw->entries.n;
+
+	if (n_entries >= 0xffff || dir_offset >= 0xffffffff || dir_size >= 0xffffffff) {
+		uint64_t end64_offset = zw->offset;
+
+		uint8_t end64[ZIP64_END_SIZE];
+		wr32(end64, ZIP64_END_SIG);
+		wr64(end64 + 4, ZIP64_END_SIZE - 12);
+		wr16(end64 + 12, (3 << 8) | ZIP64_VERSION);
+		wr16(end64 + 14, ZIP64_VERSION);
+		wr32(end64 + 16, 0);
+		wr32(end64 + 20, 0);
+		wr64(end64 + 24, n_entries);
+		wr64(end64 + 32, n_entries);
+		wr64(end64 + 40, dir_size);
+		wr64(end64 + 48, dir_offset);
+		zip_write(zw, end64, sizeof(end64));
+
+		uint8_t locator[ZIP64_LOCATOR_SIZE];
+		wr32(locator, ZIP64_LOCATOR_SIG);
+		wr32(locator + 4, 0);
+		wr64(locator + 8, end64_offset);
+		wr32(locator + 16, 1);
+		zip_write(zw, locator, sizeof(locator));
+	}
+
+	uint8_t end[ZIP_END_SIZE];
+	wr32(end, ZIP_END_SIG);
+	wr16(end + 4, 0);
+	wr16(end + 6, 0);
+	wr16(end + 8, n_entries >= 0xffff ? 0xffff : n_entries);
+	wr16(end + 10, n_entries >= 0xffff ? 0xffff : n_entries);
+	wr32(end + 12, dir_size >= 0xffffffff ? 0xffffffff : (uint32_t)dir_size);
+	wr32(end + 16, dir_offset >= 0xffffffff ? 0xffffffff : (uint32_t)dir_offset);
+	wr16(end + 20, 0);
+	zip_write(zw, end, sizeof(end));
+
+	bool ok = !zw->failed;
+	if (zw->owns_fd && close(zw->fd) != 0)
+		ok = false;
+
+	vector_free(&zw->entries);
+	vector_free(&zw->names);
+	free(zw);
+	return ok;
+}